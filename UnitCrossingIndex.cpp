@@ -0,0 +1,150 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <cmath>
+
+#include "UnitCrossingIndex.h"
+#include "UnitParallel.h"
+
+using namespace std;
+using namespace tf_gd_lib;
+
+void CrossingIndex::Clear()
+{
+	M = 0;
+	Centers.Release();
+	Offsets.Release();
+	LoVals.Release();
+	HiVals.Release();
+	LoIds.Release();
+	HiIds.Release();
+}
+//---------------------------------------------------------------------------
+
+void CrossingIndex::Build(const double *Lo, const double *Hi, size_t m, size_t ThreadsCount)
+{
+	Clear();
+
+	vector<double> centers;
+	centers.reserve(m);
+	for (size_t j = 0; j < m; ++j)
+		if (!std::isnan(Lo[j]) && !std::isnan(Hi[j]))
+			centers.push_back(Lo[j]);
+	sort(centers.begin(), centers.end());
+
+	size_t c = centers.size();
+
+	// the node of an interval is the first one on the way down whose center it contains;
+	// Lo itself is one of the centers, so the way never runs out of nodes
+	const size_t NoNode = ~size_t(0);
+	vector<size_t> node(m, NoNode);
+
+	size_t chunks = GetChunksCount(m, ThreadsCount, MinChunkForThread);
+	ParallelFor(m, chunks, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t j = begin; j < end; ++j)
+			{
+				if (std::isnan(Lo[j]) || std::isnan(Hi[j]))
+					continue;
+
+				size_t l = 0, r = c;
+				while (l < r)
+				{
+					size_t mid = l + (r - l) / 2;
+					if (Hi[j] < centers[mid])
+						r = mid;
+					else if (Lo[j] > centers[mid])
+						l = mid + 1;
+					else
+					{
+						node[j] = mid;
+						break;
+					}
+				}
+			}
+		});
+
+	// counting sort by the node
+	vector<size_t> offsets(c + 1, 0);
+	for (size_t j = 0; j < m; ++j)
+		if (node[j] != NoNode)
+			++offsets[node[j] + 1];
+	for (size_t k = 0; k < c; ++k)
+		offsets[k+1] += offsets[k];
+
+	vector<size_t> lo_ids(c ? offsets[c] : 0);
+	{
+		vector<size_t> pos(offsets.begin(), offsets.end() - 1);
+		for (size_t j = 0; j < m; ++j)
+			if (node[j] != NoNode)
+				lo_ids[pos[node[j]]++] = j;
+	}
+	vector<size_t> hi_ids(lo_ids);
+
+	ParallelFor(c, GetChunksCount(c, ThreadsCount, MinChunkForThread), [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t k = begin; k < end; ++k)
+			{
+				auto b = offsets[k], e = offsets[k+1];
+				if (e - b < 2)
+					continue;
+				sort(lo_ids.begin() + b, lo_ids.begin() + e, [Lo](size_t i, size_t k) { return Lo[i] < Lo[k]; });
+				sort(hi_ids.begin() + b, hi_ids.begin() + e, [Hi](size_t i, size_t k) { return Hi[i] > Hi[k]; });
+			}
+		});
+
+	vector<double> lo_vals(lo_ids.size()), hi_vals(hi_ids.size());
+	for (size_t i = 0; i < lo_ids.size(); ++i)
+	{
+		lo_vals[i] = Lo[lo_ids[i]];
+		hi_vals[i] = Hi[hi_ids[i]];
+	}
+
+	M = m;
+	Centers.Assign(move(centers));
+	Offsets.Assign(move(offsets));
+	LoVals.Assign(move(lo_vals));
+	HiVals.Assign(move(hi_vals));
+	LoIds.Assign(move(lo_ids));
+	HiIds.Assign(move(hi_ids));
+}
+//---------------------------------------------------------------------------
+
+void CrossingIndex::Query(double y, vector<size_t> &js) const
+{
+	if (!IsBuilt() || std::isnan(y))
+		return;
+
+	const double *centers = Centers.data();
+	const size_t *offsets = Offsets.data();
+
+	size_t l = 0, r = Centers.size();
+	while (l < r)
+	{
+		size_t k = l + (r - l) / 2;
+		size_t b = offsets[k], e = offsets[k+1];
+
+		// all the intervals of the node contain its center, so only one of their ends has to be checked
+		if (y < centers[k])
+		{
+			for (size_t i = b; i < e && LoVals[i] <= y; ++i)
+				js.push_back(LoIds[i]);
+			r = k;
+		}
+		else if (y > centers[k])
+		{
+			for (size_t i = b; i < e && HiVals[i] >= y; ++i)
+				js.push_back(HiIds[i]);
+			l = k + 1;
+		}
+		else
+		{
+			js.insert(js.end(), LoIds.begin() + b, LoIds.begin() + e);
+			break;
+		}
+	}
+}
+//---------------------------------------------------------------------------
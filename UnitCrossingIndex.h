@@ -0,0 +1,54 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitCrossingIndexH
+#define UnitCrossingIndexH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <vector>
+
+#include "UnitSharedArray.h"
+
+namespace tf_gd_lib
+{
+
+// An index of the intervals of values [Lo[j], Hi[j]] of m segments of a curve, to find the segments
+// that a level y crosses (Lo[j] <= y <= Hi[j]). It's a centered interval tree: every node keeps
+// the intervals that contain its center sorted by Lo and by Hi, so a query goes down one path
+// and takes only the matching intervals from each node, O(log m + k) for k results.
+// The centers are the Lo values themselves, so the tree is implicit and takes O(m) memory.
+// Segments with NaN are never found. Copies share the index.
+class CrossingIndex
+{
+private:
+
+	size_t M = 0;
+
+	SharedArray<double> Centers;   // sorted Lo; node k (the middle of a range of them) has the center Centers[k]
+	SharedArray<size_t> Offsets;   // the intervals of node k are [Offsets[k], Offsets[k+1]) in the lists below
+
+	SharedArray<double> LoVals, HiVals;   // ascending Lo, descending Hi within each node
+	SharedArray<size_t> LoIds, HiIds;
+
+public:
+	static constexpr size_t MinChunkForThread = 32768;
+
+	void Build(const double* Lo, const double* Hi, size_t m, size_t ThreadsCount = 1);
+
+	// Appends the segments that y crosses to js, not ordered
+	void Query(double y, std::vector<size_t>& js) const;
+
+	size_t Size() const { return M; }
+	bool IsBuilt() const { return !Offsets.empty(); }
+
+	void Clear();
+};
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
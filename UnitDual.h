@@ -0,0 +1,128 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitDualH
+#define UnitDualH
+//---------------------------------------------------------------------------
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+namespace tf_gd_lib
+{
+
+// A dual number for forward-mode automatic differentiation by up to N variables:
+// a value and its partial derivatives, carried through arithmetic and the usual math functions
+// by the chain rule. A model written as a template of its number type, for example
+//     [](double x, const auto& p) { return p[0] * exp(-p[1] * x); }
+// gives exact derivatives by its parameters when it's called with Dual parameters (see GradDescent::SetDualModel).
+// Comparisons look at the values only, so branches work as usual.
+template <size_t N>
+struct Dual
+{
+	double v = 0.0;
+	std::array<double, N> d{};
+
+	Dual() = default;
+	Dual(double _v) : v(_v) {}                         // a constant
+	Dual(double _v, size_t i) : v(_v) { d[i] = 1.0; }  // the variable i
+
+	Dual& operator+=(const Dual& b) { v += b.v; for (size_t i = 0; i < N; ++i) d[i] += b.d[i]; return *this; }
+	Dual& operator-=(const Dual& b) { v -= b.v; for (size_t i = 0; i < N; ++i) d[i] -= b.d[i]; return *this; }
+	Dual& operator*=(const Dual& b)
+	{
+		for (size_t i = 0; i < N; ++i)
+			d[i] = d[i] * b.v + v * b.d[i];
+		v *= b.v;
+		return *this;
+	}
+	Dual& operator/=(const Dual& b)
+	{
+		double r = 1.0 / b.v, q = v * r;
+		for (size_t i = 0; i < N; ++i)
+			d[i] = (d[i] - q * b.d[i]) * r;
+		v = q;
+		return *this;
+	}
+
+	Dual& operator+=(double b) { v += b; return *this; }
+	Dual& operator-=(double b) { v -= b; return *this; }
+	Dual& operator*=(double b) { v *= b; for (auto& x : d) x *= b; return *this; }
+	Dual& operator/=(double b) { return *this *= 1.0 / b; }
+};
+//---------------------------------------------------------------------------
+
+// f(a) with f' = df at a.v
+template <size_t N>
+inline Dual<N> DualChain(const Dual<N>& a, double f, double df)
+{
+	Dual<N> r(f);
+	for (size_t i = 0; i < N; ++i)
+		r.d[i] = df * a.d[i];
+	return r;
+}
+//---------------------------------------------------------------------------
+
+template <size_t N> inline Dual<N> operator+(const Dual<N>& a) { return a; }
+template <size_t N> inline Dual<N> operator-(const Dual<N>& a) { return DualChain(a, -a.v, -1.0); }
+
+template <size_t N> inline Dual<N> operator+(Dual<N> a, const Dual<N>& b) { return a += b; }
+template <size_t N> inline Dual<N> operator-(Dual<N> a, const Dual<N>& b) { return a -= b; }
+template <size_t N> inline Dual<N> operator*(Dual<N> a, const Dual<N>& b) { return a *= b; }
+template <size_t N> inline Dual<N> operator/(Dual<N> a, const Dual<N>& b) { return a /= b; }
+
+template <size_t N> inline Dual<N> operator+(Dual<N> a, double b) { return a += b; }
+template <size_t N> inline Dual<N> operator-(Dual<N> a, double b) { return a -= b; }
+template <size_t N> inline Dual<N> operator*(Dual<N> a, double b) { return a *= b; }
+template <size_t N> inline Dual<N> operator/(Dual<N> a, double b) { return a /= b; }
+
+template <size_t N> inline Dual<N> operator+(double a, Dual<N> b) { return b += a; }
+template <size_t N> inline Dual<N> operator-(double a, const Dual<N>& b) { return -b + a; }
+template <size_t N> inline Dual<N> operator*(double a, Dual<N> b) { return b *= a; }
+template <size_t N> inline Dual<N> operator/(double a, const Dual<N>& b) { return DualChain(b, a / b.v, -a / (b.v * b.v)); }
+
+template <size_t N> inline bool operator<(const Dual<N>& a, const Dual<N>& b) { return a.v < b.v; }
+template <size_t N> inline bool operator>(const Dual<N>& a, const Dual<N>& b) { return a.v > b.v; }
+template <size_t N> inline bool operator<=(const Dual<N>& a, const Dual<N>& b) { return a.v <= b.v; }
+template <size_t N> inline bool operator>=(const Dual<N>& a, const Dual<N>& b) { return a.v >= b.v; }
+template <size_t N> inline bool operator==(const Dual<N>& a, const Dual<N>& b) { return a.v == b.v; }
+template <size_t N> inline bool operator!=(const Dual<N>& a, const Dual<N>& b) { return a.v != b.v; }
+
+template <size_t N> inline bool operator<(const Dual<N>& a, double b) { return a.v < b; }
+template <size_t N> inline bool operator>(const Dual<N>& a, double b) { return a.v > b; }
+template <size_t N> inline bool operator<(double a, const Dual<N>& b) { return a < b.v; }
+template <size_t N> inline bool operator>(double a, const Dual<N>& b) { return a > b.v; }
+template <size_t N> inline bool operator<=(const Dual<N>& a, double b) { return a.v <= b; }
+template <size_t N> inline bool operator>=(const Dual<N>& a, double b) { return a.v >= b; }
+template <size_t N> inline bool operator<=(double a, const Dual<N>& b) { return a <= b.v; }
+template <size_t N> inline bool operator>=(double a, const Dual<N>& b) { return a >= b.v; }
+template <size_t N> inline bool operator==(const Dual<N>& a, double b) { return a.v == b; }
+template <size_t N> inline bool operator!=(const Dual<N>& a, double b) { return a.v != b; }
+template <size_t N> inline bool operator==(double a, const Dual<N>& b) { return a == b.v; }
+template <size_t N> inline bool operator!=(double a, const Dual<N>& b) { return a != b.v; }
+
+template <size_t N> inline Dual<N> sin(const Dual<N>& a) { return DualChain(a, std::sin(a.v), std::cos(a.v)); }
+template <size_t N> inline Dual<N> cos(const Dual<N>& a) { return DualChain(a, std::cos(a.v), -std::sin(a.v)); }
+template <size_t N> inline Dual<N> tan(const Dual<N>& a) { double t = std::tan(a.v); return DualChain(a, t, 1.0 + t * t); }
+template <size_t N> inline Dual<N> atan(const Dual<N>& a) { return DualChain(a, std::atan(a.v), 1.0 / (1.0 + a.v * a.v)); }
+template <size_t N> inline Dual<N> exp(const Dual<N>& a) { double e = std::exp(a.v); return DualChain(a, e, e); }
+template <size_t N> inline Dual<N> log(const Dual<N>& a) { return DualChain(a, std::log(a.v), 1.0 / a.v); }
+template <size_t N> inline Dual<N> sqrt(const Dual<N>& a) { double s = std::sqrt(a.v); return DualChain(a, s, 0.5 / s); }
+template <size_t N> inline Dual<N> tanh(const Dual<N>& a) { double t = std::tanh(a.v); return DualChain(a, t, 1.0 - t * t); }
+template <size_t N> inline Dual<N> fabs(const Dual<N>& a) { return a.v < 0 ? -a : a; }
+template <size_t N> inline Dual<N> abs(const Dual<N>& a) { return fabs(a); }
+
+template <size_t N> inline Dual<N> pow(const Dual<N>& a, double b)
+{
+	return DualChain(a, std::pow(a.v, b), b * std::pow(a.v, b - 1.0));
+}
+template <size_t N> inline Dual<N> pow(const Dual<N>& a, const Dual<N>& b) { return exp(b * log(a)); }
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
@@ -3,205 +3,94 @@
 //    (See accompanying file LICENSE_1_0.txt or copy at
 //          https://www.boost.org/LICENSE_1_0.txt)
 
-#include <cassert>
-#include <array>
-
 #include "UnitGradDescent.h"
 
 using namespace std;
 using namespace tf_gd_lib;
 
-void GradDescent::CalcCost()
+void GradDescent::EvalModel(const vector<double> &p, const double *xs, double *ys, size_t m) const
 {
-    LastCost = 0;
-
-	if (IsUseUserTargetFunction)
+	if (BatchDstFunction)
 	{
-		LastCost = UserTargetFunction(Params);
+		BatchDstFunction(xs, ys, m, p);
+		return;
 	}
-	else
+
+	if (!DstFunction && JacobianFunction)   // the values only, the derivatives are dropped
 	{
-		double dfC;
-		for (size_t i = 0; i < SrcFunction.Size(); ++i)
-		{
-			dfC = SrcFunction.GetY(i) - DstFunction(SrcFunction.GetX(i), Params);
-			LastCost += dfC * dfC;
-		}
+		vector<double> J(m * p.size());
+		JacobianFunction(xs, ys, J.data(), m, p);
+		return;
 	}
+
+	for (size_t i = 0; i < m; ++i)
+		ys[i] = DstFunction(xs[i], p);
 }
 //---------------------------------------------------------------------------
 
-GradErrorType GradDescent::Go()
+double GradDescent::CalcCostFor(const vector<double> &p, bool Parallel) const
 {
-	TimeStart = ClockType::now();
-
-    size_t ParamsCount = Params.size();
-
-    array<size_t,4> sizes = {
-    	MinConstrains.size(),
-    	MaxConstrains.size(),
-    	RelConstrains.size(),
-    	TypeConstrains.size() }; // is ok to initialize in rinetime?
-
-    if ( !all_of(sizes.begin(), sizes.end(), [ParamsCount](size_t v){return v == ParamsCount;}) )
-    {
-        return GradErrorType::VectorSizesNotTheSame;
-    }
-
-    for (size_t i = 0; i < ParamsCount; ++i)
-    {
-        if (TypeConstrains[i])
-        {
-            //MinConstrains[i] = Params[i] - Params[i]*RelConstrains[i]/100.0;
-            //MaxConstrains[i] = Params[i] + Params[i]*RelConstrains[i]/100.0;
-			MinConstrains[i] = Params[i] * (100 - RelConstrains[i]) / 100.0;
-			MaxConstrains[i] = Params[i] * (100 + RelConstrains[i]) / 100.0;
-        }
-    }
-
-    Cur_Eta.resize(ParamsCount);
-    fill(Cur_Eta.begin(), Cur_Eta.end(), Min_Eta * Eta_FirstJump);
-
-    IsCalculating = true;
-
-    vector<double> dCost_dp(ParamsCount);
-
-    vector<double> dp(ParamsCount, 0); // fill(dp.begin(), dp.end(), 0.0);
-
-    vector<double> old_p(ParamsCount);
-
-    //size_t PointsCount = SrcFunction.Size();
-
-    double OldCost;
-    double dCost;
+	if (IsUseUserTargetFunction)
+		return UserTargetFunction(p);
 
-    CalcCost(); // calc Cost in the first time
-    OldCost = LastCost;
+	return GradDescentBase::CalcCostFor(p, Parallel);
+}
+//---------------------------------------------------------------------------
 
-    LastIters = 0;
+// out[0] - the cost of the block, out[1 + j] - its derivative by p[j]: -2 * sum of r[i] * J[i][j]
+void GradDescent::CalcBlockCostAndGradient(const vector<double> &p, size_t b, double *out, vector<double> &Scratch) const
+{
+	const double *X = SrcFunction.GetDataX(), *Y = SrcFunction.GetDataY();
+	size_t begin = b * CostBlockSize, m = min(SrcFunction.Size() - begin, CostBlockSize);
+	size_t P = p.size();
+
+	Scratch.resize(m * P);
+	double *J = Scratch.data();
+
+	double r[CostBlockSize];
+	JacobianFunction(X + begin, r, J, m, p);
+	if (BatchDstFunction || (DstFunction && !DualValues))   // the values of the model the cost is calculated by
+		EvalModel(p, X + begin, r, m);
+	for (size_t i = 0; i < m; ++i)
+		r[i] = Y[begin + i] - r[i];
+
+	out[0] = SumSquaresPairwise(r, m);
+
+	double *g = out + 1;
+	fill(g, g + P, 0.0);
+	for (size_t i = 0; i < m; ++i)
+		for (size_t j = 0; j < P; ++j)
+			g[j] += r[i] * J[i * P + j];
+	for (size_t j = 0; j < P; ++j)
+		g[j] *= -2.0;
+}
+//---------------------------------------------------------------------------
 
-    do
-    {
-        if (!IsCalculating)
-        {
-            return GradErrorType::CanceledByUser;
-        }
+double GradDescent::CalcCostAndGradient(const vector<double> &p, vector<double> &dCost_dp, bool Parallel) const
+{
+	size_t P = p.size();
+	size_t blocks = (SrcFunction.Size() + CostBlockSize - 1) / CostBlockSize;
 
-        fill(dCost_dp.begin(), dCost_dp.end(), 0.0);
-
-    	for (size_t j = 0; j < ParamsCount; ++j)
-        {
-            if (FinDifMethod)
-            {
-                Params[j] -= 2*Eps;
-
-                CalcCost();
-                double yL2 = LastCost;
-
-                Params[j] += Eps;
-                CalcCost();
-                double yL = LastCost;
-
-                Params[j] += 2*Eps;
-                CalcCost();
-                double yR = LastCost;
-
-                Params[j] += Eps;
-                CalcCost();
-                double yR2 = LastCost;
-
-                Params[j] -= 2*Eps;
-                CalcCost();
-
-                dCost_dp[j] = (yL2 - 8*yL + 8*yR - yR2)/(12.0*Eps);
-            }
-            else
-            {
-                Params[j] -= Eps;
-                CalcCost();
-
-                double yL = LastCost;
-                Params[j] += 2*Eps;
-                CalcCost();
-
-                double yR = LastCost;
-                Params[j] -= Eps; 
-                CalcCost();
-
-                dCost_dp[j] = (-yL+yR)/(2.0*Eps);
-            }
-        }
-
-        old_p = Params;
-
-        for (size_t j = 0; j < ParamsCount; ++j)
-        {
-            Params[j] -= Cur_Eta[j]*dCost_dp[j];
-            Params[j] += Alpha*dp[j];
-
-            if (Params[j] > MaxConstrains[j])
-                Params[j] = MaxConstrains[j];
-            if (Params[j] < MinConstrains[j])
-                Params[j] = MinConstrains[j];
-
-            dp[j] = Params[j] - old_p[j];
-
-            OldCost = LastCost;
-            CalcCost();
-            dCost = OldCost - LastCost;
-
-			if (dCost > 0)
-			{
-				Cur_Eta[j] *= Eta_k_inc;
-			}
-            else
-            {
-                if (Cur_Eta[j] > Min_Eta)
-                {
-                    Params[j] = old_p[j];
-                    dp[j] = 0;
+	fill(dCost_dp.begin(), dCost_dp.end(), 0.0);
+	if (!blocks)
+		return 0;
 
-                    Cur_Eta[j] /= Eta_k_dec;          	
-                }
-            }
+	// the sums of the blocks are combined pairwise, so the result doesn't depend on the threads
+	vector<double> parts(blocks * (P + 1));
+	if (!Parallel || !Pool || Pool->Size() < 2 || blocks < 2)
+	{
+		vector<double> scratch;
+		for (size_t b = 0; b < blocks; ++b)
+			CalcBlockCostAndGradient(p, b, parts.data() + b * (P + 1), scratch);
+	}
+	else
+	{
+		vector<vector<double>> scratch(Pool->Size());
+		Pool->Run(blocks, [&](size_t b, size_t w) { CalcBlockCostAndGradient(p, b, parts.data() + b * (P + 1), scratch[w]); });
+	}
 
-        }
-
-        ++LastIters;
-
-        if (LastIters > MaxIters)
-        {
-            IsCalculating = false;
-            return GradErrorType::ItersOverflow;
-        }
-
-        if (LastIters % CallBackFreq == 0)
-        {
-            TimeEnd = ClockType::now();
-            LastTime = (double)chrono::duration_cast<chrono::milliseconds>(TimeEnd - TimeStart).count();
-            LastTime /= 1.0e3;
-
-            if (LastTime > MaxTime)
-            {
-                IsCalculating = false;
-            	return GradErrorType::TimeOut;
-            }
-
-            if (Callback)
-            {
-                Callback();
-            }
-        }
-
-    }
-    while ( any_of(Cur_Eta.begin(), Cur_Eta.end(), [this](double v){return v > Min_Eta;}) );
-
-    TimeEnd = ClockType::now();
-    LastTime = (double)chrono::duration_cast<chrono::milliseconds>(TimeEnd - TimeStart).count();
-    LastTime /= 1.0e3;
-
-    IsCalculating = false;
-    return GradErrorType::Success;
+	for (size_t j = 0; j < P; ++j)
+		dCost_dp[j] = SumPairwise(0, blocks, [&](size_t b) { return parts[b * (P + 1) + 1 + j]; });
+	return SumPairwise(0, blocks, [&](size_t b) { return parts[b * (P + 1)]; });
 }
 //---------------------------------------------------------------------------
-
@@ -8,15 +8,25 @@
 #define UnitGradDescentH
 //---------------------------------------------------------------------------
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <limits>
+#include <memory>
 #include <vector>
 
 #include "UnitTableFunctions.h"
+#include "UnitParallel.h"
+#include "UnitDual.h"
 
 namespace tf_gd_lib
 {
 
 using DstFunctionType = std::function<double(double x, const std::vector<double>&)>;
+// A model over a block of x: ys[i] = f(xs[i], p) for i < n, so it can use SIMD across the points
+using BatchDstFunctionType = std::function<void(const double* xs, double* ys, size_t n, const std::vector<double>& p)>;
+// The same, and also the derivatives by the parameters: J[i*p.size() + j] = df(xs[i], p)/dp[j]
+using JacobianFunctionType = std::function<void(const double* xs, double* ys, double* J, size_t n, const std::vector<double>& p)>;
 using CallbackType = std::function<void()>;
 
 using UserTargetFunctionType = std::function<double(const std::vector<double>&)>;
@@ -29,17 +39,54 @@ enum class GradErrorType
 	VectorSizesNotTheSame,
 	CanceledByUser,
 	TimeOut,
-	ItersOverflow
+	ItersOverflow,
+	TooManyParams   // more parameters than the model takes (see GradDescent::SetDualModel)
 };
 
-class GradDescent
+// The number storage of GradDescentBase: std::array for a parameters count known at compile time (N > 0),
+// std::vector otherwise
+template <size_t N>
+struct GradParamsTraits
 {
+	using ParamsType = std::array<double, N>;
+	using FlagsType = std::array<bool, N>;
+
+	static ParamsType Zeros(size_t) { return ParamsType{}; }
+};
+
+template <>
+struct GradParamsTraits<0>
+{
+	using ParamsType = std::vector<double>;
+	using FlagsType = std::vector<bool>;
+
+	static ParamsType Zeros(size_t n) { return ParamsType(n, 0.0); }
+};
+//---------------------------------------------------------------------------
+
+// The settings, the cost by blocks, the finite differences and the iterations of Go, shared by
+// GradDescent (the model is a std::function of std::vector) and StaticGradDescent (the model is a type,
+// so it's inlined into the cost loop). Derived gives at least
+//     void EvalModel(const ParamsType& p, const double* xs, double* ys, size_t m) const;   // ys = f(xs, p)
+//     bool HasModel() const;
+// and can hide CalcCostFor, HasExactGradient, CalcCostAndGradient and MaxParamsCount.
+template <size_t N, typename Derived>
+class GradDescentBase
+{
+public:
+	using ParamsType = typename GradParamsTraits<N>::ParamsType;
+	using FlagsType = typename GradParamsTraits<N>::FlagsType;
+
 private:
+
+	Derived& Self() { return static_cast<Derived&>(*this); }
+	const Derived& Self() const { return static_cast<const Derived&>(*this); }
+
 protected:
 
 	double Min_Eta = 1e-6;
 
-	std::vector<double> Cur_Eta;
+	ParamsType Cur_Eta = GradParamsTraits<N>::Zeros(0);
 
 	double Eta_k_inc = 1.1;
 	double Eta_k_dec = 2.0;
@@ -50,26 +97,55 @@ protected:
 	size_t MaxIters = 15000;
 	double MaxTime = 20;
 
-	std::vector<double> Params;
-	std::vector<double> MinConstrains;
-	std::vector<double> MaxConstrains;
-	std::vector<double> RelConstrains;
-	std::vector<bool>   TypeConstrains;
+	ParamsType Params = GradParamsTraits<N>::Zeros(0);
+	ParamsType MinConstrains = GradParamsTraits<N>::Zeros(0);
+	ParamsType MaxConstrains = GradParamsTraits<N>::Zeros(0);
+	ParamsType RelConstrains = GradParamsTraits<N>::Zeros(0);
+	FlagsType  TypeConstrains = FlagsType();
 
 	size_t CallBackFreq = 10;
 
 	TableFunction SrcFunction;
-	DstFunctionType DstFunction = nullptr; // is it ok to use nullptr for std::function?
-	UserTargetFunctionType UserTargetFunction = nullptr;
-	
-	bool IsUseUserTargetFunction = false;
 
 	double LastCost = -1.0;
 
 	size_t LastIters = 0;
 	double LastTime = -1.0;
 
-	void CalcCost();
+	void CalcCost() { LastCost = Self().CalcCostFor(Params, true); }
+	double CalcCostFor(const ParamsType& p, bool Parallel = false) const;   // Parallel - the blocks go to the pool
+	double CalcBlockCost(const ParamsType& p, size_t b) const;
+	void EnsurePool();
+
+	// the finite differences of the cost by every parameter at p
+	void CalcGradient(const ParamsType& p, ParamsType& dCost_dp);
+
+	// no exact gradient unless Derived gives one
+	bool HasExactGradient() const { return false; }
+	double CalcCostAndGradient(const ParamsType& p, ParamsType&, bool Parallel) const { return Self().CalcCostFor(p, Parallel); }
+
+	// Go doesn't start with more parameters
+	size_t MaxParamsCount() const { return std::numeric_limits<size_t>::max(); }
+
+	// The sum of squares of r[0..n), pairwise: the halves are summed separately down to short runs,
+	// which are summed by four accumulators
+	static double SumSquaresPairwise(const double* r, size_t n);
+
+	// The pairwise sum of leaf(b) for b in [begin, end)
+	template <typename F>
+	static double SumPairwise(size_t begin, size_t end, F&& leaf)
+	{
+		if (end - begin == 1)
+			return leaf(begin);
+
+		size_t mid = begin + (end - begin) / 2;
+		return SumPairwise(begin, mid, leaf) + SumPairwise(mid, end, leaf);
+	}
+
+	size_t GradThreadsCount = 1;
+	std::unique_ptr<ThreadPool> Pool;          // kept between the iterations and the calls of Go
+	std::vector<ParamsType> WorkerParams;      // a copy of the parameters for every thread of the pool
+	std::vector<double> GradCosts;
 
 	std::chrono::time_point<ClockType> TimeStart, TimeEnd; // default values?
 
@@ -81,14 +157,20 @@ protected:
 	CallbackType Callback = nullptr;
 
 public:
-	GradDescent() = default;
-	~GradDescent() = default;
+	// The cost is summed by blocks of CostBlockSize points: the model values of a block are calculated
+	// into a buffer, the squares of the residuals are summed pairwise, and so are the sums of the blocks.
+	// The order of the additions is always the same, so the cost doesn't depend on the threads count,
+	// and its rounding error grows as log(n) instead of n.
+	static constexpr size_t CostBlockSize = 512;
+
+	GradDescentBase() = default;
+	~GradDescentBase() = default;
 
-	GradDescent(const GradDescent&) = delete;
-	GradDescent(GradDescent&&) = delete;
+	GradDescentBase(const GradDescentBase&) = delete;
+	GradDescentBase(GradDescentBase&&) = delete;
 
-	GradDescent& operator=(const GradDescent&) = delete;
-	GradDescent& operator=(GradDescent&&) = delete;
+	GradDescentBase& operator=(const GradDescentBase&) = delete;
+	GradDescentBase& operator=(GradDescentBase&&) = delete;
 
 	void SetMin_Eta(double _Min_Eta)             { Min_Eta = _Min_Eta; }
 	//void SetCur_Eta(std::vector<double>)       {;} // read only
@@ -101,7 +183,7 @@ public:
 	void SetCallBackFreq(size_t _CallBackFreq)   { CallBackFreq = _CallBackFreq; }
 
 	double GetMin_Eta() const              { return Min_Eta; }
-	std::vector<double> GetCur_Eta() const { return Cur_Eta; }
+	ParamsType GetCur_Eta() const          { return Cur_Eta; }
 	double GetEta_k_inc() const            { return Eta_k_inc; }
 	double GetEta_k_dec() const            { return Eta_k_dec; }
 	double GetEta_FirstJump() const        { return Eta_FirstJump; }
@@ -110,48 +192,49 @@ public:
 	double GetMaxTime() const              { return MaxTime; }
 	size_t GetCallBackFreq() const         { return CallBackFreq; }
 
-	void SetParams(const std::vector<double>& _Params) { Params = _Params; }
-	void SetMinConstrains(const std::vector<double>& _MinConstrains) { MinConstrains = _MinConstrains; }
-	void SetMaxConstrains(const std::vector<double>& _MaxConstrains) { MaxConstrains = _MaxConstrains; }
-	void SetRelConstrains(const std::vector<double>& _RelConstrains) { RelConstrains = _RelConstrains; }
-	void SetTypeConstrains(const std::vector<bool>& _TypeConstrains) { TypeConstrains = _TypeConstrains; }
+	void SetParams(const ParamsType& _Params) { Params = _Params; }
+	void SetMinConstrains(const ParamsType& _MinConstrains) { MinConstrains = _MinConstrains; }
+	void SetMaxConstrains(const ParamsType& _MaxConstrains) { MaxConstrains = _MaxConstrains; }
+	void SetRelConstrains(const ParamsType& _RelConstrains) { RelConstrains = _RelConstrains; }
+	void SetTypeConstrains(const FlagsType& _TypeConstrains) { TypeConstrains = _TypeConstrains; }
 
-	std::vector<double> GetParams() const         { return Params; }
-	std::vector<double> GetMinConstrains() const  { return MinConstrains; }
-	std::vector<double> GetMaxConstrains() const  { return MaxConstrains; }
-	std::vector<double> GetRelConstrains() const  { return RelConstrains; }
-	std::vector<bool>   GetTypeConstrains() const { return TypeConstrains; }
+	ParamsType GetParams() const         { return Params; }
+	ParamsType GetMinConstrains() const  { return MinConstrains; }
+	ParamsType GetMaxConstrains() const  { return MaxConstrains; }
+	ParamsType GetRelConstrains() const  { return RelConstrains; }
+	FlagsType  GetTypeConstrains() const { return TypeConstrains; }
 
 
-	void SetSrcFunction(const TableFunction& _SrcFunction) { SrcFunction = _SrcFunction; }
-
-	// to do: consider perfect forwarding?
-	void SetDstFunction(const DstFunctionType& _DstFunction) { DstFunction = _DstFunction; }
-	//DstFunctionType GetDstFunction() {return DstFunction;} // write only
+	void SetSrcFunction(const TableFunction& _SrcFunction) { SrcFunction = _SrcFunction; }  // the points are shared, not copied
 
 	void SetCallback(const CallbackType& _Callback) { Callback = _Callback; }
 
-	void SetUseUserTargetFunction(const UserTargetFunctionType& _UserTargetFunction) { UserTargetFunction = _UserTargetFunction; }
-	void SetIsUseUserTargetFunction(bool _IsUseUserTargetFunction) { IsUseUserTargetFunction = _IsUseUserTargetFunction; }
-	
 	double GetY(size_t i) const
 	{
-		if (DstFunction && SrcFunction.Size())
-			return DstFunction(SrcFunction.GetX(i), Params);
+		if (SrcFunction.Size())
+			return GetRandomY(SrcFunction.GetX(i));
 		else
 			return 0;
 	}
 
 	double GetRandomY(double x) const
 	{
-		if (DstFunction)
-			return DstFunction(x, Params);
-		else
-			return 0;
+		double y = 0;
+		if (Self().HasModel())
+			Self().EvalModel(Params, &x, &y, 1);
+		return y;
 	}
 
+	// The model at all x of SrcFunction (ys of its size), by blocks if there is a batch model
+	void GetYs(double* ys) const;
+
 	double GetLastCost() const { return LastCost; }
 
+	// The cost of the given parameters (the same one Go minimizes); split across the threads of SetGradThreadsCount
+	double CalcCostAt(const ParamsType& _Params);
+	// The same and its gradient, the one Go uses: exact with a Jacobian, otherwise by the finite differences
+	double CalcCostAndGradientAt(const ParamsType& _Params, ParamsType& Grad);
+
 	GradErrorType Go();
 
 	void Stop() { IsCalculating = false; }
@@ -164,8 +247,434 @@ public:
 
 	void SetFinDifMethod(bool _FinDifMethod) { FinDifMethod = _FinDifMethod; }
 	bool GetFinDifMethod() const { return FinDifMethod; }
+
+	// The cost evaluations of the finite differences (4 or 2 per parameter) are spread over a pool of threads,
+	// which is started once and kept between iterations and calls of Go; the other cost evaluations
+	// are split by blocks of points over the same threads. Every thread shifts its own copy
+	// of the parameters, so DstFunction (UserTargetFunction) must be safe to call from several threads.
+	// The costs are combined in a fixed order, so the result doesn't depend on the threads count.
+	// 1 (default) - the calling thread only, 0 - all hardware threads.
+	void SetGradThreadsCount(size_t _GradThreadsCount) { GradThreadsCount = _GradThreadsCount; }
+	size_t GetGradThreadsCount() const { return GradThreadsCount; }
 };
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+double GradDescentBase<N, Derived>::SumSquaresPairwise(const double* r, size_t n)
+{
+	if (n <= 32)
+	{
+		double s[4] = {0, 0, 0, 0};
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+			for (size_t k = 0; k < 4; ++k)
+				s[k] += r[i+k] * r[i+k];
+		for (; i < n; ++i)
+			s[0] += r[i] * r[i];
+		return (s[0] + s[1]) + (s[2] + s[3]);
+	}
 
+	size_t h = n / 2;
+	return SumSquaresPairwise(r, h) + SumSquaresPairwise(r + h, n - h);
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+void GradDescentBase<N, Derived>::GetYs(double* ys) const
+{
+	const double* X = SrcFunction.GetDataX();
+	size_t n = SrcFunction.Size();
+
+	if (!Self().HasModel())
+	{
+		std::fill(ys, ys + n, 0.0);
+		return;
+	}
+
+	for (size_t b = 0; b < n; b += CostBlockSize)
+		Self().EvalModel(Params, X + b, ys + b, std::min(CostBlockSize, n - b));
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+double GradDescentBase<N, Derived>::CalcBlockCost(const ParamsType& p, size_t b) const
+{
+	const double* X = SrcFunction.GetDataX();
+	const double* Y = SrcFunction.GetDataY();
+	size_t begin = b * CostBlockSize, m = std::min(SrcFunction.Size() - begin, CostBlockSize);
+
+	double r[CostBlockSize];
+	Self().EvalModel(p, X + begin, r, m);
+	for (size_t i = 0; i < m; ++i)
+		r[i] = Y[begin + i] - r[i];
+
+	return SumSquaresPairwise(r, m);
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+double GradDescentBase<N, Derived>::CalcCostFor(const ParamsType& p, bool Parallel) const
+{
+	size_t blocks = (SrcFunction.Size() + CostBlockSize - 1) / CostBlockSize;
+	if (!blocks)
+		return 0;
+
+	if (!Parallel || !Pool || Pool->Size() < 2 || blocks < 2)
+		return SumPairwise(0, blocks, [&](size_t b) { return CalcBlockCost(p, b); });
+
+	std::vector<double> sums(blocks);
+	Pool->Run(blocks, [&](size_t b, size_t) { sums[b] = CalcBlockCost(p, b); });
+	return SumPairwise(0, blocks, [&](size_t b) { return sums[b]; });
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+void GradDescentBase<N, Derived>::EnsurePool()
+{
+	if (!Pool || Pool->Size() != ResolveThreadsCount(GradThreadsCount))
+		Pool = std::make_unique<ThreadPool>(GradThreadsCount);
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+double GradDescentBase<N, Derived>::CalcCostAt(const ParamsType& _Params)
+{
+	EnsurePool();
+	return Self().CalcCostFor(_Params, true);
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+double GradDescentBase<N, Derived>::CalcCostAndGradientAt(const ParamsType& _Params, ParamsType& Grad)
+{
+	EnsurePool();
+	Grad = GradParamsTraits<N>::Zeros(_Params.size());
+
+	if (Self().HasExactGradient())
+		return Self().CalcCostAndGradient(_Params, Grad, true);
+
+	CalcGradient(_Params, Grad);
+	return Self().CalcCostFor(_Params, true);
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+void GradDescentBase<N, Derived>::CalcGradient(const ParamsType& p, ParamsType& dCost_dp)
+{
+	static const double Steps5[] = {-2, -1, 1, 2};   // the five-point stencil without its middle
+	static const double Steps3[] = {-1, 1};
+
+	size_t ParamsCount = p.size();
+	size_t k = FinDifMethod ? 4 : 2;
+	const double* steps = FinDifMethod ? Steps5 : Steps3;
+
+	EnsurePool();
+
+	WorkerParams.assign(Pool->Size(), p);
+	GradCosts.resize(ParamsCount * k);
+
+	// a task is one shifted parameter; the shift is set and undone exactly, so the copies stay equal to Params
+	Pool->Run(ParamsCount * k, [&](size_t t, size_t w)
+		{
+			ParamsType& q = WorkerParams[w];
+			size_t j = t / k;
+			q[j] = p[j] + steps[t % k] * Eps;
+			GradCosts[t] = Self().CalcCostFor(q);
+			q[j] = p[j];
+		});
+
+	for (size_t j = 0; j < ParamsCount; ++j)
+	{
+		const double* c = GradCosts.data() + j * k;
+		if (FinDifMethod)
+			dCost_dp[j] = (c[0] - 8*c[1] + 8*c[2] - c[3])/(12.0*Eps);
+		else
+			dCost_dp[j] = (-c[0] + c[1])/(2.0*Eps);
+	}
+}
+//---------------------------------------------------------------------------
+
+template <size_t N, typename Derived>
+GradErrorType GradDescentBase<N, Derived>::Go()
+{
+	TimeStart = ClockType::now();
+
+	size_t ParamsCount = Params.size();
+
+	std::array<size_t,4> sizes = {
+		MinConstrains.size(),
+		MaxConstrains.size(),
+		RelConstrains.size(),
+		TypeConstrains.size() }; // is ok to initialize in rinetime?
+
+	if ( !std::all_of(sizes.begin(), sizes.end(), [ParamsCount](size_t v){return v == ParamsCount;}) )
+	{
+		return GradErrorType::VectorSizesNotTheSame;
+	}
+
+	if (ParamsCount > Self().MaxParamsCount())
+		return GradErrorType::TooManyParams;
+
+	for (size_t i = 0; i < ParamsCount; ++i)
+	{
+		if (TypeConstrains[i])
+		{
+			//MinConstrains[i] = Params[i] - Params[i]*RelConstrains[i]/100.0;
+			//MaxConstrains[i] = Params[i] + Params[i]*RelConstrains[i]/100.0;
+			MinConstrains[i] = Params[i] * (100 - RelConstrains[i]) / 100.0;
+			MaxConstrains[i] = Params[i] * (100 + RelConstrains[i]) / 100.0;
+		}
+	}
+
+	Cur_Eta = GradParamsTraits<N>::Zeros(ParamsCount);
+	std::fill(Cur_Eta.begin(), Cur_Eta.end(), Min_Eta * Eta_FirstJump);
+
+	IsCalculating = true;
+
+	ParamsType dCost_dp = GradParamsTraits<N>::Zeros(ParamsCount);
+
+	ParamsType dp = GradParamsTraits<N>::Zeros(ParamsCount);
+
+	ParamsType old_p = GradParamsTraits<N>::Zeros(ParamsCount);
+
+	double OldCost;
+	double dCost;
+
+	EnsurePool();
+	CalcCost(); // calc Cost in the first time
+	OldCost = LastCost;
+
+	LastIters = 0;
+
+	do
+	{
+		if (!IsCalculating)
+		{
+			return GradErrorType::CanceledByUser;
+		}
+
+		std::fill(dCost_dp.begin(), dCost_dp.end(), 0.0);
+
+		// and the cost at Params, the one the steps below are compared with
+		if (Self().HasExactGradient())
+			LastCost = Self().CalcCostAndGradient(Params, dCost_dp, true);
+		else
+		{
+			CalcGradient(Params, dCost_dp);
+			CalcCost();
+		}
+
+		old_p = Params;
+
+		for (size_t j = 0; j < ParamsCount; ++j)
+		{
+			Params[j] -= Cur_Eta[j]*dCost_dp[j];
+			Params[j] += Alpha*dp[j];
+
+			if (Params[j] > MaxConstrains[j])
+				Params[j] = MaxConstrains[j];
+			if (Params[j] < MinConstrains[j])
+				Params[j] = MinConstrains[j];
+
+			dp[j] = Params[j] - old_p[j];
+
+			OldCost = LastCost;
+			CalcCost();
+			dCost = OldCost - LastCost;
+
+			if (dCost > 0)
+			{
+				Cur_Eta[j] *= Eta_k_inc;
+			}
+			else
+			{
+				if (Cur_Eta[j] > Min_Eta)
+				{
+					Params[j] = old_p[j];
+					dp[j] = 0;
+
+					Cur_Eta[j] /= Eta_k_dec;
+				}
+			}
+
+		}
+
+		++LastIters;
+
+		if (LastIters > MaxIters)
+		{
+			IsCalculating = false;
+			return GradErrorType::ItersOverflow;
+		}
+
+		if (LastIters % CallBackFreq == 0)
+		{
+			TimeEnd = ClockType::now();
+			LastTime = (double)std::chrono::duration_cast<std::chrono::milliseconds>(TimeEnd - TimeStart).count();
+			LastTime /= 1.0e3;
+
+			if (LastTime > MaxTime)
+			{
+				IsCalculating = false;
+				return GradErrorType::TimeOut;
+			}
+
+			if (Callback)
+			{
+				Callback();
+			}
+		}
+
+	}
+	while ( std::any_of(Cur_Eta.begin(), Cur_Eta.end(), [this](double v){return v > Min_Eta;}) );
+
+	TimeEnd = ClockType::now();
+	LastTime = (double)std::chrono::duration_cast<std::chrono::milliseconds>(TimeEnd - TimeStart).count();
+	LastTime /= 1.0e3;
+
+	IsCalculating = false;
+	return GradErrorType::Success;
+}
+//---------------------------------------------------------------------------
+
+class GradDescent : public GradDescentBase<0, GradDescent>
+{
+private:
+
+	friend class GradDescentBase<0, GradDescent>;
+
+protected:
+
+	DstFunctionType DstFunction = nullptr; // is it ok to use nullptr for std::function?
+	BatchDstFunctionType BatchDstFunction = nullptr;   // used instead of DstFunction if it's set
+	JacobianFunctionType JacobianFunction = nullptr;   // the exact gradient instead of the finite differences
+	size_t DualSize = 0;   // N of SetDualModel, the most parameters its JacobianFunction takes; 0 - any
+	bool DualValues = false;   // the values of JacobianFunction are the ones of DstFunction (SetDualModel)
+	UserTargetFunctionType UserTargetFunction = nullptr;
+	
+	bool IsUseUserTargetFunction = false;
+
+	double CalcCostFor(const std::vector<double>& p, bool Parallel = false) const;   // UserTargetFunction if it's used
+	void EvalModel(const std::vector<double>& p, const double* xs, double* ys, size_t m) const;   // ys = DstFunction(xs, p)
+	bool HasModel() const { return BatchDstFunction || DstFunction || JacobianFunction; }
+
+	// the cost and its exact gradient in one pass by JacobianFunction, by blocks the same way as the cost
+	bool HasExactGradient() const { return JacobianFunction && !IsUseUserTargetFunction; }
+	double CalcCostAndGradient(const std::vector<double>& p, std::vector<double>& dCost_dp, bool Parallel) const;
+	size_t MaxParamsCount() const { return HasExactGradient() && DualSize ? DualSize : std::numeric_limits<size_t>::max(); }
+	void CalcBlockCostAndGradient(const std::vector<double>& p, size_t b, double* out, std::vector<double>& Scratch) const;
+
+public:
+
+	GradDescent() = default;
+	~GradDescent() = default;
+
+	// to do: consider perfect forwarding?
+	void SetDstFunction(const DstFunctionType& _DstFunction) { DstFunction = _DstFunction; DualValues = false; }
+	//DstFunctionType GetDstFunction() {return DstFunction;} // write only
+
+	// The cost, GetY and the gradient call it by blocks of CostBlockSize points instead of DstFunction point by point
+	void SetBatchDstFunction(const BatchDstFunctionType& _BatchDstFunction) { BatchDstFunction = _BatchDstFunction; }
+
+	// Exact gradients. With a Jacobian of the model, Go gets the cost and its gradient by the parameters
+	// in one pass over the points, instead of 4 (FinDifMethod) or 2 cost passes per parameter, and Eps isn't used.
+	// The model values are taken from DstFunction or BatchDstFunction if one of them is set, in Go as well,
+	// so the cost is of one model; the values the Jacobian gives are used only without them.
+	void SetJacobianFunction(const JacobianFunctionType& _JacobianFunction)
+	{
+		JacobianFunction = _JacobianFunction;
+		DualSize = 0;
+		DualValues = false;
+	}
+
+	// A model written as a template of its number type, for example
+	//     [](double x, const auto& p) { return p[0] * sin(p[1] * x + p[2]); }
+	// is used both ways: with double parameters as DstFunction, and with Dual<N> ones for the Jacobian
+	// (forward-mode automatic differentiation). N is the most parameters it can take: Go returns TooManyParams
+	// with more of them, and CalcCostAndGradientAt gives NaN.
+	template <size_t N, typename F>
+	void SetDualModel(F f)
+	{
+		DstFunction = [f](double x, const std::vector<double>& p) { return f(x, p); };
+		DualSize = N;
+		DualValues = true;   // the same values as DstFunction, no need to evaluate it again
+		JacobianFunction = [f](const double* xs, double* ys, double* J, size_t n, const std::vector<double>& p)
+			{
+				size_t m = p.size();
+				if (m > N)   // the dual numbers are too short for these parameters; Go checks it beforehand
+				{
+					std::fill(ys, ys + n, std::nan(""));
+					std::fill(J, J + n * m, std::nan(""));
+					return;
+				}
+
+				std::vector<Dual<N>> dp(m);
+				for (size_t j = 0; j < m; ++j)
+					dp[j] = Dual<N>(p[j], j);
+
+				for (size_t i = 0; i < n; ++i)
+				{
+					Dual<N> y = f(xs[i], dp);
+					ys[i] = y.v;
+					std::copy(y.d.begin(), y.d.begin() + m, J + i * m);
+				}
+			};
+	}
+
+	void SetUseUserTargetFunction(const UserTargetFunctionType& _UserTargetFunction) { UserTargetFunction = _UserTargetFunction; }
+	void SetIsUseUserTargetFunction(bool _IsUseUserTargetFunction) { IsUseUserTargetFunction = _IsUseUserTargetFunction; }
+};
+//---------------------------------------------------------------------------
+
+// GradDescent for a model known at compile time: f(x, p) of any callable type Model,
+// where p is std::array<double, N> if N > 0, or std::vector<double> if N = 0 (any count).
+// The model isn't called through std::function, so it's inlined into the loop of the cost over a block,
+// and with N > 0 the parameters are a local copy of a fixed size, which the compiler can keep in registers.
+// The iterations, the settings and the results are the same as with GradDescent (it's the same code),
+// and so are the costs and the steps for the same model.
+template <typename Model, size_t N = 0>
+class StaticGradDescent : public GradDescentBase<N, StaticGradDescent<Model, N>>
+{
+private:
+
+	using Base = GradDescentBase<N, StaticGradDescent<Model, N>>;
+	friend Base;
+
+	Model F;
+
+protected:
+
+	void EvalModel(const typename Base::ParamsType& p, const double* xs, double* ys, size_t m) const
+	{
+		if constexpr (N > 0)
+		{
+			const typename Base::ParamsType q = p;   // not aliased by ys
+			for (size_t i = 0; i < m; ++i)
+				ys[i] = F(xs[i], q);
+		}
+		else
+		{
+			for (size_t i = 0; i < m; ++i)
+				ys[i] = F(xs[i], p);
+		}
+	}
+
+	bool HasModel() const { return true; }
+
+public:
+
+	explicit StaticGradDescent(Model _F = Model()) : F(std::move(_F)) {}
+	~StaticGradDescent() = default;
+};
+//---------------------------------------------------------------------------
+
+// auto gd = MakeStaticGradDescent<5>([](double x, const auto& p) { return p[0] * exp(-p[1] * x); });
+template <size_t N = 0, typename Model>
+StaticGradDescent<Model, N> MakeStaticGradDescent(Model f)
+{
+	return StaticGradDescent<Model, N>(std::move(f));
+}
+//---------------------------------------------------------------------------
 
 }
 
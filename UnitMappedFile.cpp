@@ -0,0 +1,160 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <fstream>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "UnitMappedFile.h"
+
+using namespace std;
+using namespace tf_gd_lib;
+
+bool MappedFile::Open(const string &FileName)
+{
+	Close();
+
+	if (Map(FileName) || Read(FileName))
+	{
+		Opened = true;
+		return true;
+	}
+
+	return false;
+}
+//---------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+bool MappedFile::Map(const string &FileName)
+{
+	HANDLE f = CreateFileA(FileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+						   OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(f, &size) || size.QuadPart == 0)  // an empty file can't be mapped
+	{
+		CloseHandle(f);
+		return false;
+	}
+
+	HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void *p = m ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!p)
+	{
+		if (m)
+			CloseHandle(m);
+		CloseHandle(f);
+		return false;
+	}
+
+	FileHandle = f;
+	MappingHandle = m;
+	MapBase = p;
+	Data = static_cast<const char*>(p);
+	DataSize = (size_t)size.QuadPart;
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void MappedFile::Close()
+{
+	if (MapBase)
+		UnmapViewOfFile(MapBase);
+	if (MappingHandle)
+		CloseHandle(MappingHandle);
+	if (FileHandle)
+		CloseHandle(FileHandle);
+
+	MapBase = FileHandle = MappingHandle = nullptr;
+
+	Buffer.clear();
+	Buffer.shrink_to_fit();
+	Data = nullptr;
+	DataSize = 0;
+	Opened = false;
+}
+//---------------------------------------------------------------------------
+
+#else
+
+bool MappedFile::Map(const string &FileName)
+{
+	int fd = open(FileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)  // an empty file can't be mapped
+	{
+		close(fd);
+		return false;
+	}
+
+	void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);  // the mapping stays valid
+
+	if (p == MAP_FAILED)
+		return false;
+
+	madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	MapBase = p;
+	Data = static_cast<const char*>(p);
+	DataSize = (size_t)st.st_size;
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void MappedFile::Close()
+{
+	if (MapBase)
+		munmap(MapBase, DataSize);
+
+	MapBase = nullptr;
+
+	Buffer.clear();
+	Buffer.shrink_to_fit();
+	Data = nullptr;
+	DataSize = 0;
+	Opened = false;
+}
+//---------------------------------------------------------------------------
+
+#endif
+
+bool MappedFile::Read(const string &FileName)
+{
+	ifstream f(FileName, ios::binary);
+	if (!f)
+		return false;
+
+	const size_t BlockSize = 1 << 22;
+
+	size_t size = 0;
+	while (f)
+	{
+		Buffer.resize(size + BlockSize);
+		f.read(Buffer.data() + size, BlockSize);
+		size += (size_t)f.gcount();
+	}
+	Buffer.resize(size);
+
+	Data = Buffer.data();
+	DataSize = size;
+	return true;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,62 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitMappedFileH
+#define UnitMappedFileH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace tf_gd_lib
+{
+
+// A read-only file mapped into memory (mmap on POSIX, a file mapping on Windows).
+// If the mapping isn't possible, the file is read into memory in large blocks instead.
+class MappedFile
+{
+private:
+
+	const char* Data = nullptr;
+	size_t DataSize = 0;
+	bool Opened = false;
+
+	void* MapBase = nullptr;          // what has to be unmapped
+	std::vector<char> Buffer;         // used if the file isn't mapped
+
+#ifdef _WIN32
+	void* FileHandle = nullptr;
+	void* MappingHandle = nullptr;
+#endif
+
+	bool Map(const std::string& FileName);
+	bool Read(const std::string& FileName);
+
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&&) = delete;
+	MappedFile& operator=(MappedFile&&) = delete;
+
+	bool Open(const std::string& FileName);
+	void Close();
+
+	bool IsOpen() const { return Opened; }
+	bool IsMapped() const { return MapBase != nullptr; }
+
+	const char* GetData() const { return Data; }
+	size_t Size() const { return DataSize; }
+};
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
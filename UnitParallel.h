@@ -0,0 +1,169 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitParallelH
+#define UnitParallelH
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tf_gd_lib
+{
+
+// 0 means "use all hardware threads"
+inline size_t ResolveThreadsCount(size_t ThreadsCount)
+{
+	if (ThreadsCount)
+		return ThreadsCount;
+
+	size_t hw = std::thread::hardware_concurrency();
+	return hw ? hw : 1;
+}
+//---------------------------------------------------------------------------
+
+// How many chunks to split n items into, so that every chunk has at least MinChunk items
+inline size_t GetChunksCount(size_t n, size_t ThreadsCount, size_t MinChunk)
+{
+	size_t t = ResolveThreadsCount(ThreadsCount);
+	size_t c = MinChunk ? n / MinChunk : n;
+	return std::max<size_t>(1, std::min(t, c));
+}
+//---------------------------------------------------------------------------
+
+// Splits [0, n) into ChunksCount contiguous ranges and calls f(begin, end, chunk) for each of them.
+// The last chunk is processed by the calling thread.
+template <typename F>
+void ParallelFor(size_t n, size_t ChunksCount, F&& f)
+{
+	if (ChunksCount <= 1 || n < 2)
+	{
+		f(size_t(0), n, size_t(0));
+		return;
+	}
+
+	ChunksCount = std::min(ChunksCount, n);
+
+	std::vector<std::thread> threads;
+	threads.reserve(ChunksCount - 1);
+
+	for (size_t k = 0; k + 1 < ChunksCount; ++k)
+		threads.emplace_back([&f, n, ChunksCount, k]()
+			{
+				f(n * k / ChunksCount, n * (k + 1) / ChunksCount, k);
+			});
+
+	f(n * (ChunksCount - 1) / ChunksCount, n, ChunksCount - 1);
+
+	for (auto& t : threads)
+		t.join();
+}
+//---------------------------------------------------------------------------
+
+// Threads that are started once and kept waiting for work, for many small parallel steps
+// (such as the iterations of GradDescent) where starting threads every time would cost too much.
+// The calling thread takes part in the work too, so a pool of one thread has no threads of its own.
+// Run must not be called concurrently or from inside a task.
+class ThreadPool
+{
+private:
+
+	std::vector<std::thread> Workers;
+
+	std::mutex Mutex;
+	std::condition_variable StartCV, DoneCV;
+	std::function<void(size_t)> Job;   // called with the index of a thread
+	size_t Generation = 0;
+	size_t Running = 0;
+	bool Quit = false;
+
+	void WorkerLoop(size_t w)
+	{
+		size_t seen = 0;
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			StartCV.wait(lock, [&]() { return Quit || Generation != seen; });
+			if (Quit)
+				return;
+			seen = Generation;
+			lock.unlock();
+
+			Job(w);
+
+			lock.lock();
+			if (!--Running)
+				DoneCV.notify_one();
+		}
+	}
+
+public:
+	explicit ThreadPool(size_t ThreadsCount)   // 0 - all hardware threads
+	{
+		size_t t = ResolveThreadsCount(ThreadsCount);
+		Workers.reserve(t - 1);
+		for (size_t w = 1; w < t; ++w)
+			Workers.emplace_back([this, w]() { WorkerLoop(w); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Quit = true;
+		}
+		StartCV.notify_all();
+		for (auto& t : Workers)
+			t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t Size() const { return Workers.size() + 1; }
+
+	// Calls f(task, thread) for every task in [0, n), thread < Size(); the free threads take the tasks in order
+	template <typename F>
+	void Run(size_t n, F&& f)
+	{
+		std::atomic<size_t> next{0};
+		auto job = [&](size_t w)
+			{
+				for (size_t t = next++; t < n; t = next++)
+					f(t, w);
+			};
+
+		if (Workers.empty() || n < 2)
+		{
+			job(0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			Job = job;
+			Running = Workers.size();
+			++Generation;
+		}
+		StartCV.notify_all();
+
+		job(0);
+
+		std::unique_lock<std::mutex> lock(Mutex);
+		DoneCV.wait(lock, [&]() { return Running == 0; });
+		Job = nullptr;
+	}
+};
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
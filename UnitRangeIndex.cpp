@@ -0,0 +1,150 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <cmath>
+
+#include "UnitRangeIndex.h"
+#include "UnitParallel.h"
+
+using namespace std;
+using namespace tf_gd_lib;
+
+// The better one of two positions; equal values are resolved by the position, so the order doesn't matter
+size_t RangeMinMaxIndex::MinOf(const double *Y, size_t a, size_t b)
+{
+	if (a == None)
+		return b;
+	if (b == None)
+		return a;
+	return (Y[b] < Y[a] || (Y[b] == Y[a] && b < a)) ? b : a;
+}
+//---------------------------------------------------------------------------
+
+size_t RangeMinMaxIndex::MaxOf(const double *Y, size_t a, size_t b)
+{
+	if (a == None)
+		return b;
+	if (b == None)
+		return a;
+	return (Y[b] > Y[a] || (Y[b] == Y[a] && b < a)) ? b : a;
+}
+//---------------------------------------------------------------------------
+
+void RangeMinMaxIndex::ScanBlock(const double *Y, size_t begin, size_t end, size_t &iMin, size_t &iMax)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		if (std::isnan(Y[i]))
+			continue;
+		if (iMin == None || Y[i] < Y[iMin] || (Y[i] == Y[iMin] && i < iMin))
+			iMin = i;
+		if (iMax == None || Y[i] > Y[iMax] || (Y[i] == Y[iMax] && i < iMax))
+			iMax = i;
+	}
+}
+//---------------------------------------------------------------------------
+
+void RangeMinMaxIndex::Clear()
+{
+	N = Leaves = 0;
+	MinTree.Release();
+	MaxTree.Release();
+}
+//---------------------------------------------------------------------------
+
+void RangeMinMaxIndex::Build(const double *Y, size_t n, size_t ThreadsCount)
+{
+	Clear();
+	if (!n)
+		return;
+
+	size_t blocks = (n + BlockSize - 1) / BlockSize;
+	size_t leaves = 1;
+	while (leaves < blocks)
+		leaves *= 2;
+
+	vector<size_t> mins(2 * leaves, None), maxs(2 * leaves, None);
+
+	size_t chunks = GetChunksCount(blocks, ThreadsCount, MinBlocksForThread);
+	ParallelFor(blocks, chunks, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t b = begin; b < end; ++b)
+				ScanBlock(Y, b * BlockSize, min(n, (b + 1) * BlockSize), mins[leaves + b], maxs[leaves + b]);
+		});
+
+	for (size_t k = leaves - 1; k > 0; --k)
+	{
+		mins[k] = MinOf(Y, mins[2*k], mins[2*k + 1]);
+		maxs[k] = MaxOf(Y, maxs[2*k], maxs[2*k + 1]);
+	}
+
+	N = n;
+	Leaves = leaves;
+	MinTree.Assign(move(mins));
+	MaxTree.Assign(move(maxs));
+}
+//---------------------------------------------------------------------------
+
+void RangeMinMaxIndex::Update(const double *Y, size_t i)
+{
+	size_t *mins = MinTree.GetMutable().data();
+	size_t *maxs = MaxTree.GetMutable().data();
+
+	size_t b = i / BlockSize;
+	size_t k = Leaves + b;
+
+	mins[k] = maxs[k] = None;
+	ScanBlock(Y, b * BlockSize, min(N, (b + 1) * BlockSize), mins[k], maxs[k]);
+
+	for (k /= 2; k > 0; k /= 2)
+	{
+		mins[k] = MinOf(Y, mins[2*k], mins[2*k + 1]);
+		maxs[k] = MaxOf(Y, maxs[2*k], maxs[2*k + 1]);
+	}
+}
+//---------------------------------------------------------------------------
+
+RangeExtremes RangeMinMaxIndex::Query(const double *Y, size_t begin, size_t end) const
+{
+	RangeExtremes r;
+	r.iMin = r.iMax = begin;
+	if (std::isnan(Y[begin]))
+		return r;
+
+	size_t iMin = None, iMax = None;
+
+	// whole blocks [bl, br), the rest is scanned
+	size_t bl = (begin + BlockSize - 1) / BlockSize, br = end / BlockSize;
+	if (bl >= br)
+		ScanBlock(Y, begin, end, iMin, iMax);
+	else
+	{
+		ScanBlock(Y, begin, bl * BlockSize, iMin, iMax);
+		ScanBlock(Y, br * BlockSize, end, iMin, iMax);
+
+		const size_t *mins = MinTree.data(), *maxs = MaxTree.data();
+		for (size_t l = bl + Leaves, h = br + Leaves; l < h; l /= 2, h /= 2)
+		{
+			if (l & 1)
+			{
+				iMin = MinOf(Y, iMin, mins[l]);
+				iMax = MaxOf(Y, iMax, maxs[l]);
+				++l;
+			}
+			if (h & 1)
+			{
+				--h;
+				iMin = MinOf(Y, iMin, mins[h]);
+				iMax = MaxOf(Y, iMax, maxs[h]);
+			}
+		}
+	}
+
+	r.iMin = iMin;   // Y[begin] isn't NaN, so both are found
+	r.iMax = iMax;
+	return r;
+}
+//---------------------------------------------------------------------------
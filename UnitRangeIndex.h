@@ -0,0 +1,66 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitRangeIndexH
+#define UnitRangeIndexH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+
+#include "UnitSharedArray.h"
+
+namespace tf_gd_lib
+{
+
+// Positions of the minimum and the maximum of Y[begin..end), the same ones as MinMaxReduce finds:
+// the first of equal values, NaN are skipped (unless Y[begin] is NaN, then it's both)
+struct RangeExtremes
+{
+	size_t iMin = 0, iMax = 0;
+};
+
+// An index for min/max queries over ranges of an array: a segment tree over blocks of BlockSize values.
+// A query scans at most two partial blocks and goes up the tree, O(BlockSize + log n);
+// a change of one value costs the same. The tree takes about 1/BlockSize of the array size.
+// It doesn't keep a pointer to the array, so the same array must be passed to every call.
+// Copies share the tree until one of them changes it.
+class RangeMinMaxIndex
+{
+private:
+
+	static constexpr size_t None = ~size_t(0);
+
+	size_t N = 0;
+	size_t Leaves = 0;   // a power of 2 >= the count of blocks
+
+	// nodes 1..2*Leaves-1 (node 1 is the root, the leaves start at Leaves): positions of the extremes of their blocks,
+	// None if all of them are NaN
+	SharedArray<size_t> MinTree, MaxTree;
+
+	static size_t MinOf(const double* Y, size_t a, size_t b);
+	static size_t MaxOf(const double* Y, size_t a, size_t b);
+	static void ScanBlock(const double* Y, size_t begin, size_t end, size_t& iMin, size_t& iMax);
+
+public:
+	static constexpr size_t BlockSize = 32;
+	static constexpr size_t MinBlocksForThread = 4096;
+
+	void Build(const double* Y, size_t n, size_t ThreadsCount = 1);
+	void Update(const double* Y, size_t i);   // after Y[i] has changed
+
+	// begin < end <= n
+	RangeExtremes Query(const double* Y, size_t begin, size_t end) const;
+
+	size_t Size() const { return N; }
+	bool IsBuilt() const { return Leaves != 0; }
+
+	void Clear();
+};
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
@@ -0,0 +1,270 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "UnitSearchIndex.h"
+
+using namespace std;
+using namespace tf_gd_lib;
+
+static inline unsigned Log2(size_t k)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll((unsigned long long)k);
+#else
+	unsigned r = 0;
+	while (k >>= 1)
+		++r;
+	return r;
+#endif
+}
+//---------------------------------------------------------------------------
+
+static inline unsigned TrailingOnes(size_t k)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(~(unsigned long long)k);
+#else
+	unsigned r = 0;
+	while (k & 1)
+	{
+		k >>= 1;
+		++r;
+	}
+	return r;
+#endif
+}
+//---------------------------------------------------------------------------
+
+size_t tf_gd_lib::GallopLowerBound(const double *X, size_t n, size_t i, double x, size_t MaxSteps)
+{
+	i = min(i, n);
+
+	if (i < n && X[i] < x)   // forward
+	{
+		size_t step = 1, lo = i, hi = i + 1;
+		while (hi < n && X[hi] < x)
+		{
+			lo = hi;
+			if (!--MaxSteps)
+			{
+				hi = n;
+				break;
+			}
+			step *= 2;
+			hi = lo + step;
+		}
+		hi = min(hi, n);
+
+		return lower_bound(X + lo + 1, X + hi, x) - X;
+	}
+
+	if (i == 0 || X[i-1] < x)
+		return i;
+
+	// backward: X[hi] >= x, the answer is in (lo, hi]
+	size_t step = 1, hi = i - 1, lo = hi;
+	while (lo > 0)
+	{
+		if (!--MaxSteps)
+		{
+			lo = 0;
+			break;
+		}
+		lo = hi > step ? hi - step : 0;
+		if (X[lo] < x)
+			break;
+		hi = lo;
+		step *= 2;
+	}
+
+	return lower_bound(X + lo, X + hi, x) - X;
+}
+//---------------------------------------------------------------------------
+
+void SearchIndex::Clear()
+{
+	Type = SearchIndexType::None;
+	N = 0;
+	X0 = InvStep = 0.0;
+	EytzHeight = 0;
+	EytzLastLevel = 0;
+
+	Buckets.clear();
+	Buckets.shrink_to_fit();
+	Eytz.clear();
+	Eytz.shrink_to_fit();
+}
+//---------------------------------------------------------------------------
+
+bool SearchIndex::Build(const double *X, size_t n, SearchIndexType type)
+{
+	Clear();
+
+	if (type == SearchIndexType::None)
+		return true;
+
+	if (n < 2 || !(X[0] < X[n-1]))
+		return false;
+
+	switch (type)
+	{
+	case SearchIndexType::Uniform:
+		return BuildUniform(X, n);
+	case SearchIndexType::Buckets:
+		return BuildBuckets(X, n, false);
+	case SearchIndexType::Eytzinger:
+		return BuildEytzinger(X, n);
+	default: // Auto
+		return BuildUniform(X, n) || BuildBuckets(X, n, true) || BuildEytzinger(X, n);
+	}
+}
+//---------------------------------------------------------------------------
+
+bool SearchIndex::BuildUniform(const double *X, size_t n)
+{
+	double dx = (X[n-1] - X[0]) / (n - 1);
+
+	// small deviations are allowed, they cost a step or two of FixUp
+	for (size_t i = 0; i < n; ++i)
+		if (!(fabs(X[i] - (X[0] + i*dx)) <= 0.01*dx))
+			return false;
+
+	Type = SearchIndexType::Uniform;
+	N = n;
+	X0 = X[0];
+	InvStep = 1.0 / dx;
+	return true;
+}
+//---------------------------------------------------------------------------
+
+bool SearchIndex::BuildBuckets(const double *X, size_t n, bool check)
+{
+	size_t nb = n;
+	X0 = X[0];
+	InvStep = nb / (X[n-1] - X[0]);
+
+	// a point goes to bucket floor((x - X0)*InvStep); that is a monotone function of x,
+	// so the answer for any x is always within its own bucket
+	auto bucket = [this, nb](double x)
+		{
+			double t = (x - X0) * InvStep;
+			return t <= 0 ? size_t(0) : (t >= nb - 1 ? nb - 1 : size_t(t));
+		};
+
+	Buckets.assign(nb + 1, n);
+
+	size_t k = 0, MaxCount = 0, start = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		size_t b = bucket(X[i]);
+		while (k <= b)
+		{
+			Buckets[k++] = i;
+			MaxCount = max(MaxCount, i - start);
+			start = i;
+		}
+	}
+	MaxCount = max(MaxCount, n - start);
+
+	if (check && MaxCount > MaxPointsInBucket)  // the grid is too far from uniform
+	{
+		Clear();
+		return false;
+	}
+
+	Type = SearchIndexType::Buckets;
+	N = n;
+	return true;
+}
+//---------------------------------------------------------------------------
+
+bool SearchIndex::BuildEytzinger(const double *X, size_t n)
+{
+	Eytz.resize(n + 1);
+
+	// in-order traversal of the implicit tree visits the nodes in sorted order
+	size_t i = 0;
+	auto fill_node = [&](auto &self, size_t k) -> void
+		{
+			if (k > n)
+				return;
+			self(self, 2*k);
+			Eytz[k] = X[i++];
+			self(self, 2*k + 1);
+		};
+	fill_node(fill_node, 1);
+
+	EytzHeight = Log2(n) + 1;
+	EytzLastLevel = n - ((size_t(1) << (EytzHeight - 1)) - 1);
+
+	Type = SearchIndexType::Eytzinger;
+	N = n;
+	return true;
+}
+//---------------------------------------------------------------------------
+
+size_t SearchIndex::FixUp(const double *X, size_t n, size_t i, double x) const
+{
+	while (i > 0 && X[i-1] >= x)
+		--i;
+	while (i < n && X[i] < x)
+		++i;
+	return i;
+}
+//---------------------------------------------------------------------------
+
+size_t SearchIndex::LowerBound(const double *X, size_t n, double x) const
+{
+	if (Type == SearchIndexType::None || n != N)
+		return lower_bound(X, X + n, x) - X;
+
+	if (!(x > X[0]))
+		return 0;
+	if (x > X[n-1])
+		return n;
+
+	switch (Type)
+	{
+	case SearchIndexType::Uniform:
+	{
+		double t = ceil((x - X0) * InvStep);
+		size_t i = t <= 0 ? 0 : (t >= n - 1 ? n - 1 : size_t(t));
+		return FixUp(X, n, i, x);
+	}
+	case SearchIndexType::Buckets:
+	{
+		double t = (x - X0) * InvStep;
+		size_t b = t <= 0 ? 0 : (t >= n - 1 ? n - 1 : size_t(t));
+		return lower_bound(X + Buckets[b], X + Buckets[b+1], x) - X;
+	}
+	default: // Eytzinger
+	{
+		const double *e = Eytz.data();
+		size_t k = 1;
+		while (k <= n)
+		{
+#if defined(__GNUC__)
+			__builtin_prefetch((const void*)((uintptr_t)e + (k << 4) * sizeof(double)));
+#endif
+			k = 2*k + (e[k] < x);
+		}
+		k >>= TrailingOnes(k) + 1;
+		if (!k)
+			return n;
+
+		// in-order rank of node k in a perfect tree of EytzHeight levels,
+		// minus the missing nodes of the last level that come before it (they have even ranks)
+		unsigned d = Log2(k);
+		size_t r = ((2*(k - (size_t(1) << d)) + 1) << (EytzHeight - 1 - d)) - 1;
+		size_t before = (r + 1) / 2;
+		return before > EytzLastLevel ? r - (before - EytzLastLevel) : r;
+	}
+	}
+}
+//---------------------------------------------------------------------------
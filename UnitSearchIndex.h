@@ -0,0 +1,79 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitSearchIndexH
+#define UnitSearchIndexH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <vector>
+
+namespace tf_gd_lib
+{
+
+enum class SearchIndexType
+{
+	None,       // plain binary search over x
+	Auto,       // Uniform if possible, then Buckets, then Eytzinger
+	Uniform,    // index is calculated from x, O(1)
+	Buckets,    // a table "x range -> first point", O(1) for near-uniform grids
+	Eytzinger   // a copy of x in BFS order, cache-friendly binary search for arbitrary grids
+};
+
+// Index of the first point with X[k] >= x (the same as std::lower_bound), searching from the hint i in either direction.
+// Gallops 1, 2, 4, ... points away and then does a binary search, so it costs O(log distance).
+// After MaxSteps doublings the target is considered far away, and the rest of the array is just bisected.
+size_t GallopLowerBound(const double* X, size_t n, size_t i, double x, size_t MaxSteps = 64);
+
+// An acceleration structure for searching in a sorted array of x.
+// It doesn't keep a pointer to the array, so the same array must be passed to LowerBound.
+// The index must be rebuilt after the array has been changed.
+class SearchIndex
+{
+private:
+
+	SearchIndexType Type = SearchIndexType::None;
+	size_t N = 0;
+
+	// Uniform and Buckets
+	double X0 = 0.0;
+	double InvStep = 0.0;
+
+	// Buckets: Buckets[k] is the first point with x >= X0 + k/InvStep
+	std::vector<size_t> Buckets;
+
+	// Eytzinger: Eytz[1..N] are x in BFS order of an implicit binary tree;
+	// a node is mapped back to the sorted order arithmetically, by the tree height and the last level size
+	std::vector<double> Eytz;
+	unsigned EytzHeight = 0;
+	size_t EytzLastLevel = 0;
+
+	static const size_t MaxPointsInBucket = 32;
+
+	bool BuildUniform(const double* X, size_t n);
+	bool BuildBuckets(const double* X, size_t n, bool check);
+	bool BuildEytzinger(const double* X, size_t n);
+
+	size_t FixUp(const double* X, size_t n, size_t i, double x) const;
+
+public:
+
+	// Returns false if the index can't be built for this array with the requested type
+	bool Build(const double* X, size_t n, SearchIndexType type = SearchIndexType::Auto);
+
+	// The same as std::lower_bound(X, X + n, x) - X
+	size_t LowerBound(const double* X, size_t n, double x) const;
+
+	SearchIndexType GetType() const { return Type; }
+	size_t Size() const { return N; }
+
+	void Clear();
+};
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
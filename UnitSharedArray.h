@@ -0,0 +1,145 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitSharedArrayH
+#define UnitSharedArrayH
+//---------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace tf_gd_lib
+{
+
+// An array that is shared by its copies (copy-on-write): a copy costs the same for any size,
+// and the data are copied only when one of the owners is about to change them.
+// The read-only part of the interface is the same as std::vector has.
+// The first elements can be dropped without moving the rest (EraseFront): the array starts at Offset
+// in the storage, which is compacted only when the dropped part gets larger than the array itself.
+template <typename T>
+class SharedArray
+{
+private:
+
+	std::shared_ptr<std::vector<T>> Data;   // nullptr - empty
+	size_t Offset = 0;                      // the first element in *Data
+
+	static const std::vector<T>& GetEmpty()
+	{
+		static const std::vector<T> Empty;
+		return Empty;
+	}
+
+	const std::vector<T>& Get() const { return Data ? *Data : GetEmpty(); }
+
+	// the data of this owner only; a shared array is copied without its dropped part
+	void MakeOwn()
+	{
+		if (!Data)
+		{
+			Data = std::make_shared<std::vector<T>>();
+			Offset = 0;
+		}
+		else if (Data.use_count() > 1)
+		{
+			Data = std::make_shared<std::vector<T>>(begin(), end());
+			Offset = 0;
+		}
+		else   // the last other owner may have just copied the data in another thread
+			std::atomic_thread_fence(std::memory_order_acquire);
+	}
+
+public:
+	SharedArray() = default;
+	explicit SharedArray(std::vector<T>&& v) : Data(std::make_shared<std::vector<T>>(std::move(v))) {}
+
+	size_t size() const { return Data ? Data->size() - Offset : 0; }
+	bool empty() const { return !size(); }
+
+	const T* data() const { return Get().data() + Offset; }
+	const T& operator[](size_t i) const { return (*Data)[Offset + i]; }
+	const T& front() const { return (*Data)[Offset]; }
+	const T& back() const { return Data->back(); }
+
+	typename std::vector<T>::const_iterator begin() const { return Get().begin() + Offset; }
+	typename std::vector<T>::const_iterator end() const { return Get().end(); }
+
+	// The own data of this owner for changing; they are copied first if they are shared,
+	// and moved to the front of the storage if the first elements were dropped.
+	// The reference and pointers into it are valid until the owner is copied or changed in another way.
+	std::vector<T>& GetMutable()
+	{
+		MakeOwn();
+		if (Offset)
+		{
+			Data->erase(Data->begin(), Data->begin() + Offset);
+			Offset = 0;
+		}
+		return *Data;
+	}
+
+	// The same without moving the data: the pointer to the first element, valid until the next change
+	T* MutableData()
+	{
+		MakeOwn();
+		return Data->data() + Offset;
+	}
+
+	void resize(size_t n)
+	{
+		MakeOwn();
+		Data->resize(Offset + n);
+	}
+
+	// Drops the first k elements; amortized O(k), the other owners keep them
+	void EraseFront(size_t k)
+	{
+		k = std::min(k, size());
+		if (!k)
+			return;
+
+		Offset += k;
+		if (!size())
+		{
+			Release();
+			return;
+		}
+
+		if (Offset > size())
+		{
+			if (Data.use_count() > 1)
+				Data = std::make_shared<std::vector<T>>(begin(), end());
+			else
+			{
+				std::atomic_thread_fence(std::memory_order_acquire);
+				Data->erase(Data->begin(), Data->begin() + Offset);
+			}
+			Offset = 0;
+		}
+	}
+
+	// Replaces the data without copying the old ones
+	void Assign(std::vector<T>&& v)
+	{
+		Data = std::make_shared<std::vector<T>>(std::move(v));
+		Offset = 0;
+	}
+	void Release()
+	{
+		Data.reset();
+		Offset = 0;
+	}
+
+	bool IsShared() const { return Data && Data.use_count() > 1; }
+	bool IsSameData(const SharedArray& other) const { return Data == other.Data && Offset == other.Offset && size() == other.size(); }
+};
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
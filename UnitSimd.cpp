@@ -0,0 +1,244 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+	#define TF_GD_LIB_X86_SIMD
+	#include <immintrin.h>
+#endif
+
+#include "UnitSimd.h"
+
+using namespace std;
+using namespace tf_gd_lib;
+
+// The kernels are built without contraction of a*b + c into FMA, so that all of them round the same way
+#if defined(__GNUC__) && !defined(__clang__)
+	#pragma GCC optimize("fp-contract=off")
+#elif defined(__clang__)
+	#pragma clang fp contract(off)
+#endif
+
+// branchless: the count of steps depends only on n, so the lanes go in lockstep
+static inline size_t LowerBoundScalar(const double *X, size_t n, double x)
+{
+	size_t base = 0;
+	while (n > 1)
+	{
+		size_t half = n / 2;
+		base = (X[base + half] < x) ? base + half : base;
+		n -= half;
+	}
+	return base + (X[base] < x);
+}
+//---------------------------------------------------------------------------
+
+static void LowerBoundsScalar(const double *X, size_t n, const double *xs, size_t *ks, size_t m)
+{
+	for (size_t t = 0; t < m; ++t)
+		ks[t] = LowerBoundScalar(X, n, xs[t]);
+}
+//---------------------------------------------------------------------------
+
+static void SplineSegmentValsScalar(const double *X, const double *A, const double *B, const double *C, const double *D,
+									const size_t *js, const double *xs, double *ys, size_t m)
+{
+	for (size_t t = 0; t < m; ++t)
+	{
+		size_t j = js[t];
+		double dx = (xs[t] - X[j]);
+		ys[t] = A[j] + (B[j] + (C[j] / 2. + D[j] * dx / 6.0) * dx) * dx;
+	}
+}
+//---------------------------------------------------------------------------
+
+#ifdef TF_GD_LIB_X86_SIMD
+
+static_assert(sizeof(size_t) == sizeof(long long), "lane indices are 64-bit");
+
+__attribute__((target("avx2")))
+static void LowerBoundsAVX2(const double *X, size_t n, const double *xs, size_t *ks, size_t m)
+{
+	size_t t = 0;
+	for (; t + 4 <= m; t += 4)
+	{
+		__m256d x = _mm256_loadu_pd(xs + t);
+		__m256i base = _mm256_setzero_si256();
+
+		for (size_t len = n; len > 1; )
+		{
+			size_t half = len / 2;
+			__m256i h = _mm256_set1_epi64x((long long)half);
+			__m256d v = _mm256_i64gather_pd(X, _mm256_add_epi64(base, h), 8);
+			__m256i lt = _mm256_castpd_si256(_mm256_cmp_pd(v, x, _CMP_LT_OQ));
+			base = _mm256_add_epi64(base, _mm256_and_si256(lt, h));
+			len -= half;
+		}
+
+		__m256i lt = _mm256_castpd_si256(_mm256_cmp_pd(_mm256_i64gather_pd(X, base, 8), x, _CMP_LT_OQ));
+		base = _mm256_sub_epi64(base, lt);   // lt is -1 where true
+		_mm256_storeu_si256((__m256i*)(ks + t), base);
+	}
+
+	LowerBoundsScalar(X, n, xs + t, ks + t, m - t);
+}
+//---------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void SplineSegmentValsAVX2(const double *X, const double *A, const double *B, const double *C, const double *D,
+								  const size_t *js, const double *xs, double *ys, size_t m)
+{
+	const __m256d two = _mm256_set1_pd(2.0), six = _mm256_set1_pd(6.0);
+
+	size_t t = 0;
+	for (; t + 4 <= m; t += 4)
+	{
+		__m256i j = _mm256_loadu_si256((const __m256i*)(js + t));
+		__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + t), _mm256_i64gather_pd(X, j, 8));
+
+		__m256d r = _mm256_div_pd(_mm256_mul_pd(_mm256_i64gather_pd(D, j, 8), dx), six);
+		r = _mm256_add_pd(_mm256_div_pd(_mm256_i64gather_pd(C, j, 8), two), r);
+		r = _mm256_add_pd(_mm256_i64gather_pd(B, j, 8), _mm256_mul_pd(r, dx));
+		r = _mm256_add_pd(_mm256_i64gather_pd(A, j, 8), _mm256_mul_pd(r, dx));
+		_mm256_storeu_pd(ys + t, r);
+	}
+
+	SplineSegmentValsScalar(X, A, B, C, D, js + t, xs + t, ys + t, m - t);
+}
+//---------------------------------------------------------------------------
+
+// _mm512_i64gather_pd leaves its source operand undefined, and GCC warns about it
+__attribute__((target("avx512f")))
+static inline __m512d Gather512(const double *p, __m512i idx)
+{
+	return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xFF, idx, p, 8);
+}
+//---------------------------------------------------------------------------
+
+__attribute__((target("avx512f")))
+static void LowerBoundsAVX512(const double *X, size_t n, const double *xs, size_t *ks, size_t m)
+{
+	size_t t = 0;
+	for (; t + 8 <= m; t += 8)
+	{
+		__m512d x = _mm512_loadu_pd(xs + t);
+		__m512i base = _mm512_setzero_si512();
+
+		for (size_t len = n; len > 1; )
+		{
+			size_t half = len / 2;
+			__m512i h = _mm512_set1_epi64((long long)half);
+			__m512d v = Gather512(X, _mm512_add_epi64(base, h));
+			__mmask8 lt = _mm512_cmp_pd_mask(v, x, _CMP_LT_OQ);
+			base = _mm512_mask_add_epi64(base, lt, base, h);
+			len -= half;
+		}
+
+		__mmask8 lt = _mm512_cmp_pd_mask(Gather512(X, base), x, _CMP_LT_OQ);
+		base = _mm512_mask_add_epi64(base, lt, base, _mm512_set1_epi64(1));
+		_mm512_storeu_si512((void*)(ks + t), base);
+	}
+
+	LowerBoundsScalar(X, n, xs + t, ks + t, m - t);
+}
+//---------------------------------------------------------------------------
+
+__attribute__((target("avx512f")))
+static void SplineSegmentValsAVX512(const double *X, const double *A, const double *B, const double *C, const double *D,
+									const size_t *js, const double *xs, double *ys, size_t m)
+{
+	const __m512d two = _mm512_set1_pd(2.0), six = _mm512_set1_pd(6.0);
+
+	size_t t = 0;
+	for (; t + 8 <= m; t += 8)
+	{
+		__m512i j = _mm512_loadu_si512((const void*)(js + t));
+		__m512d dx = _mm512_sub_pd(_mm512_loadu_pd(xs + t), Gather512(X, j));
+
+		__m512d r = _mm512_div_pd(_mm512_mul_pd(Gather512(D, j), dx), six);
+		r = _mm512_add_pd(_mm512_div_pd(Gather512(C, j), two), r);
+		r = _mm512_add_pd(Gather512(B, j), _mm512_mul_pd(r, dx));
+		r = _mm512_add_pd(Gather512(A, j), _mm512_mul_pd(r, dx));
+		_mm512_storeu_pd(ys + t, r);
+	}
+
+	SplineSegmentValsScalar(X, A, B, C, D, js + t, xs + t, ys + t, m - t);
+}
+//---------------------------------------------------------------------------
+
+#endif
+
+SimdLevel tf_gd_lib::GetMaxSimdLevel()
+{
+#ifdef TF_GD_LIB_X86_SIMD
+	static const SimdLevel Max = __builtin_cpu_supports("avx512f") ? SimdLevel::AVX512 :
+								 (__builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : SimdLevel::Scalar);
+	return Max;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+//---------------------------------------------------------------------------
+
+static atomic<int>& CurrentLevel()
+{
+	static atomic<int> Level((int)GetMaxSimdLevel());
+	return Level;
+}
+//---------------------------------------------------------------------------
+
+SimdLevel tf_gd_lib::GetSimdLevel()
+{
+	return (SimdLevel)CurrentLevel().load(memory_order_relaxed);
+}
+//---------------------------------------------------------------------------
+
+bool tf_gd_lib::SetSimdLevel(SimdLevel Level)
+{
+	if ((int)Level > (int)GetMaxSimdLevel())
+		return false;
+
+	CurrentLevel().store((int)Level, memory_order_relaxed);
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void tf_gd_lib::LowerBounds(const double *X, size_t n, const double *xs, size_t *ks, size_t m)
+{
+	switch (GetSimdLevel())
+	{
+#ifdef TF_GD_LIB_X86_SIMD
+	case SimdLevel::AVX512:
+		LowerBoundsAVX512(X, n, xs, ks, m);
+		break;
+	case SimdLevel::AVX2:
+		LowerBoundsAVX2(X, n, xs, ks, m);
+		break;
+#endif
+	default:
+		LowerBoundsScalar(X, n, xs, ks, m);
+	}
+}
+//---------------------------------------------------------------------------
+
+void tf_gd_lib::SplineSegmentVals(const double *X, const double *A, const double *B, const double *C, const double *D,
+								  const size_t *js, const double *xs, double *ys, size_t m)
+{
+	switch (GetSimdLevel())
+	{
+#ifdef TF_GD_LIB_X86_SIMD
+	case SimdLevel::AVX512:
+		SplineSegmentValsAVX512(X, A, B, C, D, js, xs, ys, m);
+		break;
+	case SimdLevel::AVX2:
+		SplineSegmentValsAVX2(X, A, B, C, D, js, xs, ys, m);
+		break;
+#endif
+	default:
+		SplineSegmentValsScalar(X, A, B, C, D, js, xs, ys, m);
+	}
+}
+//---------------------------------------------------------------------------
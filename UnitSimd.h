@@ -0,0 +1,39 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitSimdH
+#define UnitSimdH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+
+namespace tf_gd_lib
+{
+
+// Instruction sets of the vectorized kernels. The best one supported by the CPU is chosen at runtime;
+// AVX2 and AVX-512 exist only in x86-64 builds by GCC or Clang, everywhere else it's always Scalar.
+// All of them give exactly the same results.
+enum class SimdLevel
+{
+	Scalar,
+	AVX2,
+	AVX512
+};
+
+SimdLevel GetMaxSimdLevel();   // supported by the CPU and the build
+SimdLevel GetSimdLevel();      // used now
+bool SetSimdLevel(SimdLevel Level);   // false (and nothing is changed) if Level isn't supported
+
+// ks[t] = lower_bound(X, X + n, xs[t]) - X for t < m, n > 0; every x is searched in its own lane
+void LowerBounds(const double* X, size_t n, const double* xs, size_t* ks, size_t m);
+
+// ys[t] = the value of the spline segment js[t] at xs[t] (the same arithmetic as SplineValByX)
+void SplineSegmentVals(const double* X, const double* A, const double* B, const double* C, const double* D,
+					   const size_t* js, const double* xs, double* ys, size_t m);
+
+} // namespace
+
+#endif
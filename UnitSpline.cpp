@@ -4,91 +4,866 @@
 //          https://www.boost.org/LICENSE_1_0.txt)
 
 //#include <cassert>
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 #include "UnitSpline.h"
+#include "UnitParallel.h"
+#include "UnitSimd.h"
 
 using namespace std;
 using namespace tf_gd_lib;
 
 bool CubicSpline::BuildSpline(const std::vector<SinglePoint> &Points)
 {
-    size_t n = Points.size();
+	vector<double> X(Points.size()), Y(Points.size());
+	for (size_t i = 0; i < Points.size(); ++i)
+	{
+		X[i] = Points[i].x;
+		Y[i] = Points[i].y;
+	}
 
-	if (n < 3) 
-		return false;
+	return BuildSpline(X.data(), Y.data(), X.size());
+}
+//---------------------------------------------------------------------------
+
+// Row i (1 <= i <= n-1) of the system for c: A*c[i-1] + C*c[i] + B*c[i+1] = F.
+// The last one, for c[n-1], is the row n-2 again without B, the same as CalcSplineCoefs has it.
+static inline void GetSplineRow(const double *X, const double *Y, size_t n, size_t i, double &A, double &C, double &B, double &F)
+{
+	size_t r = min(i, n - 2);
 
-	Splines.clear();
-	//Splines.reserve(n); // is it necessary before resize?
-	Splines.resize(n);
-	//Splines.shrink_to_fit(); // is it necessary after resize?
+	double h_i = X[r] - X[r-1], h_i1 = X[r+1] - X[r];
+	A = h_i;
+	C = 2.0 * (h_i + h_i1);
+	B = i < n - 1 ? h_i1 : 0.0;
+	F = 6.0 * ((Y[r+1] - Y[r]) / h_i1 - (Y[r] - Y[r-1]) / h_i);
+}
+//---------------------------------------------------------------------------
 
-	for (size_t i = 0; i < n; ++i)
+static inline void CalcSplineCoefsBD(const double *X, const double *Y, size_t begin, size_t end, double *b, const double *c, double *d)
+{
+	for (size_t i = begin; i < end; ++i)
 	{
-		Splines[i].x = Points[i].x;
-		Splines[i].a = Points[i].y;
+		double h_i = X[i] - X[i-1];
+		d[i] = (c[i] - c[i-1]) / h_i;
+		b[i] = h_i * (2.0 * c[i] + c[i-1]) / 6.0 + (Y[i] - Y[i-1]) / h_i;
 	}
-	Splines[0].c = 0.0;
+}
+//---------------------------------------------------------------------------
+
+// Coefficients b, c, d of the natural cubic spline for n >= 3 points (b[0] and d[0] aren't used);
+// work is 2*n doubles
+static void CalcSplineCoefs(const double *X, const double *Y, size_t n, double *b, double *c, double *d, double *work)
+{
+	c[0] = 0.0;
 
-	vector<double> alpha(n-1);
-	vector<double> beta(n-1);
+	double *alpha = work;
+	double *beta = work + n;
 
-	double A, B, C, F, h_i, h_i1, z;
+	double A = 0.0, B = 0.0, C = 0.0, F = 0.0, h_i, h_i1, z;
 	alpha[0] = beta[0] = 0.0;
 
 	for (size_t i = 1; i < n-1; ++i)
 	{
-		h_i = Points[i].x - Points[i-1].x, h_i1 = Points[i+1].x - Points[i].x;
+		h_i = X[i] - X[i-1], h_i1 = X[i+1] - X[i];
 		A = h_i;
 		C = 2.0 * (h_i + h_i1);
 		B = h_i1;
-		F = 6.0 * ((Points[i+1].y - Points[i].y) / h_i1 - (Points[i].y - Points[i-1].y) / h_i);
+		F = 6.0 * ((Y[i+1] - Y[i]) / h_i1 - (Y[i] - Y[i-1]) / h_i);
 		z = (A * alpha[i-1] + C);
 		alpha[i] = -B / z;
 		beta[i] = (F - A * beta[i-1]) / z;
 	}
 
-	Splines[n-1].c = (F - A * beta[n-2]) / (C + A * alpha[n-2]);
+	c[n-1] = (F - A * beta[n-2]) / (C + A * alpha[n-2]);
 
 	for (long long i = n - 2; i > 0; --i)
-		Splines[i].c = alpha[i] * Splines[i+1].c + beta[i];
+		c[i] = alpha[i] * c[i+1] + beta[i];
 
-	for (long long i = n - 1; i > 0; --i)
+	CalcSplineCoefsBD(X, Y, 1, n, b, c, d);
+}
+//---------------------------------------------------------------------------
+
+// The same system solved by chunks of unknowns in parallel (the partition method); work is 3*n + 4*chunks doubles.
+// The last unknown of every chunk but the last one is a separator. Inside a chunk
+// c[i] = y[i] + u[i]*(the left separator) + v[i]*(the right separator), which gives a small tridiagonal system
+// for the separators. The matrix is diagonally dominant, so the result differs from the serial one only by rounding.
+// Every chunk needs at least one unknown besides its separator, so there are at most N/2 of them.
+static void CalcSplineCoefsPartitioned(const double *X, const double *Y, size_t n, double *b, double *c, double *d,
+									   double *work, size_t chunks)
+{
+	size_t N = n - 1;   // the unknowns c[1..n-1]
+
+	chunks = min(chunks, N / 2);
+	if (chunks < 2)
+	{
+		CalcSplineCoefs(X, Y, n, b, c, d, work);
+		return;
+	}
+
+	auto chunk_begin = [N, chunks](size_t k) { return k < chunks ? 1 + N * k / chunks : N + 1; };
+
+	double *alpha = work, *u = work + n, *v = work + 2*n;
+	double *sa = work + 3*n, *sc = sa + chunks, *sb = sc + chunks, *sf = sb + chunks;   // the separators' rows
+
+	c[0] = 0.0;
+
+	// y (in c), u and v of the inner unknowns [s, t) of each chunk
+	ParallelFor(N, chunks, [=](size_t, size_t, size_t k)
+		{
+			size_t s = chunk_begin(k), t = chunk_begin(k + 1) - (k + 1 < chunks);
+			if (s >= t)   // can't happen after the clamp above
+				return;
+
+			double A = 0.0, C = 0.0, B = 0.0, F = 0.0, z = 1.0;
+			for (size_t i = s; i < t; ++i)
+			{
+				GetSplineRow(X, Y, n, i, A, C, B, F);
+				if (i == s)
+				{
+					z = C;
+					c[i] = F / z;
+					u[i] = -A / z;
+				}
+				else
+				{
+					z = A * alpha[i-1] + C;
+					c[i] = (F - A * c[i-1]) / z;
+					u[i] = -A * u[i-1] / z;
+				}
+				alpha[i] = i + 1 < t ? -B / z : 0.0;
+			}
+
+			v[t-1] = -B / z;
+			for (size_t i = t - 1; i-- > s; )
+			{
+				c[i] = alpha[i] * c[i+1] + c[i];
+				u[i] = alpha[i] * u[i+1] + u[i];
+				v[i] = alpha[i] * v[i+1];
+			}
+		});
+
+	// the separators q = chunk_begin(p+1) - 1, p < chunks - 1
+	size_t ns = chunks - 1;
+	for (size_t p = 0; p < ns; ++p)
+	{
+		size_t q = chunk_begin(p + 1) - 1;
+
+		double A = 0.0, C = 0.0, B = 0.0, F = 0.0;
+		GetSplineRow(X, Y, n, q, A, C, B, F);
+
+		sa[p] = p ? A * u[q-1] : 0.0;
+		sb[p] = C + A * v[q-1] + B * u[q+1];
+		sc[p] = p + 1 < ns ? B * v[q+1] : 0.0;
+		sf[p] = F - A * c[q-1] - B * c[q+1];
+	}
+
+	for (size_t p = 0; p < ns; ++p)
+	{
+		double z = p ? sb[p] + sa[p] * sc[p-1] : sb[p];
+		sc[p] = -sc[p] / z;
+		sf[p] = (sf[p] - (p ? sa[p] * sf[p-1] : 0.0)) / z;
+	}
+	for (size_t p = ns; p-- > 0; )
 	{
-		h_i = Points[i].x - Points[i-1].x;
-		Splines[i].d = (Splines[i].c - Splines[i-1].c) / h_i;
-		Splines[i].b = h_i * (2.0 * Splines[i].c + Splines[i-1].c) / 6.0 + (Points[i].y - Points[i-1].y) / h_i;
+		if (p + 1 < ns)
+			sf[p] += sc[p] * sf[p+1];
+		c[chunk_begin(p + 1) - 1] = sf[p];
 	}
 
+	// the inner unknowns, then b and d of the whole chunk
+	ParallelFor(N, chunks, [=](size_t, size_t, size_t k)
+		{
+			size_t s = chunk_begin(k), e = chunk_begin(k + 1), t = e - (k + 1 < chunks);
+			double left = c[s-1], right = k + 1 < chunks ? c[t] : 0.0;
+
+			for (size_t i = s; i < t; ++i)
+				c[i] += u[i] * left + v[i] * right;
+
+			CalcSplineCoefsBD(X, Y, s, e, b, c, d);
+		});
+}
+//---------------------------------------------------------------------------
+
+bool tf_gd_lib::NaturalSplineCoefs(const double *X, const double *Y, size_t n, double *b, double *c, double *d, size_t Chunks)
+{
+	if (n < 3)
+		return false;
+
+	vector<double> work(3 * n + 4 * max<size_t>(Chunks, 1));
+	if (Chunks > 1)
+		CalcSplineCoefsPartitioned(X, Y, n, b, c, d, work.data(), Chunks);
+	else
+		CalcSplineCoefs(X, Y, n, b, c, d, work.data());
+	b[0] = c[0] = d[0] = 0.0;
 	return true;
 }
 //---------------------------------------------------------------------------
 
-double CubicSpline::operator()(double x) const
+static inline double SegmentSlope(const double *X, const double *Y, size_t k)
+{
+	return (Y[k+1] - Y[k]) / (X[k+1] - X[k]);
+}
+//---------------------------------------------------------------------------
+
+static inline int Sign(double v)
+{
+	return (v > 0) - (v < 0);
+}
+//---------------------------------------------------------------------------
+
+// Akima's slope at the point k from the slopes of the segments k-2..k+1;
+// beyond the ends the segment slopes are extrapolated linearly
+static double AkimaSlope(const double *X, const double *Y, size_t n, size_t k)
+{
+	long long last = (long long)n - 2;   // the last segment
+
+	double s[4];
+	for (long long t = 0; t < 4; ++t)
+	{
+		long long q = (long long)k - 2 + t;
+		if (q < 0)
+		{
+			double d0 = SegmentSlope(X, Y, 0), d1 = SegmentSlope(X, Y, 1);
+			s[t] = d0 + q * (d1 - d0);
+		}
+		else if (q > last)
+		{
+			double d0 = SegmentSlope(X, Y, (size_t)last), d1 = SegmentSlope(X, Y, (size_t)last - 1);
+			s[t] = d0 + (q - last) * (d0 - d1);
+		}
+		else
+			s[t] = SegmentSlope(X, Y, (size_t)q);
+	}
+
+	double w1 = fabs(s[3] - s[2]), w2 = fabs(s[1] - s[0]);
+	if (w1 + w2 == 0.0)
+		return (s[1] + s[2]) / 2.0;
+
+	return (w1 * s[1] + w2 * s[2]) / (w1 + w2);
+}
+//---------------------------------------------------------------------------
+
+// The monotone slope (Fritsch-Carlson) at the point k, the same as PCHIP in SciPy and MATLAB
+static double PchipSlope(const double *X, const double *Y, size_t n, size_t k)
+{
+	// the ends: a three-point estimate that keeps the shape
+	if (k == 0 || k == n - 1)
+	{
+		size_t s0 = k ? n - 2 : 0, s1 = k ? n - 3 : 1;
+		double h0 = X[s0+1] - X[s0], h1 = X[s1+1] - X[s1];
+		double d0 = SegmentSlope(X, Y, s0), d1 = SegmentSlope(X, Y, s1);
+
+		double m = ((2.0 * h0 + h1) * d0 - h0 * d1) / (h0 + h1);
+		if (Sign(m) != Sign(d0))
+			return 0.0;
+		if (Sign(d0) != Sign(d1) && fabs(m) > 3.0 * fabs(d0))
+			return 3.0 * d0;
+		return m;
+	}
+
+	double d0 = SegmentSlope(X, Y, k - 1), d1 = SegmentSlope(X, Y, k);
+	if (Sign(d0) * Sign(d1) <= 0)   // an extremum
+		return 0.0;
+
+	double h0 = X[k] - X[k-1], h1 = X[k+1] - X[k];
+	double w0 = 2.0 * h1 + h0, w1 = h1 + 2.0 * h0;
+	return (w0 + w1) / (w0 / d0 + w1 / d1);
+}
+//---------------------------------------------------------------------------
+
+// Coefficients of the segments [jbegin, jend) of a local spline (1 <= jbegin < jend <= n), written in the same form
+// as of the natural spline: the Hermite cubic by the values and the slopes at both ends, expanded at X[j].
+// slopes is jend - jbegin + 1 doubles.
+static void CalcLocalSplineCoefs(SplineType Type, const double *X, const double *Y, size_t n, size_t jbegin, size_t jend,
+								 double *b, double *c, double *d, double *slopes)
+{
+	for (size_t k = jbegin - 1; k < jend; ++k)
+		slopes[k - (jbegin - 1)] = Type == SplineType::Akima ? AkimaSlope(X, Y, n, k) : PchipSlope(X, Y, n, k);
+
+	for (size_t j = jbegin; j < jend; ++j)
+	{
+		double m0 = slopes[j - jbegin], m1 = slopes[j - jbegin + 1];
+		double h = X[j] - X[j-1];
+		double delta = (Y[j] - Y[j-1]) / h;
+
+		b[j] = m1;
+		c[j] = (2.0 * m0 + 4.0 * m1 - 6.0 * delta) / h;
+		d[j] = 6.0 * (m0 + m1 - 2.0 * delta) / (h * h);
+	}
+}
+//---------------------------------------------------------------------------
+
+// A column of the spline of size n to be written over; its memory is reused if no copy shares it
+static double* PrepareColumn(SharedArray<double> &Column, size_t n)
+{
+	if (Column.IsShared())
+		Column.Release();
+
+	vector<double> &v = Column.GetMutable();
+	v.resize(n);
+	return v.data();
+}
+//---------------------------------------------------------------------------
+
+bool CubicSpline::BuildSpline(const double *X, const double *Y, size_t n, size_t ThreadsCount)
+{
+	if (n < 3) 
+		return false;
+
+	return BuildSpline(SharedArray<double>(vector<double>(X, X + n)), SharedArray<double>(vector<double>(Y, Y + n)),
+					   ThreadsCount);
+}
+//---------------------------------------------------------------------------
+
+bool CubicSpline::BuildSpline(const SharedArray<double> &X, const SharedArray<double> &Y, size_t ThreadsCount)
+{
+	size_t n = X.size();
+	if (n < 3 || Y.size() != n)
+		return false;
+
+	size_t chunks = GetChunksCount(n - 1, ThreadsCount, MinChunkForThread);
+	if (Type != SplineType::Natural)
+		Work.Data.resize(n + chunks);
+	else
+		Work.Data.resize(chunks > 1 ? 3 * n + 4 * chunks : 2 * n);
+
+	Index.reset();
+
+	// the knots and a (the values at the knots) are the points themselves
+	SplinesX = X;
+	SplinesA = Y;
+
+	double *b = PrepareColumn(SplinesB, n);
+	double *c = PrepareColumn(SplinesC, n);
+	double *d = PrepareColumn(SplinesD, n);
+	b[0] = c[0] = d[0] = 0.0;   // not used
+
+	SplinesI.Release();
+
+	if (Type != SplineType::Natural)
+	{
+		// every segment depends only on a few neighbouring points, so the chunks are independent
+		// (each one has its own slopes in work, with one more slope at the left)
+		double *work = Work.Data.data();
+		SplineType type = Type;
+		ParallelFor(n - 1, chunks, [=](size_t begin, size_t end, size_t k)
+			{
+				CalcLocalSplineCoefs(type, X.data(), Y.data(), n, begin + 1, end + 1, b, c, d, work + begin + k);
+			});
+	}
+	else if (chunks > 1)
+		CalcSplineCoefsPartitioned(X.data(), Y.data(), n, b, c, d, Work.Data.data(), chunks);
+	else
+		CalcSplineCoefs(X.data(), Y.data(), n, b, c, d, Work.Data.data());
+
+	return true;
+}
+//---------------------------------------------------------------------------
+
+bool CubicSpline::UpdateSpline(const SharedArray<double> &X, const SharedArray<double> &Y, size_t begin, size_t end)
+{
+	size_t n = X.size();
+	if (n < 3 || n != Size() || Y.size() != n || begin >= end || end > n)
+		return false;
+
+	size_t lo, hi;
+	if (Type == SplineType::Natural)
+	{
+		// the unknowns c[lo..hi]; the rows begin-1..end of the system have changed
+		lo = begin > UpdateMargin + 1 ? begin - 1 - UpdateMargin : 1;
+		hi = min(n - 1, end + UpdateMargin);
+	}
+	else
+	{
+		// the segments lo..hi; the slopes at the points begin-2..end+1 have changed
+		lo = begin > 2 ? begin - 2 : 1;
+		hi = min(n - 1, end + 2);
+	}
+	size_t m = hi - lo + 1;
+	if (2 * m > n)
+		return false;
+
+	// the knots and a are usually the points themselves, then they are already the new ones
+	if (!SplinesX.IsSameData(X))
+	{
+		vector<double> &v = SplinesX.GetMutable();
+		if (!equal(v.begin() + begin, v.begin() + end, X.begin() + begin))
+			Index.reset();   // it was built for the old knots
+		copy(X.begin() + begin, X.begin() + end, v.begin() + begin);
+	}
+
+	if (!SplinesA.IsSameData(Y))
+	{
+		vector<double> &v = SplinesA.GetMutable();
+		copy(Y.begin() + begin, Y.begin() + end, v.begin() + begin);
+	}
+
+	SplinesI.Release();
+
+	const double *x = SplinesX.data();
+	const double *a = SplinesA.data();
+	double *b = SplinesB.GetMutable().data();
+	double *c = SplinesC.GetMutable().data();
+	double *d = SplinesD.GetMutable().data();
+
+	if (Type != SplineType::Natural)
+	{
+		Work.Data.resize(max(Work.Data.size(), m + 1));
+		CalcLocalSplineCoefs(Type, x, a, n, lo, hi + 1, b, c, d, Work.Data.data());
+		return true;
+	}
+
+	// the same rows as in CalcSplineCoefs; c[lo-1] and c[hi+1] are taken as known
+	Work.Data.resize(max(Work.Data.size(), 2 * m));
+	double *alpha = Work.Data.data(), *beta = alpha + m;
+	for (size_t k = 0; k < m; ++k)
+	{
+		size_t i = lo + k;
+
+		double A, C, B, F;
+		GetSplineRow(x, a, n, i, A, C, B, F);
+
+		if (k == 0)
+		{
+			F -= A * c[i-1];
+			A = 0.0;
+		}
+		if (k == m - 1)
+		{
+			if (B != 0.0)
+				F -= B * c[i+1];
+			B = 0.0;
+		}
+
+		double z = k ? A * alpha[k-1] + C : C;
+		alpha[k] = -B / z;
+		beta[k] = (F - (k ? A * beta[k-1] : 0.0)) / z;
+	}
+
+	c[hi] = beta[m-1];
+	for (size_t k = m - 1; k-- > 0; )
+		c[lo+k] = alpha[k] * c[lo+k+1] + beta[k];
+
+	CalcSplineCoefsBD(x, a, lo, min(hi + 1, n - 1) + 1, b, c, d);
+
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void CubicSpline::SetCoefs(const double *X, const double *A, const double *B, const double *C, const double *D, size_t n)
 {
-	if (Splines.empty())  // If splines don't exist - return NaN
+	Clear();
+
+	SplinesX.Assign(vector<double>(X, X + n));
+	SplinesA.Assign(vector<double>(A, A + n));
+	SplinesB.Assign(vector<double>(B, B + n));
+	SplinesC.Assign(vector<double>(C, C + n));
+	SplinesD.Assign(vector<double>(D, D + n));
+}
+//---------------------------------------------------------------------------
+
+bool CubicSpline::HasKnots(const SharedArray<double> &X) const
+{
+	return SplinesX.IsSameData(X) || (SplinesX.size() == X.size() && equal(X.begin(), X.end(), SplinesX.begin()));
+}
+//---------------------------------------------------------------------------
+
+void CubicSpline::Clear()
+{
+	SplinesX.Release();
+	SplinesA.Release();
+	SplinesB.Release();
+	SplinesC.Release();
+	SplinesD.Release();
+	SplinesI.Release();
+
+	Index.reset();
+}
+//---------------------------------------------------------------------------
+
+void CubicSpline::ClearAndRelease()
+{
+	Clear();
+
+	Work.Data.clear();
+	Work.Data.shrink_to_fit();
+}
+//---------------------------------------------------------------------------
+
+bool CubicSpline::BuildSearchIndex(SearchIndexType type)
+{
+	auto idx = make_shared<SearchIndex>();
+	if (!idx->Build(SplinesX.data(), SplinesX.size(), type))
+		return false;
+
+	Index = idx;
+	return true;
+}
+//---------------------------------------------------------------------------
+
+// The segment for x, n >= 2
+static inline size_t SplineSegmentByX(const double *X, size_t n, const SearchIndex *Index, double x)
+{
+	if (x <= X[0])
+		return 1;
+	if (x >= X[n-1])
+		return n - 1;
+	if (Index)
+		return Index->LowerBound(X, n, x);
+	return lower_bound(X, X + n, x) - X;
+}
+//---------------------------------------------------------------------------
+
+// The derivative of the order 0..3 of the segment j at x
+static inline double SplineSegmentDeriv(const double *X, const double *A, const double *B, const double *C, const double *D,
+										size_t j, double x, unsigned Order)
+{
+	double dx = (x - X[j]);
+	switch (Order)
+	{
+	case 0:
+		return A[j] + (B[j] + (C[j] / 2. + D[j] * dx / 6.0) * dx) * dx;
+	case 1:
+		return B[j] + (C[j] + D[j] * dx / 2.0) * dx;
+	case 2:
+		return C[j] + D[j] * dx;
+	case 3:
+		return D[j];
+	default:
+		return 0.0;
+	}
+}
+//---------------------------------------------------------------------------
+
+double tf_gd_lib::SplineValByX(const double *X, const double *A, const double *B, const double *C, const double *D,
+							   size_t n, const SearchIndex *Index, double x)
+{
+	return SplineDerivByX(X, A, B, C, D, n, Index, x, 0);
+}
+//---------------------------------------------------------------------------
+
+double tf_gd_lib::SplineDerivByX(const double *X, const double *A, const double *B, const double *C, const double *D,
+								 size_t n, const SearchIndex *Index, double x, unsigned Order)
+{
+	if (!n)  // If splines don't exist - return NaN
 		return std::numeric_limits<double>::quiet_NaN();
+	if (n == 1)
+		return Order ? 0.0 : A[0];
+
+	return SplineSegmentDeriv(X, A, B, C, D, SplineSegmentByX(X, n, Index, x), x, Order);
+}
+//---------------------------------------------------------------------------
+
+// One thread's share of SplineValsByX, the same scheme as for the linear interpolation:
+// the first pass over a block finds segments, the second one evaluates them (both are vectorized, see UnitSimd.h).
+// Ascending runs of x are merged with the knots, short ones are looked up independently.
+static void SplineValsByXChunk(const double *X, const double *A, const double *B, const double *C, const double *D,
+							   size_t n, const SearchIndex *Index, const double *xs, double *ys, size_t m, unsigned Order)
+{
+	const size_t BlockSize = 256;
+	const size_t MinRunToMerge = 16;
+
+	size_t js[BlockSize];                    // segments
+	size_t pos[BlockSize], lbs[BlockSize];   // x left for the vectorized search, and what it has found
+	double xp[BlockSize];
+
+	// without an index, scattered x are searched together, a lane for each
+	bool batch_search = !Index || Index->GetType() == SearchIndexType::None;
+
+	size_t lb = 0;          // lower bound of the last x of the previous run
+	bool merging = false;   // the previous run was merged, and may go on in the next block
+
+	for (size_t blk = 0; blk < m; blk += BlockSize)
+	{
+		size_t bm = min(BlockSize, m - blk);
+		const double *x = xs + blk;
+		size_t np = 0;
+
+		size_t r = 0;
+		while (r < bm)
+		{
+			size_t e = r + 1;               // [r, e) is an ascending run
+			while (e < bm && x[e] >= x[e-1])
+				++e;
+
+			bool goes_on = merging && r == 0 && x[0] >= x[-1];
+			merging = goes_on || e - r >= MinRunToMerge;
+
+			for (size_t k = r; k < e; ++k)
+			{
+				if (merging && (k > r || goes_on))
+					lb = GallopLowerBound(X, n, lb, x[k], 4);
+				else if (merging || !batch_search)
+					lb = Index ? Index->LowerBound(X, n, x[k]) : lower_bound(X, X + n, x[k]) - X;
+				else
+				{
+					pos[np] = k;
+					xp[np++] = x[k];
+					continue;
+				}
+
+				// the same segment choice as in SplineValByX
+				js[k] = min(max<size_t>(lb, 1), n - 1);
+			}
+			r = e;
+		}
+
+		LowerBounds(X, n, xp, lbs, np);
+		for (size_t t = 0; t < np; ++t)
+			js[pos[t]] = min(max<size_t>(lbs[t], 1), n - 1);
+
+		if (!Order)
+			SplineSegmentVals(X, A, B, C, D, js, x, ys + blk, bm);
+		else
+			for (size_t k = 0; k < bm; ++k)
+				ys[blk + k] = SplineSegmentDeriv(X, A, B, C, D, js[k], x[k], Order);
+	}
+}
+//---------------------------------------------------------------------------
+
+void tf_gd_lib::SplineValsByX(const double *X, const double *A, const double *B, const double *C, const double *D,
+							  size_t n, const SearchIndex *Index, const double *xs, double *ys, size_t m, size_t ThreadsCount)
+{
+	SplineDerivsByX(X, A, B, C, D, n, Index, xs, ys, m, 0, ThreadsCount);
+}
+//---------------------------------------------------------------------------
+
+void tf_gd_lib::SplineDerivsByX(const double *X, const double *A, const double *B, const double *C, const double *D,
+								size_t n, const SearchIndex *Index, const double *xs, double *ys, size_t m,
+								unsigned Order, size_t ThreadsCount)
+{
+	if (!m)
+		return;
+
+	if (n < 2)
+	{
+		fill(ys, ys + m, n ? (Order ? 0.0 : A[0]) : numeric_limits<double>::quiet_NaN());
+		return;
+	}
+
+	size_t chunks = GetChunksCount(m, ThreadsCount, CubicSpline::MinChunkForThread);
+
+	ParallelFor(m, chunks, [=](size_t begin, size_t end, size_t)
+		{
+			SplineValsByXChunk(X, A, B, C, D, n, Index, xs + begin, ys + begin, end - begin, Order);
+		});
+}
+//---------------------------------------------------------------------------
+
+// Splits the segment j into monotone pieces: the ends and the extremes between them as dx from X[j]
+// (ascending) in t, the values in f; returns their count, 2..4. The values at the knots are exactly A.
+static size_t SplineSegmentPieces(const double *X, const double *A, const double *B, const double *C, const double *D,
+								  size_t j, double *t, double *f)
+{
+	double a = X[j-1] - X[j];
 
-	SplinePart s;
-	if (x <= Splines[0].x)
-		s = Splines[1];
-	else if (x >= Splines.back().x) 
-		s = Splines.back();
-	else 
+	// the roots of the derivative B + C*dx + D/2*dx^2
+	double r[2];
+	size_t nr = 0;
+	double qa = D[j] / 2.0, qb = C[j], qc = B[j];
+	if (qa == 0.0)
+	{
+		if (qb != 0.0)
+			r[nr++] = -qc / qb;
+	}
+	else
 	{
-		size_t i = 0, j = Splines.size() - 1;
-		while (i + 1 < j)
+		double disc = qb*qb - 4.0*qa*qc;
+		if (disc >= 0.0)
 		{
-			size_t k = i + (j - i) / 2;
-			if (x <= Splines[k].x)
-				j = k;
+			double q = -(qb + (qb < 0 ? -sqrt(disc) : sqrt(disc))) / 2.0;
+			r[nr++] = q / qa;
+			if (q != 0.0)
+				r[nr++] = qc / q;
+		}
+	}
+	if (nr == 2 && r[1] < r[0])
+		swap(r[0], r[1]);
+
+	size_t k = 0;
+	t[k] = a;
+	f[k++] = A[j-1];
+	for (size_t i = 0; i < nr; ++i)
+		if (r[i] > a && r[i] < 0.0 && r[i] > t[k-1])
+		{
+			t[k] = r[i];
+			f[k++] = SplineSegmentDeriv(X, A, B, C, D, j, X[j] + r[i], 0);
+		}
+	t[k] = 0.0;
+	f[k++] = A[j];
+	return k;
+}
+//---------------------------------------------------------------------------
+
+void tf_gd_lib::SplineSegmentRanges(const double *X, const double *A, const double *B, const double *C, const double *D,
+									size_t n, double *Lo, double *Hi, size_t ThreadsCount)
+{
+	if (n < 2)
+		return;
+
+	size_t chunks = GetChunksCount(n - 1, ThreadsCount, CubicSpline::MinChunkForThread);
+	ParallelFor(n - 1, chunks, [=](size_t begin, size_t end, size_t)
+		{
+			for (size_t j = begin + 1; j < end + 1; ++j)
+			{
+				double t[4], f[4];
+				size_t k = SplineSegmentPieces(X, A, B, C, D, j, t, f);
+
+				double lo = f[0], hi = f[0];
+				for (size_t i = 1; i < k; ++i)
+				{
+					lo = std::isnan(f[i]) ? f[i] : min(lo, f[i]);
+					hi = std::isnan(f[i]) ? f[i] : max(hi, f[i]);
+				}
+				Lo[j-1] = lo;
+				Hi[j-1] = hi;
+			}
+		});
+}
+//---------------------------------------------------------------------------
+
+void tf_gd_lib::SplineSolveSegment(const double *X, const double *A, const double *B, const double *C, const double *D,
+								   size_t j, double y, vector<double> &xs)
+{
+	double t[4], f[4];
+	size_t k = SplineSegmentPieces(X, A, B, C, D, j, t, f);
+
+	if (j == 1 && f[0] == y)
+		xs.push_back(X[0]);
+
+	// each piece takes its right end only, so a knot or an extreme is reported once
+	for (size_t i = 0; i + 1 < k; ++i)
+	{
+		double gl = f[i] - y, gr = f[i+1] - y;
+		if (gr == 0.0)
+		{
+			xs.push_back(X[j] + t[i+1]);
+			continue;
+		}
+		if (!(gl < 0.0 && gr > 0.0) && !(gl > 0.0 && gr < 0.0))
+			continue;
+
+		// Newton's method kept within the bracket, bisection if it steps out
+		double lo = t[i], hi = t[i+1], x = lo + (hi - lo) / 2.0;
+		for (int it = 0; it < 100; ++it)
+		{
+			double g = SplineSegmentDeriv(X, A, B, C, D, j, X[j] + x, 0) - y;
+			if (g == 0.0)
+				break;
+			if ((g < 0.0) == (gl < 0.0))
+			{
+				lo = x;
+				gl = g;
+			}
 			else
-				i = k;
+				hi = x;
+
+			double xn = x - g / SplineSegmentDeriv(X, A, B, C, D, j, X[j] + x, 1);
+			if (!(xn > lo && xn < hi))
+				xn = lo + (hi - lo) / 2.0;
+			if (xn == x || xn == lo || xn == hi)
+				break;
+			x = xn;
 		}
-		s = Splines[j];
+
+		xs.push_back(min(max(X[j] + x, X[j-1]), X[j]));
 	}
+}
+//---------------------------------------------------------------------------
+
+void CubicSpline::GetValsByX(const double *xs, double *ys, size_t m, size_t ThreadsCount) const
+{
+	SplineValsByX(SplinesX.data(), SplinesA.data(), SplinesB.data(), SplinesC.data(), SplinesD.data(),
+				  SplinesX.size(), Index.get(), xs, ys, m, ThreadsCount);
+}
+//---------------------------------------------------------------------------
+
+double CubicSpline::Derivative(double x, unsigned Order) const
+{
+	return SplineDerivByX(SplinesX.data(), SplinesA.data(), SplinesB.data(), SplinesC.data(), SplinesD.data(),
+						  SplinesX.size(), Index.get(), x, Order);
+}
+//---------------------------------------------------------------------------
+
+void CubicSpline::GetDerivativesByX(const double *xs, double *ys, size_t m, unsigned Order, size_t ThreadsCount) const
+{
+	SplineDerivsByX(SplinesX.data(), SplinesA.data(), SplinesB.data(), SplinesC.data(), SplinesD.data(),
+					SplinesX.size(), Index.get(), xs, ys, m, Order, ThreadsCount);
+}
+//---------------------------------------------------------------------------
 
-	double dx = (x - s.x);
-	return s.a + (s.b + (s.c / 2. + s.d * dx / 6.0) * dx) * dx;
+// The integral of the segment j from X[j] to x
+static inline double SplineSegmentIntegral(const double *X, const double *A, const double *B, const double *C, const double *D,
+										   size_t j, double x)
+{
+	double dx = (x - X[j]);
+	return (A[j] + (B[j] / 2. + (C[j] / 6. + D[j] * dx / 24.0) * dx) * dx) * dx;
+}
+//---------------------------------------------------------------------------
+
+bool CubicSpline::BuildIntegral()
+{
+	size_t n = Size();
+	if (n < 2)
+		return false;
+
+	const double *X = SplinesX.data();
+	const double *A = SplinesA.data(), *B = SplinesB.data(), *C = SplinesC.data(), *D = SplinesD.data();
+
+	double *I = PrepareColumn(SplinesI, n);
+	I[0] = 0.0;
+	for (size_t j = 1; j < n; ++j)
+		I[j] = I[j-1] - SplineSegmentIntegral(X, A, B, C, D, j, X[j-1]);
+
+	return true;
+}
+//---------------------------------------------------------------------------
+
+double CubicSpline::Integral(double x1, double x2) const
+{
+	size_t n = Size();
+	if (!IsIntegralExists() || n != SplinesI.size())
+		return numeric_limits<double>::quiet_NaN();
+
+	const double *X = SplinesX.data();
+	const double *A = SplinesA.data(), *B = SplinesB.data(), *C = SplinesC.data(), *D = SplinesD.data();
+	const double *I = SplinesI.data();
+
+	// the integral from X[0] to x
+	auto from_x0 = [&](double x)
+		{
+			size_t j = SplineSegmentByX(X, n, Index.get(), x);
+			return I[j] + SplineSegmentIntegral(X, A, B, C, D, j, x);
+		};
+
+	return from_x0(x2) - from_x0(x1);
+}
+//---------------------------------------------------------------------------
+
+double CubicSpline::Cursor::GetValByX(double x)
+{
+	const CubicSpline &s = *Spline;
+	size_t n = s.Size();
+	if (n < 2)
+		return s(x);
+
+	const double *X = s.SplinesX.data();
+	const double *A = s.SplinesA.data(), *B = s.SplinesB.data(), *C = s.SplinesC.data(), *D = s.SplinesD.data();
+
+	// the same segment choice as in SplineValByX
+	j = min(max<size_t>(GallopLowerBound(X, n, j, x), 1), n - 1);
+
+	double dx = (x - X[j]);
+	return A[j] + (B[j] + (C[j] / 2. + D[j] * dx / 6.0) * dx) * dx;
+}
+//---------------------------------------------------------------------------
+
+double CubicSpline::operator()(double x) const
+{
+	return SplineValByX(SplinesX.data(), SplinesA.data(), SplinesB.data(), SplinesC.data(), SplinesD.data(),
+						SplinesX.size(), Index.get(), x);
 }
 //---------------------------------------------------------------------------
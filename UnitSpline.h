@@ -8,8 +8,13 @@
 #define UnitSplineH
 //---------------------------------------------------------------------------
 
+#include <cstddef>
+#include <memory>
 #include <vector>
 
+#include "UnitSearchIndex.h"
+#include "UnitSharedArray.h"
+
 namespace tf_gd_lib
 {
 
@@ -20,27 +25,157 @@ struct SinglePoint
 	SinglePoint(double _x, double _y) : x(_x), y(_y) {}
 };
 
+// Natural - the global natural cubic spline (C2); a change of a point changes the whole spline a little.
+// Akima, Pchip - local C1 splines: the slope at a knot depends only on the neighbouring points
+// (Pchip keeps the data monotone between the knots and has no overshoots), so a change of a point changes
+// a few segments around it. All of them are kept and evaluated the same way.
+enum class SplineType
+{
+	Natural,
+	Akima,
+	Pchip
+};
+
+// Value of a spline given by columns: knots X and coefficients A, B, C, D of n segments (Index may be nullptr).
+// Segment j covers (X[j-1], X[j]]. Shared by CubicSpline and TableFunctionView.
+double SplineValByX(const double* X, const double* A, const double* B, const double* C, const double* D,
+					size_t n, const SearchIndex* Index, double x);
+
+// Batch evaluation: ys[k] = SplineValByX(..., xs[k]). Ascending runs of xs are merged with the knots,
+// so a sorted batch costs O(n + m); the rest falls back to a search. Large batches are split across threads.
+void SplineValsByX(const double* X, const double* A, const double* B, const double* C, const double* D,
+				   size_t n, const SearchIndex* Index, const double* xs, double* ys, size_t m, size_t ThreadsCount);
+
+// The same for derivatives of the order 0..3 (0 - the value itself, higher orders are 0),
+// calculated right from the coefficients
+double SplineDerivByX(const double* X, const double* A, const double* B, const double* C, const double* D,
+					  size_t n, const SearchIndex* Index, double x, unsigned Order);
+void SplineDerivsByX(const double* X, const double* A, const double* B, const double* C, const double* D,
+					 size_t n, const SearchIndex* Index, const double* xs, double* ys, size_t m,
+					 unsigned Order, size_t ThreadsCount);
+
+// Coefficients B, C, D of the natural spline through n >= 3 points (B[0], C[0], D[0] are 0), as BuildSpline
+// calculates them: serially if Chunks < 2, otherwise by the partition method in up to Chunks parallel chunks
+// (fewer if the chunks would be too short). false if n < 3.
+bool NaturalSplineCoefs(const double* X, const double* Y, size_t n, double* B, double* C, double* D, size_t Chunks);
+
+// For inverse queries (see TableFunction::SplineFindXsByY).
+// SplineSegmentRanges: the ranges of values [Lo[j-1], Hi[j-1]] of the segments j = 1..n-1 over their x,
+// including the overshoots between the knots; NaN if a segment has NaN.
+// SplineSolveSegment: appends the x of the segment j where the spline is y. The segment takes (X[j-1], X[j]]
+// (the first one also X[0]), so a knot shared by two segments is reported once.
+void SplineSegmentRanges(const double* X, const double* A, const double* B, const double* C, const double* D,
+						 size_t n, double* Lo, double* Hi, size_t ThreadsCount);
+void SplineSolveSegment(const double* X, const double* A, const double* B, const double* C, const double* D,
+						size_t j, double y, std::vector<double>& xs);
+
 class CubicSpline
 {
 private:
 
-	struct SplinePart
+	// coefficients are kept as columns (structure of arrays), the same way as they are stored in files;
+	// copies of a spline share them (copy-on-write)
+	SharedArray<double> SplinesX;     // knots
+	SharedArray<double> SplinesA, SplinesB, SplinesC, SplinesD;
+	SharedArray<double> SplinesI;     // integrals from X[0] to the knots, see BuildIntegral
+
+	std::shared_ptr<const SearchIndex> Index;
+
+	SplineType Type = SplineType::Natural;
+
+	// scratch memory of the builds, kept for the next ones; copies of the spline don't take it
+	struct BuildBuffer
 	{
-		double a, b, c, d, x;
-	};
+		std::vector<double> Data;
 
-	std::vector<SplinePart> Splines;
+		BuildBuffer() = default;
+		BuildBuffer(const BuildBuffer&) {}
+		BuildBuffer& operator=(const BuildBuffer&) { return *this; }
+	};
+	BuildBuffer Work;
 
 public:
+	// UpdateSpline solves the system of a natural spline again this far (in knots) around the changed points;
+	// the influence of a change decays at least twice per knot, so further on nothing changes.
+	// A local spline is recalculated for two knots around them.
+	static constexpr size_t UpdateMargin = 60;
+
+	// The type is used by the next BuildSpline; Clear doesn't change it
+	void SetType(SplineType _Type) { Type = _Type; }
+	SplineType GetType() const { return Type; }
+
+	// batch evaluation and the build are split across threads only if each thread gets at least this amount of x
+	static constexpr size_t MinChunkForThread = 32768;
 
 	bool BuildSpline(const std::vector<SinglePoint>& Points);
+	// ThreadsCount: 1 - the serial solver; otherwise (0 - all hardware threads) a large system is solved by chunks
+	// in parallel, and the result matches the serial one within rounding. A local spline is built by chunks
+	// in the same way, and its result doesn't depend on the threads count at all.
+	// Repeated builds reuse the memory of the previous one unless a copy of the spline shares it.
+	bool BuildSpline(const double* X, const double* Y, size_t n, size_t ThreadsCount = 1);
+	bool BuildSpline(const SharedArray<double>& X, const SharedArray<double>& Y, size_t ThreadsCount = 1);   // shares X and Y instead of copying
+
+	// Recalculates the spline after the points [begin, end) have changed, and neither their count nor order has.
+	// false if it isn't possible or a window is too big to be worth it, then BuildSpline is needed.
+	bool UpdateSpline(const SharedArray<double>& X, const SharedArray<double>& Y, size_t begin, size_t end);
+
+	// Sets already calculated coefficients (for example, read from a file); the type isn't changed
+	void SetCoefs(const double* X, const double* A, const double* B, const double* C, const double* D, size_t n);
 
 	double operator()(double x) const;
 
-	bool IsSplineExists() const { return !Splines.empty(); }
+	void GetValsByX(const double* xs, double* ys, size_t m, size_t ThreadsCount = 0) const;   // 0 - all hardware threads
+
+	// Derivatives of the order 1..3 (see SplineDerivByX)
+	double Derivative(double x, unsigned Order = 1) const;
+	void GetDerivativesByX(const double* xs, double* ys, size_t m, unsigned Order = 1, size_t ThreadsCount = 0) const;
+
+	// The integral over [x1, x2] (extrapolated the same way as the values) by the integrals from X[0] to the knots:
+	// they are calculated by BuildIntegral, then a query costs two searches by x. NaN without them;
+	// any change of the coefficients drops them.
+	bool BuildIntegral();
+	bool IsIntegralExists() const { return !SplinesI.empty(); }
+	double Integral(double x1, double x2) const;
+
+	// A position hint for sequential evaluation: the segment is searched from the last one in either direction
+	// by galloping, so a step costs O(log distance). The result is the same as of operator().
+	// A cursor must not outlive its spline or be used after the spline has changed.
+	class Cursor
+	{
+	private:
+		const CubicSpline* Spline;
+		size_t j;   // the segment (X[j-1], X[j]]
+
+	public:
+		explicit Cursor(const CubicSpline& _Spline, size_t _j = 1) : Spline(&_Spline), j(_j) {}
+
+		double GetValByX(double x);
+		double operator()(double x) { return GetValByX(x); }
+
+		size_t GetIndex() const { return j; }
+		void SetIndex(size_t _j) { j = _j; }
+	};
+
+	Cursor GetCursor(size_t j = 1) const { return Cursor(*this, j); }
+
+	bool IsSplineExists() const { return !SplinesX.empty(); }
+	size_t Size() const { return SplinesX.size(); }
+
+	const double* GetDataA() const { return SplinesA.data(); }
+	const double* GetDataB() const { return SplinesB.data(); }
+	const double* GetDataC() const { return SplinesC.data(); }
+	const double* GetDataD() const { return SplinesD.data(); }
+
+	// The index must be built for the same knots (see GetKnots); BuildSpline drops it
+	void SetSearchIndex(const std::shared_ptr<const SearchIndex>& _Index) { Index = _Index; }
+	bool BuildSearchIndex(SearchIndexType type = SearchIndexType::Auto);
+	SearchIndexType GetSearchIndexType() const { return Index ? Index->GetType() : SearchIndexType::None; }
+
+	const double* GetKnots() const { return SplinesX.data(); }
+	bool HasKnots(const SharedArray<double>& X) const;   // the spline is built for these x
 
-	void Clear() { Splines.clear(); };
-	void ClearAndRelease() { Splines.clear(); Splines.shrink_to_fit(); };
+	void Clear();
+	void ClearAndRelease();   // also frees the scratch memory of the builds
 };
 
 
@@ -0,0 +1,124 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "UnitTableFile.h"
+
+using namespace std;
+using namespace tf_gd_lib;
+
+bool TableFunctionView::Open(const string &FileName)
+{
+	Close();
+
+	auto f = make_shared<MappedFile>();
+	if (!f->Open(FileName) || f->Size() < sizeof(TableFileHeader))
+		return false;
+
+	const char *data = f->GetData();
+	size_t size = f->Size();
+
+	TableFileHeader h;
+	memcpy(&h, data, sizeof(h));
+
+	if (memcmp(h.Magic, TableFileMagic, sizeof(h.Magic)) != 0 ||
+		h.Version != TableFileVersion ||
+		h.ByteOrder != TableFileByteOrder ||
+		h.HasSpline > 1 + (uint64_t)SplineType::Pchip)
+		return false;
+
+	size_t n = (size_t)h.Count;
+
+	// a column must be aligned and fit in the file
+	auto column = [data, size, n](uint64_t offset, const double *&p)
+		{
+			p = nullptr;
+			if (!offset)
+				return true;
+			if (offset % sizeof(double) || offset > size || (size - offset) / sizeof(double) < n)
+				return false;
+			p = reinterpret_cast<const double*>(data + offset);
+			return true;
+		};
+
+	const double *x, *y, *coefs[4];
+	if (!column(h.ColumnOffsets[tfcX], x) || !column(h.ColumnOffsets[tfcY], y) || (n && (!x || !y)))
+		return false;
+
+	for (size_t k = 0; k < 4; ++k)
+		if (!column(h.HasSpline ? h.ColumnOffsets[tfcSplineA + k] : 0, coefs[k]) || (h.HasSpline && !coefs[k]))
+			return false;
+
+	if (h.NameOffset > size || size - h.NameOffset < h.NameSize)
+		return false;
+
+	// the points of the min and max must be in the table (both 0 for an empty one)
+	if (h.i_ForMinY >= max<uint64_t>(h.Count, 1) || h.i_ForMaxY >= max<uint64_t>(h.Count, 1))
+		return false;
+
+	File = f;
+	Header = h;
+	X = x;
+	Y = y;
+	for (size_t k = 0; k < 4; ++k)
+		Coefs[k] = coefs[k];
+	N = n;
+	Name.assign(data + h.NameOffset, (size_t)h.NameSize);
+
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void TableFunctionView::Close()
+{
+	File.reset();
+	Index.reset();
+
+	X = Y = nullptr;
+	for (auto &c : Coefs)
+		c = nullptr;
+	N = 0;
+
+	Header = TableFileHeader();
+	Name.clear();
+}
+//---------------------------------------------------------------------------
+
+double TableFunctionView::SplineVal(double x) const
+{
+	if (!IsSplineExists())
+		return numeric_limits<double>::quiet_NaN();
+
+	return SplineValByX(X, Coefs[0], Coefs[1], Coefs[2], Coefs[3], N, Index.get(), x);
+}
+//---------------------------------------------------------------------------
+
+void TableFunctionView::GetSplineValsByX(const double *xs, double *ys, size_t n) const
+{
+	if (!IsSplineExists())
+	{
+		fill(ys, ys + n, numeric_limits<double>::quiet_NaN());
+		return;
+	}
+
+	SplineValsByX(X, Coefs[0], Coefs[1], Coefs[2], Coefs[3], N, Index.get(), xs, ys, n, ThreadsCount);
+}
+//---------------------------------------------------------------------------
+
+bool TableFunctionView::BuildSearchIndex(SearchIndexType type)
+{
+	Index.reset();
+
+	auto idx = make_shared<SearchIndex>();
+	if (!idx->Build(X, N, type))
+		return false;
+
+	Index = idx;
+	return true;
+}
+//---------------------------------------------------------------------------
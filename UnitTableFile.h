@@ -0,0 +1,129 @@
+﻿//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+//---------------------------------------------------------------------------
+#ifndef UnitTableFileH
+#define UnitTableFileH
+//---------------------------------------------------------------------------
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "UnitTableFunctions.h"
+#include "UnitMappedFile.h"
+
+namespace tf_gd_lib
+{
+
+// Binary table file (see TableFunction::SaveToBinaryFile):
+//   the header, the name, then columns of doubles, each one aligned to TableFileAlignment bytes:
+//   x, y, and optionally spline coefficients a, b, c, d (the spline knots are x).
+// HasSpline is 0 if there is no spline, otherwise 1 + its SplineType.
+// Numbers are in the byte order of the machine that wrote the file; ByteOrder tells which one it was.
+
+const char TableFileMagic[8] = {'T', 'F', 'G', 'D', 'T', 'A', 'B', '\x1A'};
+const uint32_t TableFileVersion = 1;
+const uint32_t TableFileByteOrder = 0x01020304;
+const size_t TableFileAlignment = 64;
+
+enum TableFileColumn
+{
+	tfcX, tfcY, tfcSplineA, tfcSplineB, tfcSplineC, tfcSplineD,
+	tfcCount
+};
+
+struct TableFileHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t ByteOrder;
+
+	uint64_t Count;          // points
+	uint64_t HasSpline;
+
+	double MinX, MaxX;
+	double MinY, MaxY;
+	double x_ForMinY, x_ForMaxY;
+	uint64_t i_ForMinY, i_ForMaxY;
+
+	uint64_t NameOffset, NameSize;
+	uint64_t ColumnOffsets[tfcCount];   // 0 if a column isn't present
+};
+//---------------------------------------------------------------------------
+
+// A read-only table opened from a binary table file without copying:
+// the columns are used right in the mapped memory, so opening costs the same for any size,
+// and many processes share the same pages.
+class TableFunctionView
+{
+private:
+
+	std::shared_ptr<MappedFile> File;
+
+	const double* X = nullptr;
+	const double* Y = nullptr;
+	const double* Coefs[4] = {nullptr, nullptr, nullptr, nullptr};
+	size_t N = 0;
+
+	TableFileHeader Header = {};
+	std::string Name;
+
+	std::shared_ptr<const SearchIndex> Index;
+
+	size_t ThreadsCount = 0;
+
+public:
+
+	bool Open(const std::string& FileName);
+	void Close();
+
+	bool IsOpen() const { return File != nullptr; }
+
+	size_t Size() const { return N; }
+
+	double GetX(size_t i) const { return X[i]; }
+	double GetY(size_t i) const { return Y[i]; }
+
+	const double* GetDataX() const { return X; }
+	const double* GetDataY() const { return Y; }
+
+	double GetMinX() const { return Header.MinX; }
+	double GetMaxX() const { return Header.MaxX; }
+
+	double GetMinY() const { return Header.MinY; }
+	double GetMaxY() const { return Header.MaxY; }
+
+	double Get_x_ForMinY() const { return Header.x_ForMinY; }
+	double Get_x_ForMaxY() const { return Header.x_ForMaxY; }
+
+	size_t Get_i_ForMinY() const { return (size_t)Header.i_ForMinY; }
+	size_t Get_i_ForMaxY() const { return (size_t)Header.i_ForMaxY; }
+
+	std::string GetName() const { return Name; }
+
+	double GetValByBSearchFromX(double x) const { return LineValByX(X, Y, N, Index.get(), x); }
+	double operator()(double x) const { return GetValByBSearchFromX(x); }
+
+	void GetValsByX(const double* xs, double* ys, size_t n) const { LineValsByX(X, Y, N, Index.get(), xs, ys, n, ThreadsCount); }
+
+	void SetThreadsCount(size_t _ThreadsCount) { ThreadsCount = _ThreadsCount; }
+
+	bool IsSplineExists() const { return Coefs[0] != nullptr; }
+	SplineType GetSplineType() const { return Header.HasSpline > 1 ? (SplineType)(Header.HasSpline - 1) : SplineType::Natural; }
+	const double* GetSplineData(size_t k) const { return Coefs[k]; }   // coefficients a, b, c, d for k = 0..3
+	double SplineVal(double x) const;   // NaN if the file has no spline
+	void GetSplineValsByX(const double* xs, double* ys, size_t n) const;
+
+	// The index isn't stored in the file; it is built in memory
+	bool BuildSearchIndex(SearchIndexType type = SearchIndexType::Auto);
+	SearchIndexType GetSearchIndexType() const { return Index ? Index->GetType() : SearchIndexType::None; }
+};
+//---------------------------------------------------------------------------
+
+} // namespace
+
+#endif
@@ -6,8 +6,15 @@
 #include <algorithm>
 #include <tuple>
 #include <fstream>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 
 #include "UnitTableFunctions.h"
+#include "UnitParallel.h"
+#include "UnitMappedFile.h"
+#include "UnitTableFile.h"
 
 using namespace std;
 using namespace tf_gd_lib;
@@ -39,105 +46,221 @@ inline double tf_gd_lib::LineInterpolSafeMiddleVal(double x, double x1, double x
 std::tuple<double &,double &> TableFunction::operator[](size_t i)
 {
 	iCache = i;
-	return make_tuple(ref(Points[i].x), ref(Points[i].y));
+	Index.reset();
+	SetStatDirty();
+	SetSplineDirty(i, i + 1);
+	return make_tuple(ref(PointsX.GetMutable()[i]), ref(PointsY.GetMutable()[i]));
 }
 //---------------------------------------------------------------------------
 
-double TableFunction::GetValByBSearchFromX(double x) const
+double tf_gd_lib::LineValByX(const double *X, const double *Y, size_t n, const SearchIndex *Index, double x)
 {
-	if (Points.size() < 2)
+	if (n < 2)
 	{
 		return 0;
 	}
 
-	auto it = lower_bound(Points.begin(), Points.end(), SinglePoint(x, 0), [](const SinglePoint &a, const SinglePoint &b)
-		{
-			return a.x < b.x;
-		});
+	size_t i = Index ? Index->LowerBound(X, n, x) : lower_bound(X, X + n, x) - X;
 
-	if (it == Points.begin())
+	if (i == 0)
 	{
-		iCache = 0;
-
-		return LineInterpol(x, it->x, (it+1)->x, it->y, (it+1)->y);
+		return LineInterpol(x, X[0], X[1], Y[0], Y[1]);
 	}
-	else if (it == Points.end())
+	else if (i == n)
 	{
-		iCache = Points.size() - 1;
-
-		return LineInterpol(x, (it-2)->x, (it-1)->x, (it-2)->y, (it-1)->y);
+		return LineInterpol(x, X[n-2], X[n-1], Y[n-2], Y[n-1]);
 	}
 	else
 	{
-		iCache = distance(Points.begin(), it) - 1;
-
-		return LineInterpol(x, (it-1)->x, it->x, (it-1)->y, it->y);
+		return LineInterpol(x, X[i-1], X[i], Y[i-1], Y[i]);
 	}
 
 }
 //---------------------------------------------------------------------------
 
-double TableFunction::GetValFromRightX(double x) const
+double TableFunction::GetValByBSearchFromX(double x) const
+{
+	return LineValByX(PointsX.data(), PointsY.data(), PointsX.size(), Index.get(), x);
+}
+//---------------------------------------------------------------------------
+
+// One thread's share of LineValsByX. Works by blocks: the first pass finds segments and gathers
+// their end points into small contiguous arrays, the second one is a plain arithmetic loop
+// that the compiler can vectorize.
+// Ascending runs of x are merged with the table. Short runs (random access) are looked up independently,
+// so that the CPU can overlap their cache misses instead of chaining them through a shared position.
+static void GetValsByXChunk(const double *X, const double *Y, size_t np, const SearchIndex *Index,
+							const double *xs, double *ys, size_t n)
 {
-	if (Points.size() <2)
+	const size_t BlockSize = 256;
+	const size_t MinRunToMerge = 16;
+
+	double x1[BlockSize], x2[BlockSize], y1[BlockSize], y2[BlockSize];
+
+	size_t lb = 0;          // lower bound of the last x of the previous run
+	bool merging = false;   // the previous run was merged, and may go on in the next block
+
+	for (size_t b = 0; b < n; b += BlockSize)
 	{
-		return 0;
+		size_t m = min(BlockSize, n - b);
+		const double *x = xs + b;
+
+		size_t r = 0;
+		while (r < m)
+		{
+			size_t e = r + 1;               // [r, e) is an ascending run
+			while (e < m && x[e] >= x[e-1])
+				++e;
+
+			bool goes_on = merging && r == 0 && x[0] >= x[-1];
+			merging = goes_on || e - r >= MinRunToMerge;
+
+			for (size_t k = r; k < e; ++k)
+			{
+				if (merging && (k > r || goes_on))
+					lb = GallopLowerBound(X, np, lb, x[k], 4);
+				else
+					lb = Index ? Index->LowerBound(X, np, x[k]) : lower_bound(X, X + np, x[k]) - X;
+
+				// the same segment choice as in LineValByX
+				size_t i = min(max<size_t>(lb, 1), np - 1) - 1;
+
+				x1[k] = X[i];   x2[k] = X[i+1];
+				y1[k] = Y[i];   y2[k] = Y[i+1];
+			}
+			r = e;
+		}
+
+		double *y = ys + b;
+		for (size_t k = 0; k < m; ++k)
+			y[k] = y1[k] + (x[k]-x1[k])*(y2[k]-y1[k])/(x2[k]-x1[k]);  // LineInterpol
 	}
+}
+//---------------------------------------------------------------------------
+
+void tf_gd_lib::LineValsByX(const double *X, const double *Y, size_t np, const SearchIndex *Index,
+							const double *xs, double *ys, size_t n, size_t ThreadsCount)
+{
+	if (!n)
+		return;
 
-	if (x < Points[iCache].x)
+	if (np < 2)
 	{
-		return Points[iCache].y;  // Or, as an option, to do left extrapolation
+		fill(ys, ys + n, 0.0);
+		return;
 	}
 
-	for (size_t i = iCache; i < Points.size(); ++i)
-	{
-		if (x < Points[i].x)   // Interpolation
+	size_t chunks = GetChunksCount(n, ThreadsCount, TableFunction::MinChunkForThread);
+
+	ParallelFor(n, chunks, [=](size_t begin, size_t end, size_t)
 		{
-			iCache = i-1;
-			return LineInterpol(x, Points[i-1].x, Points[i].x, Points[i-1].y, Points[i].y);
-		}
-	}
+			GetValsByXChunk(X, Y, np, Index, xs + begin, ys + begin, end - begin);
+		});
+}
+//---------------------------------------------------------------------------
 
-	// Right Extrapolation 
-	iCache = Points.size()-1;
-	return LineInterpol(x, Points[Points.size()-2].x, Points[Points.size()-1].x,
-						   Points[Points.size()-2].y, Points[Points.size()-1].y);
+void TableFunction::GetValsByX(const double *xs, double *ys, size_t n) const
+{
+	LineValsByX(PointsX.data(), PointsY.data(), PointsX.size(), Index.get(), xs, ys, n, ThreadsCount);
+}
+//---------------------------------------------------------------------------
 
+std::vector<double> TableFunction::GetValsByX(const std::vector<double> &xs) const
+{
+	vector<double> ys(xs.size());
+	GetValsByX(xs.data(), ys.data(), xs.size());
+	return ys;
 }
 //---------------------------------------------------------------------------
 
-double TableFunction::GetValFromLeftX(double x) const
+double TableFunction::Cursor::GetValByX(double x)
 {
-	if (Points.size() <2)
+	const double *X = Table->PointsX.data();
+	const double *Y = Table->PointsY.data();
+	size_t n = Table->PointsX.size();
+
+	if (n < 2)
 	{
 		return 0;
 	}
 
-	if (x < Points[0].x)       // Left Extrapolation
-	{
-		iCache = 0;
-		return LineInterpol(x, Points[0].x, Points[1].x, Points[0].y, Points[1].y);
-	}
+	// the cursor is at the segment (X[i], X[i+1]]; the same segment choice as in LineValByX,
+	// extrapolation by the first or the last segment
+	size_t lb = GallopLowerBound(X, n, min(i + 1, n - 1), x);
+	i = min(max<size_t>(lb, 1), n - 1) - 1;
 
-	size_t n = min(iCache +2, Points.size());
+	return LineInterpol(x, X[i], X[i+1], Y[i], Y[i+1]);
+}
+//---------------------------------------------------------------------------
 
-	for (size_t i = 1; i < n; ++i)
-	{
-		if (x < Points[i].x)   // Interpolation
-		{
-			iCache = i-1;
-			return LineInterpol(x, Points[i-1].x, Points[i].x, Points[i-1].y, Points[i].y);
-		}
-	}
+double TableFunction::GetValFromRightX(double x)
+{
+	Cursor c(*this, iCache);
+	double y = c.GetValFromRightX(x);
+	iCache = c.GetIndex();
+	return y;
+}
+//---------------------------------------------------------------------------
+
+double TableFunction::GetValFromLeftX(double x)
+{
+	Cursor c(*this, iCache);
+	double y = c.GetValFromLeftX(x);
+	iCache = c.GetIndex();
+	return y;
+}
+//---------------------------------------------------------------------------
+
+TableFunction::TableFunction(const TableFunction &other)
+{
+	*this = other;
+}
+//---------------------------------------------------------------------------
+
+TableFunction& TableFunction::operator=(const TableFunction &other)
+{
+	if (this == &other)
+		return *this;
+
+	PointsX = other.PointsX;
+	PointsY = other.PointsY;
+	Name = other.Name;
+	iCache = other.iCache;
+	Index = other.Index;
+	ThreadsCount = other.ThreadsCount;
+	WindowSize = other.WindowSize;
+	Window = other.Window;
+	RangeIndexOn = other.RangeIndexOn;
+
+	// the const methods fill these in under the same lock (GetSpline, RecalcStat, Integral, Ensure*)
+	lock_guard<mutex> lock(other.Lazy.Mutex);
 
-	return Points[iCache].y;   // Or, as an option, to do right extrapolation
+	MinX = other.MinX;
+	MaxX = other.MaxX;
+	MinY = other.MinY;
+	MaxY = other.MaxY;
+	x_ForMinY = other.x_ForMinY;
+	x_ForMaxY = other.x_ForMaxY;
+	i_ForMinY = other.i_ForMinY;
+	i_ForMaxY = other.i_ForMaxY;
+
+	LineIntegrals = other.LineIntegrals;
+	RangeIndex = other.RangeIndex;
+	LineCrossings = other.LineCrossings;
+	SplineCrossings = other.SplineCrossings;
+	LineMonotone = other.LineMonotone;
+	Spline = other.Spline;
+
+	Lazy = other.Lazy;
+
+	return *this;
 }
 //---------------------------------------------------------------------------
 
 void TableFunction::ClearAll()
 {
-	Points.clear();
-    Points.shrink_to_fit();
+	PointsX.Release();
+	PointsY.Release();
 
 	MinX = MaxX = 0;
 	MinY = MaxY = 0;
@@ -146,6 +269,21 @@ void TableFunction::ClearAll()
 
     iCache = 0;
 
+	Index.reset();
+
+	Lazy.StatDirty = false;
+	Lazy.SplineReady = false;
+	Lazy.Begin = Lazy.End = 0;
+	Lazy.LineIntegralReady = Lazy.SplineIntegralReady = false;
+	LineIntegrals.Release();
+	Lazy.LineCrossingsReady = Lazy.SplineCrossingsReady = false;
+	LineCrossings.Clear();
+	Window.Clear();
+	SplineCrossings.Clear();
+	LineMonotone = 0;
+
+	ClearRangeIndex();
+
 	Name.clear();
 
     Spline.Clear();
@@ -154,25 +292,31 @@ void TableFunction::ClearAll()
 
 void TableFunction::SetValAtPoint(size_t i, double y)
 {
-	Points[i].y = y;
+	PointsY.GetMutable()[i] = y;
+
+	UpdateStatForValue(i);
+	SetSplineDirty(i, i + 1);
 }
 //---------------------------------------------------------------------------
 
 void TableFunction::SetPointByNumber(size_t i, const std::tuple<double,double> &point)
 {
-	Points[i].x = get<0>(point);
-	Points[i].y = get<1>(point);
+	PointsX.GetMutable()[i] = get<0>(point);
+	PointsY.GetMutable()[i] = get<1>(point);
+
+	Index.reset();
+	SetStatDirty();
+	SetSplineDirty(i, i + 1);
 }
 //---------------------------------------------------------------------------
 
 void TableFunction::CreateNewFunction(size_t n, const string &_name)
 {
 	ClearAll();
-	Points.reserve(n);
-	for (size_t i = 0; i < n; ++i)
-		Points.emplace_back(0.0, 0.0);
+	PointsX.Assign(vector<double>(n, 0.0));
+	PointsY.Assign(vector<double>(n, 0.0));
+	SetStatDirty();
 
-    //Points.shrink_to_fit();
 	Name = _name;
 }
 //---------------------------------------------------------------------------
@@ -180,13 +324,15 @@ void TableFunction::CreateNewFunction(size_t n, const string &_name)
 void TableFunction::CreateDemoFunction(size_t n, double a, double dx, std::function<double(double)> f, const std::string &_name)
 {
 	ClearAll();
-	Points.reserve(n);
+	vector<double> X(n), Y(n);
 	for (size_t i = 0; i < n; ++i)
 	{
 		double x = a + i*dx;
-		Points.emplace_back(x, f(x));
+		X[i] = x;
+		Y[i] = f(x);
 	}
-	//Points.shrink_to_fit();
+	PointsX.Assign(move(X));
+	PointsY.Assign(move(Y));
 
     CalcStat();
 
@@ -194,101 +340,1453 @@ void TableFunction::CreateDemoFunction(size_t n, double a, double dx, std::funct
 }
 //---------------------------------------------------------------------------
 
+bool TableFunction::CreateAdaptiveFunction(double a, double b, std::function<double(double)> f, double Tolerance,
+										   bool ForSpline, size_t MaxPoints, const std::string &_name)
+{
+	ClearAll();
+	Name = _name;
+
+	if (!(a <= b))
+		return false;
+
+	// every interval i keeps the value of f at its middle once it's known (Known[i]),
+	// so an interval that has passed the check costs nothing in the next passes
+	size_t n = a < b ? max<size_t>(2, min(AdaptiveInitialPoints, MaxPoints)) : 1;
+	vector<double> X(n), Y(n), Mid(n - 1);
+	vector<char> Known(n - 1, 0);
+	for (size_t i = 0; i < n; ++i)
+		X[i] = n > 1 ? a + (b - a) * i / (n - 1) : a;
+
+	vector<double> xs, ys;
+	auto sample = [&]()
+		{
+			ys.resize(xs.size());
+			ParallelFor(xs.size(), GetChunksCount(xs.size(), ThreadsCount, MinSamplesForThread),
+				[&](size_t begin, size_t end, size_t)
+				{
+					for (size_t k = begin; k < end; ++k)
+						ys[k] = f(xs[k]);
+				});
+		};
+
+	xs = X;
+	sample();
+	Y = ys;
+
+	bool done = n < 2;   // a single point is exact
+	CubicSpline spline;
+	spline.SetType(Spline.GetType());
+	vector<double> mids, interp;
+
+	while (n > 1)
+	{
+		// the middles of the new intervals
+		xs.clear();
+		for (size_t i = 0; i + 1 < n; ++i)
+			if (!Known[i])
+				xs.push_back(X[i] + (X[i+1] - X[i]) / 2);
+		sample();
+		for (size_t i = 0, k = 0; i + 1 < n; ++i)
+			if (!Known[i])
+			{
+				Mid[i] = ys[k++];
+				Known[i] = 1;
+			}
+
+		// the interpolation there; the spline is global, so all of them are checked again
+		interp.resize(n - 1);
+		if (ForSpline && spline.BuildSpline(X.data(), Y.data(), n, ThreadsCount))
+		{
+			mids.resize(n - 1);
+			for (size_t i = 0; i + 1 < n; ++i)
+				mids[i] = X[i] + (X[i+1] - X[i]) / 2;
+			spline.GetValsByX(mids.data(), interp.data(), n - 1, ThreadsCount);
+		}
+		else
+			for (size_t i = 0; i + 1 < n; ++i)
+				interp[i] = (Y[i] + Y[i+1]) / 2;
+
+		// halve the intervals that miss; the middle becomes a point, its halves are new intervals
+		vector<double> X2, Y2, Mid2;
+		vector<char> Known2;
+		X2.reserve(2 * n);
+		Y2.reserve(2 * n);
+		Mid2.reserve(2 * n);
+		Known2.reserve(2 * n);
+
+		// (an interval too short to be halved, or one over MaxPoints, stays as it is and spoils the result)
+		bool refined = false, missed = false;
+		for (size_t i = 0; i + 1 < n; ++i)
+		{
+			X2.push_back(X[i]);
+			Y2.push_back(Y[i]);
+
+			double m = X[i] + (X[i+1] - X[i]) / 2;
+			bool miss = fabs(Mid[i] - interp[i]) > Tolerance;
+			if (miss && m > X[i] && m < X[i+1] && X2.size() + (n - i) <= MaxPoints)
+			{
+				X2.push_back(m);
+				Y2.push_back(Mid[i]);
+				Mid2.insert(Mid2.end(), {0.0, 0.0});
+				Known2.insert(Known2.end(), {0, 0});
+				refined = true;
+			}
+			else
+			{
+				Mid2.push_back(Mid[i]);
+				Known2.push_back(1);
+				missed = missed || miss;
+			}
+		}
+		X2.push_back(X[n-1]);
+		Y2.push_back(Y[n-1]);
+
+		if (!refined)
+		{
+			done = !missed;
+			break;
+		}
+
+		X.swap(X2);
+		Y.swap(Y2);
+		Mid.swap(Mid2);
+		Known.swap(Known2);
+		n = X.size();
+	}
+
+	PointsX.Assign(move(X));
+	PointsY.Assign(move(Y));
+	CalcStat();
+
+	return done;
+}
+//---------------------------------------------------------------------------
+
 void TableFunction::KillDuplicates()
 {
-	auto it_last = unique(Points.begin(), Points.end(), [](const SinglePoint &a, const SinglePoint &b)
+	size_t n = PointsX.size();
+	if (n < 2)
+		return;
+
+	Index.reset();
+	SetStatDirty();
+	SetSplineDirty(0, n);
+
+	const double *X = PointsX.data();
+	const double *Y = PointsY.data();
+
+	// keeps the first point of every group with the same x; X is taken by reference,
+	// since GetMutable below may move the points (see SharedArray::EraseFront)
+	auto is_kept = [&X](size_t i) { return i == 0 || X[i] != X[i-1]; };
+
+	size_t count = GetChunksCount(n, ThreadsCount, MinChunkForThread);
+	if (count == 1)
+	{
+		vector<double> &MutX = PointsX.GetMutable();
+		vector<double> &MutY = PointsY.GetMutable();
+		X = MutX.data();
+		Y = MutY.data();
+
+		size_t last = 0;
+		for (size_t i = 1; i < n; ++i)
 		{
-			return a.x == b.x;
+			if (is_kept(i))
+			{
+				++last;
+				MutX[last] = X[i];
+				MutY[last] = Y[i];
+			}
+		}
+
+		MutX.resize(last + 1);
+		MutY.resize(last + 1);
+		return;
+	}
+
+	// the first pass counts the kept points of every chunk, the second one copies them to their places
+	vector<size_t> offsets(count + 1, 0);
+	ParallelFor(n, count, [&](size_t begin, size_t end, size_t k)
+		{
+			size_t c = 0;
+			for (size_t i = begin; i < end; ++i)
+				c += is_kept(i);
+			offsets[k + 1] = c;
+		});
+
+	for (size_t k = 0; k < count; ++k)
+		offsets[k + 1] += offsets[k];
+
+	vector<double> NewX(offsets[count]);
+	vector<double> NewY(offsets[count]);
+	ParallelFor(n, count, [&](size_t begin, size_t end, size_t k)
+		{
+			size_t out = offsets[k];
+			for (size_t i = begin; i < end; ++i)
+				if (is_kept(i))
+				{
+					NewX[out] = X[i];
+					NewY[out++] = Y[i];
+				}
 		});
 
-	Points.erase(it_last, Points.end());
+	PointsX.Assign(move(NewX));
+	PointsY.Assign(move(NewY));
 }
 //---------------------------------------------------------------------------
 
 void TableFunction::Sort()
-{                                  
-	sort(Points.begin(), Points.end(), [](const SinglePoint &a, const SinglePoint &b)
+{
+	if (is_sorted(PointsX.begin(), PointsX.end()))
+		return;
+
+	Index.reset();
+	SetStatDirty();
+	SetSplineDirty(0, PointsX.size());
+
+	auto less_x = [](const SinglePoint &a, const SinglePoint &b) { return a.x < b.x; };
+
+	// x and y have to be moved together, so the sort goes through a temporary array of pairs;
+	// every chunk is sorted by its own thread, then the sorted runs are merged pairwise
+	size_t n = PointsX.size();
+	size_t count = GetChunksCount(n, ThreadsCount, MinChunkForThread);
+
+	vector<SinglePoint> Points(n, SinglePoint(0, 0));
+	ParallelFor(n, count, [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t i = begin; i < end; ++i)
+				Points[i] = SinglePoint(PointsX[i], PointsY[i]);
+			stable_sort(Points.begin() + begin, Points.begin() + end, less_x);
+		});
+
+	SinglePoint *src = Points.data();
+	vector<SinglePoint> Buf;
+	if (count > 1)
+	{
+		Buf.assign(n, SinglePoint(0, 0));
+		SinglePoint *dst = Buf.data();
+
+		vector<size_t> runs(count + 1);   // the same bounds as ParallelFor has
+		for (size_t k = 0; k <= count; ++k)
+			runs[k] = n * k / count;
+
+		// a merge takes equal x from the left run first, so the whole sort stays stable
+		while (runs.size() > 2)
+		{
+			size_t r = runs.size() - 1;
+			size_t pairs = (r + 1) / 2;
+
+			ParallelFor(pairs, pairs, [&](size_t j, size_t, size_t)
+				{
+					size_t b = runs[2*j], m = runs[min(2*j + 1, r)], e = runs[min(2*j + 2, r)];
+					merge(src + b, src + m, src + m, src + e, dst + b, less_x);
+				});
+
+			vector<size_t> next;
+			for (size_t j = 0; j < pairs; ++j)
+				next.push_back(runs[2*j]);
+			next.push_back(n);
+			runs.swap(next);
+
+			swap(src, dst);
+		}
+	}
+
+	// the sorted points go to new arrays, so the old ones aren't copied if they are shared
+	vector<double> X(n), Y(n);
+	ParallelFor(n, count, [&](size_t begin, size_t end, size_t)
 		{
-			return a.x < b.x;
+			for (size_t i = begin; i < end; ++i)
+			{
+				X[i] = src[i].x;
+				Y[i] = src[i].y;
+			}
 		});
+
+	PointsX.Assign(move(X));
+	PointsY.Assign(move(Y));
 }
 //---------------------------------------------------------------------------
 
-void TableFunction::CalcStat()
+// Several independent accumulators, so the loop has no long dependency chain and can be vectorized;
+// the positions are found afterwards as the first elements equal to the extremes.
+// NaN are skipped; if there are only NaN, the positions are n.
+static MinMaxInfo MinMaxOfChunk(const double *A, size_t n)
 {
-	if (Points.empty())
-		return;
+	const size_t Lanes = 8;
+
+	double mn[Lanes], mx[Lanes];
+	for (size_t k = 0; k < Lanes; ++k)
+	{
+		mn[k] = numeric_limits<double>::infinity();
+		mx[k] = -numeric_limits<double>::infinity();
+	}
+
+	size_t i = 0;
+	for (; i + Lanes <= n; i += Lanes)
+		for (size_t k = 0; k < Lanes; ++k)
+		{
+			mn[k] = A[i+k] < mn[k] ? A[i+k] : mn[k];
+			mx[k] = A[i+k] > mx[k] ? A[i+k] : mx[k];
+		}
+
+	for (; i < n; ++i)
+	{
+		mn[0] = A[i] < mn[0] ? A[i] : mn[0];
+		mx[0] = A[i] > mx[0] ? A[i] : mx[0];
+	}
+
+	for (size_t k = 1; k < Lanes; ++k)
+	{
+		mn[0] = mn[k] < mn[0] ? mn[k] : mn[0];
+		mx[0] = mx[k] > mx[0] ? mx[k] : mx[0];
+	}
+
+	MinMaxInfo r;
+	r.iMin = find(A, A + n, mn[0]) - A;
+	r.iMax = find(A, A + n, mx[0]) - A;
 
-	MinX = MaxX = Points[0].x;
-	MinY = MaxY = Points[0].y;
+	// the value itself is taken from the array: 0.0 and -0.0 are equal, but the first one is wanted
+	r.Min = r.iMin < n ? A[r.iMin] : mn[0];
+	r.Max = r.iMax < n ? A[r.iMax] : mx[0];
+	return r;
+}
+//---------------------------------------------------------------------------
 
-	x_ForMinY = x_ForMaxY = Points[0].x;
+MinMaxInfo tf_gd_lib::MinMaxReduce(const double *A, size_t n, size_t ThreadsCount)
+{
+	MinMaxInfo r;
+	if (!n)
+		return r;
 
-	for (size_t i = 1; i < Points.size(); ++i)
+	if (std::isnan(A[0]))
 	{
-		if (Points[i].x > MaxX)
-			MaxX = Points[i].x;
+		r.Min = r.Max = A[0];
+		return r;
+	}
 
-		if (Points[i].x < MinX)
-			MinX = Points[i].x;
+	size_t count = GetChunksCount(n, ThreadsCount, TableFunction::MinChunkForThread);
 
-		if (Points[i].y > MaxY)
+	vector<MinMaxInfo> parts(count);
+	vector<size_t> ends(count);
+	ParallelFor(n, count, [&](size_t begin, size_t end, size_t k)
 		{
-			MaxY = Points[i].y;
-			x_ForMaxY = Points[i].x;
-			i_ForMaxY = i;
-		}
+			parts[k] = MinMaxOfChunk(A + begin, end - begin);
+			ends[k] = end;
+			parts[k].iMin += begin;
+			parts[k].iMax += begin;
+		});
 
-		if (Points[i].y < MinY)
+	// A[0] isn't NaN, so the first chunk always has both; later chunks win only with strictly better values
+	r = parts[0];
+	for (size_t k = 1; k < count; ++k)
+	{
+		const MinMaxInfo &p = parts[k];
+		if (p.iMin < ends[k] && p.Min < r.Min)
+		{
+			r.Min = p.Min;
+			r.iMin = p.iMin;
+		}
+		if (p.iMax < ends[k] && p.Max > r.Max)
 		{
-			MinY = Points[i].y;
-			x_ForMinY = Points[i].x;
-			i_ForMinY = i;
+			r.Max = p.Max;
+			r.iMax = p.iMax;
 		}
 	}
+
+	return r;
 }
 //---------------------------------------------------------------------------
 
-bool TableFunction::LoadFromFile(const string &FileName) // vs. wstring
+void TableFunction::CalcStat()
 {
-	ifstream f(FileName); // vs. wifstream
-	if (!f)
-        return false;
+	CalcStatNow();
+	Lazy.StatDirty = false;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::RecalcStat() const
+{
+	lock_guard<mutex> lock(Lazy.Mutex);
+	if (Lazy.StatDirty.load(memory_order_relaxed))
+	{
+		CalcStatNow();
+		Lazy.StatDirty.store(false, memory_order_release);
+	}
+}
+//---------------------------------------------------------------------------
 
-    LoadFromStream(f);  // TO DO: test on travis
+void TableFunction::CalcStatNow() const
+{
+	size_t n = PointsX.size();
+	if (!n)
+		return;
 
-	Name = FileName;
-	size_t pos = Name.find_last_of("\\");  // TO DO: Check separator in different OS
+	const double *X = PointsX.data();
 
-	if (pos != string::npos)
+	MinMaxInfo sx = MinMaxReduce(X, n, ThreadsCount);
+	MinMaxInfo sy = MinMaxReduce(PointsY.data(), n, ThreadsCount);
+
+	MinX = sx.Min;
+	MaxX = sx.Max;
+
+	MinY = sy.Min;
+	x_ForMinY = X[sy.iMin];
+	i_ForMinY = sy.iMin;
+
+	MaxY = sy.Max;
+	x_ForMaxY = X[sy.iMax];
+	i_ForMaxY = sy.iMax;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::UpdateStatForValue(size_t i)
+{
+	if (Lazy.StatDirty)
+		return;
+
+	double y = PointsY[i];
+
+	// the extreme point itself can only get better or it's the time to search again;
+	// NaN at the first point makes the statistics NaN (see MinMaxReduce)
+	if (i == i_ForMaxY || i == i_ForMinY || (i == 0 && std::isnan(y)))
 	{
-		Name.erase(0, pos+1);
+		if ((i == i_ForMaxY && !(y >= MaxY)) || (i == i_ForMinY && !(y <= MinY)) || std::isnan(y))
+		{
+			SetStatDirty();
+			return;
+		}
 	}
 
-	return true;
+	if (i == i_ForMaxY || y > MaxY || (y == MaxY && i < i_ForMaxY))
+	{
+		MaxY = y;
+		x_ForMaxY = PointsX[i];
+		i_ForMaxY = i;
+	}
+
+	if (i == i_ForMinY || y < MinY || (y == MinY && i < i_ForMinY))
+	{
+		MinY = y;
+		x_ForMinY = PointsX[i];
+		i_ForMinY = i;
+	}
 }
 //---------------------------------------------------------------------------
 
-void TableFunction::LoadFromStream(istream &Stream) // vs. wistream
+void TableFunction::SetSplineDirty(size_t begin, size_t end)
 {
-	ClearAll();
+	Window.Ready = false;   // AppendPoints sets it back
+	Lazy.LineIntegralReady = Lazy.SplineIntegralReady = false;
+	Lazy.LineCrossingsReady = Lazy.SplineCrossingsReady = false;
 
-	string line;
-	while (getline(Stream, line))
+	if (RangeIndexOn)
 	{
-		double x, y;
-		sscanf(line.c_str(), "%lf%lf", &x, &y);
-		Points.emplace_back(x, y);
+		if (Lazy.RangeIndexReady)
+		{
+			Lazy.RangeBegin = begin;
+			Lazy.RangeEnd = end;
+			Lazy.RangeIndexReady = false;
+		}
+		else
+		{
+			Lazy.RangeBegin = min(Lazy.RangeBegin, begin);
+			Lazy.RangeEnd = max(Lazy.RangeEnd, end);
+		}
 	}
-	Points.shrink_to_fit();
 
-	Sort();
-	CalcStat();
+	if (Lazy.SplineReady)
+	{
+		Lazy.Begin = begin;
+		Lazy.End = end;
+		Lazy.SplineReady = false;
+	}
+	else
+	{
+		Lazy.Begin = min(Lazy.Begin, begin);
+		Lazy.End = max(Lazy.End, end);
+	}
 }
 //---------------------------------------------------------------------------
 
-bool TableFunction::BuildSpline()
+void TableFunction::UpdateStatForPoint(size_t i)
 {
-    return Spline.BuildSpline(Points);
+	double x = PointsX[i];
+	double y = PointsY[i];
+
+	// ties go to the smaller x, the same way CalcStat picks the first one
+	if (y > MaxY || (y == MaxY && x < x_ForMaxY))
+	{
+		MaxY = y;
+		x_ForMaxY = x;
+	}
+
+	if (y < MinY || (y == MinY && x < x_ForMinY))
+	{
+		MinY = y;
+		x_ForMinY = x;
+	}
 }
-//---------------------------------------------------------------------------
\ No newline at end of file
+//---------------------------------------------------------------------------
+
+void TableFunction::AppendPoints(const double *xs, const double *ys, size_t n)
+{
+	if (!n)
+		return;
+
+	EnsureStat();
+
+	bool WindowReady = Window.Ready;
+
+	Index.reset();
+	SetSplineDirty(0, PointsX.size() + n);
+
+	// the batch itself: sorted (stable, so the first of equal x is kept) and without duplicates
+	vector<SinglePoint> Batch;
+	Batch.reserve(n);
+	for (size_t k = 0; k < n; ++k)
+		Batch.emplace_back(xs[k], ys[k]);
+
+	auto less_x = [](const SinglePoint &a, const SinglePoint &b) { return a.x < b.x; };
+	if (!is_sorted(Batch.begin(), Batch.end(), less_x))
+		stable_sort(Batch.begin(), Batch.end(), less_x);
+
+	Batch.erase(unique(Batch.begin(), Batch.end(), [](const SinglePoint &a, const SinglePoint &b)
+		{
+			return a.x == b.x;
+		}), Batch.end());
+
+	size_t OldSize = PointsX.size();
+	bool WasEmpty = !OldSize;
+
+	// only the tail with x >= the first x of the batch takes part in the merge
+	size_t p = lower_bound(PointsX.begin(), PointsX.end(), Batch.front().x) - PointsX.begin();
+
+	vector<double> TailX(PointsX.begin() + p, PointsX.end());
+	vector<double> TailY(PointsY.begin() + p, PointsY.end());
+
+	PointsX.resize(p + TailX.size() + Batch.size());
+	PointsY.resize(PointsX.size());
+
+	double *MutX = PointsX.MutableData();
+	double *MutY = PointsY.MutableData();
+
+	size_t i = 0, k = 0, out = p;
+	while (i < TailX.size() || k < Batch.size())
+	{
+		if (k == Batch.size() || (i < TailX.size() && TailX[i] <= Batch[k].x))
+		{
+			if (k < Batch.size() && TailX[i] == Batch[k].x)
+				++k;   // already in the table
+			MutX[out] = TailX[i];
+			MutY[out++] = TailY[i++];
+		}
+		else
+		{
+			MutX[out] = Batch[k].x;
+			MutY[out++] = Batch[k++].y;
+		}
+	}
+
+	PointsX.resize(out);
+	PointsY.resize(out);
+
+	if (WindowSize)
+	{
+		// the merged region replaces the old tail in the candidates; the whole table if they aren't there yet
+		size_t from = WindowReady ? p : 0;
+		if (WindowReady)
+			Window.PopFrom(PointsX[p]);
+		else
+			Window.Clear();
+		for (size_t j = from; j < out; ++j)
+			Window.Push(PointsX[j], PointsY[j]);
+
+		if (out > WindowSize)
+		{
+			PointsX.EraseFront(out - WindowSize);
+			PointsY.EraseFront(out - WindowSize);
+			Window.EvictBefore(PointsX.front());
+		}
+
+		Window.Ready = true;
+		if (std::isnan(PointsY.front()))
+		{
+			// NaN at the first point makes the statistics NaN (see MinMaxReduce); the candidates leave NaN out,
+			// so they stay valid for the time the NaN leaves the window
+			MinY = MaxY = PointsY.front();
+			x_ForMinY = x_ForMaxY = PointsX.front();
+		}
+		else
+		{
+			MinY = Window.Mins.front().y;
+			x_ForMinY = Window.Mins.front().x;
+			MaxY = Window.Maxs.front().y;
+			x_ForMaxY = Window.Maxs.front().x;
+		}
+	}
+	else
+	{
+		if (WasEmpty)
+		{
+			MinY = MaxY = PointsY[0];
+			x_ForMinY = x_ForMaxY = PointsX[0];
+		}
+
+		// new points are the ones that aren't from the tail; checking the whole merged region is as cheap
+		for (size_t j = p; j < out; ++j)
+			UpdateStatForPoint(j);
+	}
+
+	MinX = PointsX.front();
+	MaxX = PointsX.back();
+
+	// x are unique, so the positions of the extremes are found by their x
+	i_ForMinY = lower_bound(PointsX.begin(), PointsX.end(), x_ForMinY) - PointsX.begin();
+	i_ForMaxY = lower_bound(PointsX.begin(), PointsX.end(), x_ForMaxY) - PointsX.begin();
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::AppendPoints(const vector<double> &xs, const vector<double> &ys)
+{
+	AppendPoints(xs.data(), ys.data(), min(xs.size(), ys.size()));
+}
+//---------------------------------------------------------------------------
+
+bool TableFunction::LoadFromFile(const string &FileName, LoadInfo *Info) // vs. wstring
+{
+	MappedFile f;
+	if (!f.Open(FileName))
+        return false;
+
+    LoadFromText(f.GetData(), f.Size(), Info);  // TO DO: test on travis
+
+	Name = FileName;
+	size_t pos = Name.find_last_of("\\");  // TO DO: Check separator in different OS
+
+	if (pos != string::npos)
+	{
+		Name.erase(0, pos+1);
+	}
+
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::LoadFromStream(istream &Stream, LoadInfo *Info) // vs. wistream
+{
+	const size_t BlockSize = 1 << 22;
+
+	vector<char> text;
+	size_t size = 0;
+	while (Stream)
+	{
+		text.resize(size + BlockSize);
+		Stream.read(text.data() + size, BlockSize);
+		size += (size_t)Stream.gcount();
+	}
+
+	LoadFromText(text.data(), size, Info);
+}
+//---------------------------------------------------------------------------
+
+static inline bool IsBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+//---------------------------------------------------------------------------
+
+// The text isn't null-terminated, so nothing can be read beyond end. Returns nullptr on failure.
+static const char* ParseDouble(const char *p, const char *end, double &v)
+{
+	if (p < end && *p == '+')   // sscanf accepts it, from_chars doesn't
+		++p;
+
+#if defined(__cpp_lib_to_chars)
+	auto r = from_chars(p, end, v);
+	return r.ec == errc() ? r.ptr : nullptr;
+#else
+	char buf[64];
+	size_t len = 0;
+	while (p + len < end && len < sizeof(buf) - 1 && !IsBlank(p[len]) && p[len] != '\n')
+		++len;
+	memcpy(buf, p, len);
+	buf[len] = 0;
+
+	char *e;
+	v = strtod(buf, &e);
+	return e == buf ? nullptr : p + (e - buf);
+#endif
+}
+//---------------------------------------------------------------------------
+
+// One thread's share of LoadFromText: whole lines from Begin to End
+struct LoadChunk
+{
+	const char *Begin = nullptr, *End = nullptr;
+
+	size_t LinesCount = 0;
+	size_t FirstLine = 0;      // the number of lines in the previous chunks
+	size_t PointsCount = 0;
+
+	vector<size_t> MalformedLines;
+	bool Sorted = true;
+};
+//---------------------------------------------------------------------------
+
+static void ParseChunk(LoadChunk &c, double *X, double *Y)
+{
+	const char *p = c.Begin;
+	size_t line = c.FirstLine;
+
+	while (p < c.End)
+	{
+		const char *eol = static_cast<const char*>(memchr(p, '\n', c.End - p));
+		if (!eol)
+			eol = c.End;
+		++line;
+
+		while (p < eol && IsBlank(*p))
+			++p;
+
+		if (p < eol)  // not a blank line
+		{
+			double x, y;
+			const char *q = ParseDouble(p, eol, x);
+			while (q && q < eol && IsBlank(*q))
+				++q;
+			q = q ? ParseDouble(q, eol, y) : nullptr;
+
+			if (q)
+			{
+				size_t k = c.PointsCount++;
+				X[k] = x;
+				Y[k] = y;
+				if (k && X[k-1] > x)
+					c.Sorted = false;
+			}
+			else
+				c.MalformedLines.push_back(line);
+		}
+
+		p = eol + 1;
+	}
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::LoadFromText(const char *Text, size_t TextSize, LoadInfo *Info)
+{
+	ClearAll();
+
+	// chunks of whole lines
+	size_t count = GetChunksCount(TextSize, ThreadsCount, MinLoadChunkForThread);
+	vector<LoadChunk> chunks(count);
+
+	const char *end = Text + TextSize;
+	const char *p = Text;
+	for (size_t k = 0; k < count; ++k)
+	{
+		const char *e = (k + 1 < count) ? Text + TextSize * (k + 1) / count : end;
+		if (e < p)
+			e = p;
+		if (e < end && e > Text && e[-1] != '\n')
+		{
+			const char *eol = static_cast<const char*>(memchr(e, '\n', end - e));
+			e = eol ? eol + 1 : end;
+		}
+		chunks[k].Begin = p;
+		chunks[k].End = e;
+		p = e;
+	}
+
+	// the first pass counts lines, so that the storage can be allocated once
+	ParallelFor(count, count, [&chunks](size_t begin, size_t, size_t)
+		{
+			LoadChunk &c = chunks[begin];
+			c.LinesCount = std::count(c.Begin, c.End, '\n');
+			if (c.End > c.Begin && c.End[-1] != '\n')
+				++c.LinesCount;
+		});
+
+	size_t lines = 0;
+	for (auto &c : chunks)
+	{
+		c.FirstLine = lines;
+		lines += c.LinesCount;
+	}
+
+	vector<double> X(lines), Y(lines);
+
+	// the second pass parses every chunk into its own part of the storage
+	ParallelFor(count, count, [&X, &Y, &chunks](size_t begin, size_t, size_t)
+		{
+			LoadChunk &c = chunks[begin];
+			ParseChunk(c, X.data() + c.FirstLine, Y.data() + c.FirstLine);
+		});
+
+	// close the gaps left by blank and malformed lines
+	bool sorted = true;
+	size_t n = 0;
+	for (auto &c : chunks)
+	{
+		if (!c.PointsCount)
+			continue;
+
+		if (n)
+			sorted = sorted && c.Sorted && X[n-1] <= X[c.FirstLine];
+		else
+			sorted = c.Sorted;
+
+		if (n != c.FirstLine)
+		{
+			memmove(X.data() + n, X.data() + c.FirstLine, c.PointsCount * sizeof(double));
+			memmove(Y.data() + n, Y.data() + c.FirstLine, c.PointsCount * sizeof(double));
+		}
+		n += c.PointsCount;
+	}
+
+	X.resize(n);
+	Y.resize(n);
+	X.shrink_to_fit();
+	Y.shrink_to_fit();
+
+	PointsX.Assign(move(X));
+	PointsY.Assign(move(Y));
+
+	if (!sorted)
+		Sort();
+	CalcStat();
+
+	if (Info)
+	{
+		Info->LinesCount = lines;
+		Info->PointsCount = n;
+		Info->WasSorted = sorted;
+		Info->MalformedLines.clear();
+		for (auto &c : chunks)
+			Info->MalformedLines.insert(Info->MalformedLines.end(), c.MalformedLines.begin(), c.MalformedLines.end());
+	}
+}
+//---------------------------------------------------------------------------
+
+bool TableFunction::SaveToBinaryFile(const string &FileName) const
+{
+	size_t n = PointsX.size();
+
+	if (!is_sorted(PointsX.begin(), PointsX.end()))
+		return false;
+
+	EnsureStat();
+
+	const CubicSpline &Spline = this->Spline.IsSplineExists() ? GetSpline() : this->Spline;
+	bool HasSpline = Spline.Size() == n && n && Spline.HasKnots(PointsX);
+
+	TableFileHeader h = {};
+	memcpy(h.Magic, TableFileMagic, sizeof(h.Magic));
+	h.Version = TableFileVersion;
+	h.ByteOrder = TableFileByteOrder;
+
+	h.Count = n;
+	h.HasSpline = HasSpline ? 1 + (uint64_t)Spline.GetType() : 0;
+
+	h.MinX = MinX;   h.MaxX = MaxX;
+	h.MinY = MinY;   h.MaxY = MaxY;
+	h.x_ForMinY = x_ForMinY;   h.x_ForMaxY = x_ForMaxY;
+	h.i_ForMinY = i_ForMinY;   h.i_ForMaxY = i_ForMaxY;
+
+	const double *columns[tfcCount] = { PointsX.data(), PointsY.data(),
+		Spline.GetDataA(), Spline.GetDataB(), Spline.GetDataC(), Spline.GetDataD() };
+	size_t ColumnsCount = HasSpline ? tfcCount : tfcSplineA;
+
+	auto align = [](uint64_t offset)
+		{
+			return (offset + TableFileAlignment - 1) / TableFileAlignment * TableFileAlignment;
+		};
+
+	uint64_t offset = sizeof(h);
+	h.NameOffset = offset;
+	h.NameSize = Name.size();
+	offset += Name.size();
+
+	for (size_t k = 0; k < ColumnsCount; ++k)
+	{
+		offset = align(offset);
+		h.ColumnOffsets[k] = offset;
+		offset += n * sizeof(double);
+	}
+
+	ofstream f(FileName, ios::binary);
+	if (!f)
+		return false;
+
+	f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	f.write(Name.data(), Name.size());
+
+	const char zeros[TableFileAlignment] = {};
+	uint64_t pos = sizeof(h) + Name.size();
+	for (size_t k = 0; k < ColumnsCount; ++k)
+	{
+		f.write(zeros, h.ColumnOffsets[k] - pos);
+		f.write(reinterpret_cast<const char*>(columns[k]), n * sizeof(double));
+		pos = h.ColumnOffsets[k] + n * sizeof(double);
+	}
+
+	return f.good();
+}
+//---------------------------------------------------------------------------
+
+bool TableFunction::LoadFromBinaryFile(const string &FileName)
+{
+	TableFunctionView v;
+	if (!v.Open(FileName))
+		return false;
+
+	ClearAll();
+
+	size_t n = v.Size();
+	PointsX.Assign(vector<double>(v.GetDataX(), v.GetDataX() + n));
+	PointsY.Assign(vector<double>(v.GetDataY(), v.GetDataY() + n));
+
+	MinX = v.GetMinX();   MaxX = v.GetMaxX();
+	MinY = v.GetMinY();   MaxY = v.GetMaxY();
+	x_ForMinY = v.Get_x_ForMinY();   x_ForMaxY = v.Get_x_ForMaxY();
+	i_ForMinY = v.Get_i_ForMinY();   i_ForMaxY = v.Get_i_ForMaxY();
+
+	Name = v.GetName();
+
+	if (v.IsSplineExists())
+	{
+		Spline.SetCoefs(v.GetDataX(), v.GetSplineData(0), v.GetSplineData(1), v.GetSplineData(2), v.GetSplineData(3), n);
+		Spline.SetType(v.GetSplineType());
+		Lazy.SplineReady = true;
+	}
+
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::SetSplineType(SplineType Type)
+{
+	if (Type == Spline.GetType())
+		return;
+
+	Spline.Clear();
+	Spline.SetType(Type);
+	SetSplineDirty(0, PointsX.size());
+}
+//---------------------------------------------------------------------------
+
+double TableFunction::Integral(double x1, double x2) const
+{
+	size_t n = PointsX.size();
+	if (n < 2)
+		return 0;   // the same as the values
+
+	const double *X = PointsX.data(), *Y = PointsY.data();
+
+	if (!Lazy.LineIntegralReady.load(memory_order_acquire))
+	{
+		lock_guard<mutex> lock(Lazy.Mutex);
+		if (!Lazy.LineIntegralReady.load(memory_order_relaxed))
+		{
+			vector<double> I(n);
+			I[0] = 0.0;
+			for (size_t i = 1; i < n; ++i)
+				I[i] = I[i-1] + (Y[i-1] + Y[i]) / 2.0 * (X[i] - X[i-1]);
+
+			LineIntegrals.Assign(move(I));
+			Lazy.LineIntegralReady.store(true, memory_order_release);
+		}
+	}
+
+	const double *I = LineIntegrals.data();
+
+	// the integral from X[0] to x over the same segment as LineValByX takes
+	auto from_x0 = [&](double x)
+		{
+			size_t i = Index ? Index->LowerBound(X, n, x) : lower_bound(X, X + n, x) - X;
+			size_t j = min(max<size_t>(i, 1), n - 1);
+
+			double u = x - X[j-1];
+			double slope = (Y[j] - Y[j-1]) / (X[j] - X[j-1]);
+			return I[j-1] + (Y[j-1] + slope * u / 2.0) * u;
+		};
+
+	return from_x0(x2) - from_x0(x1);
+}
+//---------------------------------------------------------------------------
+
+double TableFunction::SplineIntegral(double x1, double x2) const
+{
+	const CubicSpline &s = GetSpline();
+
+	if (!Lazy.SplineIntegralReady.load(memory_order_acquire))
+	{
+		lock_guard<mutex> lock(Lazy.Mutex);
+		if (!Lazy.SplineIntegralReady.load(memory_order_relaxed))
+		{
+			Spline.BuildIntegral();   // false (and then NaN) if there is no spline
+			Lazy.SplineIntegralReady.store(true, memory_order_release);
+		}
+	}
+
+	return s.Integral(x1, x2);
+}
+//---------------------------------------------------------------------------
+
+bool TableFunction::BuildSpline()
+{
+	Lazy.SplineIntegralReady = Lazy.SplineCrossingsReady = false;
+
+    if (!Spline.BuildSpline(PointsX, PointsY, ThreadsCount))
+		return false;
+
+	if (Index)  // the knots are the same as x
+		Spline.SetSearchIndex(Index);
+
+	Lazy.SplineReady = true;
+	return true;
+}
+//---------------------------------------------------------------------------
+
+const CubicSpline& TableFunction::GetSpline() const
+{
+	if (Lazy.SplineReady.load(memory_order_acquire))
+		return Spline;
+
+	lock_guard<mutex> lock(Lazy.Mutex);
+	if (Lazy.SplineReady.load(memory_order_relaxed))
+		return Spline;
+
+	// the window is solved again if the spline is for the same count of points, otherwise it's built anew
+	size_t n = PointsX.size();
+	if (!Spline.IsSplineExists() || !Spline.UpdateSpline(PointsX, PointsY, min(Lazy.Begin, n), min(Lazy.End, n)))
+	{
+		if (!Spline.BuildSpline(PointsX, PointsY, ThreadsCount))
+		{
+			Spline.Clear();   // too few points
+			return Spline;
+		}
+		if (Index)
+			Spline.SetSearchIndex(Index);
+	}
+
+	Lazy.SplineReady.store(true, memory_order_release);
+	return Spline;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::BuildRangeIndex()
+{
+	RangeIndex.Build(PointsY.data(), PointsY.size(), ThreadsCount);
+	RangeIndexOn = true;
+	Lazy.RangeIndexReady = true;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::ClearRangeIndex()
+{
+	RangeIndex.Clear();
+	RangeIndexOn = false;
+	Lazy.RangeIndexReady = false;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::EnsureRangeIndex() const
+{
+	if (Lazy.RangeIndexReady.load(memory_order_acquire))
+		return;
+
+	lock_guard<mutex> lock(Lazy.Mutex);
+	if (Lazy.RangeIndexReady.load(memory_order_relaxed))
+		return;
+
+	// a few changed values are updated one by one, for more of them (or another count) the index is rebuilt
+	size_t n = PointsY.size();
+	size_t begin = min(Lazy.RangeBegin, n), end = min(Lazy.RangeEnd, n);
+	if (RangeIndex.Size() == n && end - begin <= n / RangeMinMaxIndex::BlockSize)
+	{
+		for (size_t i = begin; i < end; ++i)
+			RangeIndex.Update(PointsY.data(), i);
+	}
+	else
+		RangeIndex.Build(PointsY.data(), n, ThreadsCount);
+
+	Lazy.RangeIndexReady.store(true, memory_order_release);
+}
+//---------------------------------------------------------------------------
+
+bool TableFunction::GetMinMaxY(double x1, double x2, MinMaxInfo &Info) const
+{
+	const double *X = PointsX.data(), *Y = PointsY.data();
+	size_t n = PointsX.size();
+
+	size_t begin = Index ? Index->LowerBound(X, n, x1) : lower_bound(X, X + n, x1) - X;
+	size_t end = upper_bound(X + begin, X + n, x2) - X;
+	if (begin >= end)
+		return false;
+
+	if (RangeIndexOn)
+	{
+		EnsureRangeIndex();
+		RangeExtremes r = RangeIndex.Query(Y, begin, end);
+		Info.iMin = r.iMin;
+		Info.iMax = r.iMax;
+	}
+	else
+	{
+		Info = MinMaxReduce(Y + begin, end - begin, ThreadsCount);
+		Info.iMin += begin;
+		Info.iMax += begin;
+	}
+
+	Info.Min = Y[Info.iMin];
+	Info.Max = Y[Info.iMax];
+	return true;
+}
+//---------------------------------------------------------------------------
+
+bool TableFunction::BuildSearchIndex(SearchIndexType type)
+{
+	Index.reset();
+
+	auto idx = make_shared<SearchIndex>();
+	if (!idx->Build(PointsX.data(), PointsX.size(), type))
+		return false;
+
+	Index = idx;
+
+	if (Spline.HasKnots(PointsX))  // the spline is built for the current points
+		Spline.SetSearchIndex(Index);
+
+	return true;
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::EnsureLineCrossings() const
+{
+	if (Lazy.LineCrossingsReady.load(memory_order_acquire))
+		return;
+
+	lock_guard<mutex> lock(Lazy.Mutex);
+	if (Lazy.LineCrossingsReady.load(memory_order_relaxed))
+		return;
+
+	const double *Y = PointsY.data();
+	size_t n = PointsY.size();
+
+	// NaN fails both checks
+	bool asc = true, desc = true;
+	for (size_t i = 1; i < n && (asc || desc); ++i)
+	{
+		asc = asc && Y[i-1] <= Y[i];
+		desc = desc && Y[i-1] >= Y[i];
+	}
+
+	LineCrossings.Clear();
+	LineMonotone = asc ? 1 : (desc ? -1 : 0);
+
+	if (!LineMonotone)
+	{
+		const double NaN = numeric_limits<double>::quiet_NaN();
+		vector<double> lo(n - 1), hi(n - 1);
+		for (size_t j = 0; j + 1 < n; ++j)
+		{
+			bool bad = std::isnan(Y[j]) || std::isnan(Y[j+1]);
+			lo[j] = bad ? NaN : min(Y[j], Y[j+1]);
+			hi[j] = bad ? NaN : max(Y[j], Y[j+1]);
+		}
+		LineCrossings.Build(lo.data(), hi.data(), n - 1, ThreadsCount);
+	}
+
+	Lazy.LineCrossingsReady.store(true, memory_order_release);
+}
+//---------------------------------------------------------------------------
+
+size_t TableFunction::FindXsByY(double y, vector<double> &xs) const
+{
+	xs.clear();
+
+	const double *X = PointsX.data(), *Y = PointsY.data();
+	size_t n = PointsX.size();
+
+	if (n < 2)
+	{
+		if (n && Y[0] == y)
+			xs.push_back(X[0]);
+		return xs.size();
+	}
+
+	EnsureLineCrossings();
+
+	// the segments j (the points j and j+1) that y crosses, ascending
+	vector<size_t> js;
+	if (LineMonotone && !std::isnan(y))
+	{
+		// the points equal to y are [lb, ub), the segments around them cross it
+		size_t lb, ub;
+		if (LineMonotone > 0)
+		{
+			lb = lower_bound(Y, Y + n, y) - Y;
+			ub = upper_bound(Y + lb, Y + n, y) - Y;
+		}
+		else
+		{
+			lb = lower_bound(Y, Y + n, y, greater<double>()) - Y;
+			ub = upper_bound(Y + lb, Y + n, y, greater<double>()) - Y;
+		}
+		for (size_t j = lb ? lb - 1 : 0; j < min(ub, n - 1); ++j)
+			js.push_back(j);
+	}
+	else
+	{
+		LineCrossings.Query(y, js);
+		sort(js.begin(), js.end());
+	}
+
+	// a segment takes (X[j], X[j+1]] (the first one also X[0]), so a point shared by two segments is taken once
+	for (size_t j : js)
+	{
+		double y0 = Y[j], y1 = Y[j+1];
+		if (j == 0 && y0 == y)
+			xs.push_back(X[0]);
+		if (y1 == y)
+			xs.push_back(X[j+1]);
+		else if ((y0 < y && y < y1) || (y0 > y && y > y1))
+			xs.push_back(min(X[j] + (y - y0) / (y1 - y0) * (X[j+1] - X[j]), X[j+1]));
+	}
+
+	return xs.size();
+}
+//---------------------------------------------------------------------------
+
+void TableFunction::EnsureSplineCrossings() const
+{
+	if (Lazy.SplineCrossingsReady.load(memory_order_acquire))
+		return;
+
+	lock_guard<mutex> lock(Lazy.Mutex);
+	if (Lazy.SplineCrossingsReady.load(memory_order_relaxed))
+		return;
+
+	SplineCrossings.Clear();
+
+	size_t n = Spline.Size();
+	if (n >= 2)
+	{
+		vector<double> lo(n - 1), hi(n - 1);
+		SplineSegmentRanges(Spline.GetKnots(), Spline.GetDataA(), Spline.GetDataB(), Spline.GetDataC(), Spline.GetDataD(),
+							n, lo.data(), hi.data(), ThreadsCount);
+		SplineCrossings.Build(lo.data(), hi.data(), n - 1, ThreadsCount);
+	}
+
+	Lazy.SplineCrossingsReady.store(true, memory_order_release);
+}
+//---------------------------------------------------------------------------
+
+size_t TableFunction::SplineFindXsByY(double y, vector<double> &xs) const
+{
+	xs.clear();
+
+	const CubicSpline &s = GetSpline();
+	if (s.Size() < 2)
+		return 0;
+
+	EnsureSplineCrossings();
+
+	vector<size_t> js;
+	SplineCrossings.Query(y, js);
+	sort(js.begin(), js.end());
+
+	const double *X = s.GetKnots();
+	for (size_t j : js)
+		SplineSolveSegment(X, s.GetDataA(), s.GetDataB(), s.GetDataC(), s.GetDataD(), j + 1, y, xs);
+
+	return xs.size();
+}
+//---------------------------------------------------------------------------
+
+TableFunction TableFunction::Resample(const vector<double> &xs, bool BySpline) const
+{
+	TableFunction r;
+	r.Name = Name;
+	r.ThreadsCount = ThreadsCount;
+	r.Spline.SetType(Spline.GetType());
+
+	vector<double> ys(xs.size());
+	if (BySpline)
+		GetSplineValsByX(xs.data(), ys.data(), xs.size());
+	else
+		GetValsByX(xs.data(), ys.data(), xs.size());
+
+	r.PointsX.Assign(vector<double>(xs));
+	r.PointsY.Assign(move(ys));
+	r.CalcStat();
+	return r;
+}
+//---------------------------------------------------------------------------
+
+TableFunction TableFunction::ResampleUniform(size_t n, bool BySpline) const
+{
+	if (!Size())
+		return Resample(vector<double>(), BySpline);
+
+	double a = GetMinX(), b = GetMaxX();
+	vector<double> xs(n);
+	for (size_t k = 0; k < n; ++k)
+		xs[k] = n > 1 ? a + (b - a) * k / (n - 1) : a;
+	if (n > 1)
+		xs[n-1] = b;
+
+	TableFunction r = Resample(xs, BySpline);
+	r.BuildSearchIndex(SearchIndexType::Uniform);
+	return r;
+}
+//---------------------------------------------------------------------------
+
+TableFunction TableFunction::DecimateLTTB(size_t n) const
+{
+	const double *X = PointsX.data(), *Y = PointsY.data();
+	size_t N = PointsX.size();
+
+	TableFunction r;
+	r.Name = Name;
+	r.ThreadsCount = ThreadsCount;
+	r.Spline.SetType(Spline.GetType());
+
+	if (n >= N || N < 3 || !n)
+	{
+		if (n)
+		{
+			r.PointsX = PointsX;
+			r.PointsY = PointsY;
+			r.CalcStat();
+		}
+		return r;
+	}
+
+	vector<size_t> picked(1, 0);
+	if (n >= 3)
+	{
+		// the buckets [B(i), B(i+1)) of the points between the first and the last ones
+		size_t nb = n - 2;
+		auto B = [N, nb](size_t i) { return 1 + i * (N - 2) / nb; };
+
+		vector<double> ax(nb + 1), ay(nb + 1);
+		ax[nb] = X[N-1];
+		ay[nb] = Y[N-1];
+
+		size_t chunks = min(nb, GetChunksCount(N, ThreadsCount, MinChunkForThread));
+		ParallelFor(nb, chunks, [&](size_t begin, size_t end, size_t)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					size_t b = B(i), e = B(i + 1);
+					double sx = 0, sy = 0;
+					for (size_t k = b; k < e; ++k)
+					{
+						sx += X[k];
+						sy += Y[k];
+					}
+					ax[i] = sx / (e - b);
+					ay[i] = sy / (e - b);
+				}
+			});
+
+		// the point of bucket i after the point (px, py): the first one of the largest triangle
+		auto pick = [&](size_t i, double px, double py)
+			{
+				double cx = ax[i+1], cy = ay[i+1];
+				size_t best = B(i);
+				double MaxArea = -1;
+				for (size_t k = B(i); k < B(i + 1); ++k)
+				{
+					double area = fabs((px - cx) * (Y[k] - py) - (px - X[k]) * (cy - py));
+					if (area > MaxArea)
+					{
+						MaxArea = area;
+						best = k;
+					}
+				}
+				return best;
+			};
+
+		// A pick depends only on the previous one. So every chunk of buckets but the first one starts
+		// from a guess (the average of the bucket before it) in parallel; then, chunk by chunk, its picks
+		// are redone from the real previous one until a pick is the same as the guessed chain had -
+		// the rest of the chunk is right from there. That is usually a bucket or two, and the result
+		// is exactly the one of the serial pass.
+		vector<size_t> picks(nb);
+		ParallelFor(nb, chunks, [&](size_t begin, size_t end, size_t)
+			{
+				double px = begin ? ax[begin-1] : X[0], py = begin ? ay[begin-1] : Y[0];
+				for (size_t i = begin; i < end; ++i)
+				{
+					picks[i] = pick(i, px, py);
+					px = X[picks[i]];
+					py = Y[picks[i]];
+				}
+			});
+
+		for (size_t k = 1; k < chunks; ++k)
+			for (size_t i = nb * k / chunks; i < nb * (k + 1) / chunks; ++i)
+			{
+				size_t p = pick(i, X[picks[i-1]], Y[picks[i-1]]);
+				if (p == picks[i])
+					break;
+				picks[i] = p;
+			}
+
+		picked.insert(picked.end(), picks.begin(), picks.end());
+	}
+	if (n >= 2)
+		picked.push_back(N - 1);
+
+	vector<double> xs(picked.size()), ys(picked.size());
+	for (size_t k = 0; k < picked.size(); ++k)
+	{
+		xs[k] = X[picked[k]];
+		ys[k] = Y[picked[k]];
+	}
+
+	r.PointsX.Assign(move(xs));
+	r.PointsY.Assign(move(ys));
+	r.CalcStat();
+	return r;
+}
+//---------------------------------------------------------------------------
+
+TableFunction TableFunction::BlockAverage(size_t BlockSize) const
+{
+	const double *X = PointsX.data(), *Y = PointsY.data();
+	size_t N = PointsX.size();
+
+	BlockSize = max<size_t>(BlockSize, 1);
+	size_t m = (N + BlockSize - 1) / BlockSize;
+
+	vector<double> xs(m), ys(m);
+	ParallelFor(m, GetChunksCount(N, ThreadsCount, MinChunkForThread), [&](size_t begin, size_t end, size_t)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				size_t b = i * BlockSize, e = min(N, b + BlockSize);
+				double sx = 0, sy = 0;
+				for (size_t k = b; k < e; ++k)
+				{
+					sx += X[k];
+					sy += Y[k];
+				}
+				xs[i] = sx / (e - b);
+				ys[i] = sy / (e - b);
+			}
+		});
+
+	TableFunction r;
+	r.Name = Name;
+	r.ThreadsCount = ThreadsCount;
+	r.Spline.SetType(Spline.GetType());
+	r.PointsX.Assign(move(xs));
+	r.PointsY.Assign(move(ys));
+	r.CalcStat();
+	return r;
+}
+//---------------------------------------------------------------------------
@@ -9,11 +9,19 @@
 //---------------------------------------------------------------------------
 
 #include <vector>
+#include <deque>
 #include <functional>
+#include <atomic>
+#include <mutex>
 #include <cmath>
+#include <memory>
 #include <string>
+#include <tuple>
 
 #include "UnitSpline.h"
+#include "UnitSharedArray.h"
+#include "UnitRangeIndex.h"
+#include "UnitCrossingIndex.h"
 
 namespace tf_gd_lib
 {
@@ -21,55 +29,221 @@ namespace tf_gd_lib
 inline double LineInterpol(double x, double x1, double x2, double y1, double y2);
 inline double LineInterpolSafeMiddleVal(double x, double x1, double x2, double y1, double y2);
 
+// Linear interpolation/extrapolation kernels over sorted columns of n points (Index may be nullptr).
+// They are shared by TableFunction and TableFunctionView.
+double LineValByX(const double* X, const double* Y, size_t n, const SearchIndex* Index, double x);
+void LineValsByX(const double* X, const double* Y, size_t n, const SearchIndex* Index,
+				 const double* xs, double* ys, size_t m, size_t ThreadsCount);
+
+// What happened while loading a text with "x y" lines
+struct LoadInfo
+{
+	size_t LinesCount = 0;                // including blank lines
+	size_t PointsCount = 0;
+	std::vector<size_t> MalformedLines;   // numbers (from 1) of the lines that couldn't be parsed and were skipped
+	bool WasSorted = true;                // x were already ascending, so the sort was skipped
+};
+
+// The minimum and the maximum of an array with their positions; the same as a loop from the start
+// that takes a value only if it's strictly less (greater): the first one of equal values wins,
+// NaN are skipped (unless A[0] is NaN, then it's both). Split across threads for large arrays.
+struct MinMaxInfo
+{
+	double Min = 0.0, Max = 0.0;
+	size_t iMin = 0, iMax = 0;
+};
+
+MinMaxInfo MinMaxReduce(const double* A, size_t n, size_t ThreadsCount = 1);
+
+// What has to be recalculated in a table before use (see TableFunction::GetSpline).
+// The flags are checked without locking, the recalculation is done under the lock.
+// A copy gets the same flags and its own mutex.
+struct LazyState
+{
+	std::atomic<bool> StatDirty{false};
+	std::atomic<bool> SplineReady{false};   // the spline is calculated for the current points
+	size_t Begin = 0, End = 0;              // if it isn't, the points changed since it was
+	std::atomic<bool> LineIntegralReady{false}, SplineIntegralReady{false};
+	std::atomic<bool> RangeIndexReady{false};   // the same as for the spline
+	size_t RangeBegin = 0, RangeEnd = 0;
+	std::atomic<bool> LineCrossingsReady{false}, SplineCrossingsReady{false};
+	std::mutex Mutex;
+
+	LazyState() = default;
+	LazyState(const LazyState& other) { *this = other; }
+	LazyState& operator=(const LazyState& other)
+	{
+		StatDirty = other.StatDirty.load();
+		SplineReady = other.SplineReady.load();
+		Begin = other.Begin;
+		End = other.End;
+		LineIntegralReady = other.LineIntegralReady.load();
+		SplineIntegralReady = other.SplineIntegralReady.load();
+		RangeIndexReady = other.RangeIndexReady.load();
+		RangeBegin = other.RangeBegin;
+		RangeEnd = other.RangeEnd;
+		LineCrossingsReady = other.LineCrossingsReady.load();
+		SplineCrossingsReady = other.SplineCrossingsReady.load();
+		return *this;
+	}
+};
+
+// The candidates for MinY and MaxY of a sliding window (see TableFunction::SetWindowSize):
+// points by ascending x with ascending (descending) y, so the front is the extreme of the window,
+// evicting drops the front, and a new point drops the back it beats. NaN are left out, as MinMaxReduce does.
+// A copy of a table starts without them and rebuilds them on its first AppendPoints.
+struct WindowExtremes
+{
+	std::deque<SinglePoint> Mins, Maxs;
+	bool Ready = false;
+
+	WindowExtremes() = default;
+	WindowExtremes(const WindowExtremes&) {}
+	WindowExtremes& operator=(const WindowExtremes&) { Clear(); return *this; }
+
+	void Clear()
+	{
+		Mins.clear();
+		Maxs.clear();
+		Ready = false;
+	}
+
+	void Push(double x, double y)
+	{
+		if (std::isnan(y))
+			return;
+		while (!Mins.empty() && Mins.back().y > y)   // the first of equal values stays
+			Mins.pop_back();
+		Mins.emplace_back(x, y);
+		while (!Maxs.empty() && Maxs.back().y < y)
+			Maxs.pop_back();
+		Maxs.emplace_back(x, y);
+	}
+
+	// the points from x on are going to be pushed again
+	void PopFrom(double x)
+	{
+		while (!Mins.empty() && Mins.back().x >= x)
+			Mins.pop_back();
+		while (!Maxs.empty() && Maxs.back().x >= x)
+			Maxs.pop_back();
+	}
+
+	// the points before x are gone
+	void EvictBefore(double x)
+	{
+		while (!Mins.empty() && Mins.front().x < x)
+			Mins.pop_front();
+		while (!Maxs.empty() && Maxs.front().x < x)
+			Maxs.pop_front();
+	}
+};
+
 class TableFunction
 {
 private:
 protected:
 
-	std::vector<SinglePoint> Points;
+	// points are kept as two separate contiguous arrays (structure of arrays),
+	// so searching by x doesn't pull y into cache, and loops over x or y can be vectorized;
+	// copies of a table share them until one of the copies changes its points
+	SharedArray<double> PointsX;
+	SharedArray<double> PointsY;
 
-	double MinX = 0.0, MaxX = 0.0;
-	double MinY = 0.0, MaxY = 0.0;
+	// the statistics are recalculated on first use after a change of the points (see LazyState)
+	mutable double MinX = 0.0, MaxX = 0.0;
+	mutable double MinY = 0.0, MaxY = 0.0;
 
-	double x_ForMinY = 0.0, x_ForMaxY = 0.0;
-	size_t i_ForMinY = 0, i_ForMaxY = 0;
+	mutable double x_ForMinY = 0.0, x_ForMaxY = 0.0;
+	mutable size_t i_ForMinY = 0, i_ForMaxY = 0;
 
 	std::string Name;
 
-	mutable size_t iCache = 0;
+	size_t iCache = 0;   // the position of the table's own sequential access
+
+	std::shared_ptr<const SearchIndex> Index;   // optional, shared with Spline
+
+	size_t ThreadsCount = 0; // 0 - use all hardware threads
+
+	size_t WindowSize = 0;   // 0 - no limit for AppendPoints
+	WindowExtremes Window;   // only while there is a limit
+
+	mutable SharedArray<double> LineIntegrals;   // integrals from the first point to each point, see Integral
+
+	mutable RangeMinMaxIndex RangeIndex;   // optional, see BuildRangeIndex
+	bool RangeIndexOn = false;
+
+	// for inverse queries, see FindXsByY
+	mutable CrossingIndex LineCrossings, SplineCrossings;
+	mutable int LineMonotone = 0;   // 1 - y are ascending, -1 - descending, 0 - neither (then LineCrossings is used)
+
+	mutable LazyState Lazy;
+
+	void UpdateStatForPoint(size_t i);
+	void UpdateStatForValue(size_t i);
+
+	void SetStatDirty() { Lazy.StatDirty = true; }
+	void SetSplineDirty(size_t begin, size_t end);   // the points [begin, end) have changed; also the integrals and the indexes
+	void EnsureRangeIndex() const;
+	void EnsureLineCrossings() const;
+	void EnsureSplineCrossings() const;
+
+	void EnsureStat() const { if (Lazy.StatDirty.load(std::memory_order_acquire)) RecalcStat(); }
+	void RecalcStat() const;
+	void CalcStatNow() const;
 
 public:
+	// batch evaluation, Sort, KillDuplicates and CalcStat are split across threads
+	// only if each thread gets at least this amount of points
+	static constexpr size_t MinChunkForThread = 32768;
+
+	// and text parsing - if each thread gets at least this amount of bytes
+	static constexpr size_t MinLoadChunkForThread = 1 << 20;
+
+	// CreateAdaptiveFunction: the initial grid, and the least samples of f per thread
+	static constexpr size_t AdaptiveInitialPoints = 33;
+	static constexpr size_t MinSamplesForThread = 16;
+
 	TableFunction() = default;
 	~TableFunction() = default;
 
-	TableFunction(const TableFunction&) = default;
-	TableFunction& operator=(const TableFunction&) = default;
+	// A copy takes the lazily calculated members under the lock of the source,
+	// so a table can be copied while other threads call its const methods
+	TableFunction(const TableFunction& other);
+	TableFunction& operator=(const TableFunction& other);
 
 	TableFunction(TableFunction&&) = default;
 	TableFunction& operator=(TableFunction&&) = default;
 
 
-	size_t Size() const { return Points.size(); }
+	size_t Size() const { return PointsX.size(); }
 
-	double GetX(size_t i) const { iCache = i; return Points[i].x; };
-	double GetY(size_t i) const { iCache = i; return Points[i].y; };
+	double GetX(size_t i) const { return PointsX[i]; };
+	double GetY(size_t i) const { return PointsY[i]; };
 
+	// read-only contiguous arrays of Size() elements for kernels; invalidated by any change of the points
+	const double* GetDataX() const { return PointsX.data(); }
+	const double* GetDataY() const { return PointsY.data(); }
+
+	// x can be changed through it, so it drops the search index;
+	// the references are valid until the table is copied or changed in another way
 	std::tuple<double &, double &> operator[](size_t i);
 
 	void SetPointByNumber(size_t i, const std::tuple<double, double>& point);
 	void SetValAtPoint(size_t i, double y);
 
-	double GetMinX() const { return MinX; };
-	double GetMaxX() const { return MaxX; };
+	// the statistics are recalculated here if the points have changed since the last time
+	double GetMinX() const { EnsureStat(); return MinX; };
+	double GetMaxX() const { EnsureStat(); return MaxX; };
 
-	double GetMinY() const { return MinY; };
-	double GetMaxY() const { return MaxY; };
+	double GetMinY() const { EnsureStat(); return MinY; };
+	double GetMaxY() const { EnsureStat(); return MaxY; };
 
-	double Get_x_ForMinY() const { return x_ForMinY; };
-	double Get_x_ForMaxY() const { return x_ForMaxY; };
+	double Get_x_ForMinY() const { EnsureStat(); return x_ForMinY; };
+	double Get_x_ForMaxY() const { EnsureStat(); return x_ForMaxY; };
 
-	size_t Get_i_ForMinY() const { return i_ForMinY; };
-	size_t Get_i_ForMaxY() const { return i_ForMaxY; };
+	size_t Get_i_ForMinY() const { EnsureStat(); return i_ForMinY; };
+	size_t Get_i_ForMaxY() const { EnsureStat(); return i_ForMaxY; };
 
 	void SetName(const std::string& name) { Name = name; }
 	std::string GetName() const { return Name; }
@@ -77,30 +251,159 @@ public:
 	double GetValByBSearchFromX(double x) const;
 	double operator()(double x) const { return GetValByBSearchFromX(x); }
 
-	double GetValFromRightX(double x) const;
-	double GetValFromLeftX(double x) const;
+	// Batch evaluation: ys[k] = (*this)(xs[k]). Ascending runs of xs are merged with Points in one pass,
+	// the rest falls back to a search.
+	void GetValsByX(const double* xs, double* ys, size_t n) const;
+	std::vector<double> GetValsByX(const std::vector<double>& xs) const;
+
+	void SetThreadsCount(size_t _ThreadsCount) { ThreadsCount = _ThreadsCount; }
+	size_t GetThreadsCount() const { return ThreadsCount; }
+
+	// A position hint for sequential access. The table itself isn't changed by it,
+	// so one table can be shared by many threads, each with its own cursor.
+	// A cursor must not outlive its table or be used after a change of the points.
+	class Cursor
+	{
+	private:
+		const TableFunction* Table;
+		size_t i;
+
+	public:
+		explicit Cursor(const TableFunction& _Table, size_t _i = 0) : Table(&_Table), i(_i) {}
+
+		// The segment is searched from the cursor's one in either direction by galloping,
+		// so a step costs O(log distance); beyond the table the value is extrapolated.
+		// The result is the same as of operator() of the table.
+		double GetValByX(double x);
+
+		double GetValFromRightX(double x) { return GetValByX(x); }  // for x going forward
+		double GetValFromLeftX(double x) { return GetValByX(x); }   // for x going backward
+
+		size_t GetIndex() const { return i; }
+		void SetIndex(size_t _i) { i = _i; }
+	};
+
+	Cursor GetCursor(size_t i = 0) const { return Cursor(*this, i); }
+
+	// Sequential access by the table's own cursor. Not const: it moves the cursor.
+	// All the other const methods don't change anything, so they are safe to call concurrently.
+	double GetValFromRightX(double x);
+	double GetValFromLeftX(double x);
 
 	void ClearAll();
 
 	void CreateNewFunction(size_t n, const std::string& _name = "NewFunc");
-	void SetPoint(size_t i, double x, double y) { Points[i].x = x; Points[i].y = y; }
+	void SetPoint(size_t i, double x, double y) { SetPointByNumber(i, std::make_tuple(x, y)); }
 
 	static double TestFunc(double x) { return std::sin(10.0 * x); }
 
 	void CreateDemoFunction(size_t n, double a, double dx,
 		std::function<double(double)> f = TestFunc /* = std::sin*/, const std::string& _name = "DemoFunc");	                                                   
 
+	// A tabulated surrogate of an expensive f over [a, b]. The grid starts uniform and intervals are halved
+	// where the interpolation misses f at their middle by more than Tolerance, that is where the curvature is high;
+	// so the points are dense only where they have to be. ForSpline - the spline of the table's type
+	// (see SetSplineType) is checked instead of the linear interpolation.
+	// f is called once per x; new x are sampled in parallel (see SetThreadsCount), so f must be safe to call
+	// from several threads unless the table has one thread. false if MaxPoints stopped the refinement first.
+	bool CreateAdaptiveFunction(double a, double b, std::function<double(double)> f, double Tolerance,
+		bool ForSpline = false, size_t MaxPoints = 1 << 22, const std::string& _name = "AdaptiveFunc");
+
+	// These are parallel for large tables (see SetThreadsCount); the result doesn't depend on the threads count.
+	// Sort is stable: points with equal x keep their order, so KillDuplicates keeps the first of them.
 	void KillDuplicates();
 	void Sort();
 	void CalcStat();
 
-	bool LoadFromFile(const std::string& FileName);
-	void LoadFromStream(std::istream& Stream);
-
-	double GetBackX() { return Points.back().x; }
-
-	CubicSpline Spline;
-	bool BuildSpline();
+	// Streaming ingestion. The table must be sorted without duplicates and with the statistics calculated
+	// (an empty table is). A sorted or nearly sorted batch costs O(batch): it is sorted by itself,
+	// only the tail of the table it overlaps is merged, and the statistics are updated incrementally.
+	// A point with x already present is dropped (the older one is kept).
+	void AppendPoints(const double* xs, const double* ys, size_t n);
+	void AppendPoints(const std::vector<double>& xs, const std::vector<double>& ys);
+
+	// Keeps only the last WindowSize points (by x) after each AppendPoints; 0 - no limit.
+	// The evicted points aren't moved out (the storage is compacted now and then), and MinY and MaxY
+	// are kept by WindowExtremes, so a batch still costs amortized O(batch), also with NaN in the window.
+	void SetWindowSize(size_t _WindowSize) { WindowSize = _WindowSize; Window.Clear(); }
+	size_t GetWindowSize() const { return WindowSize; }
+
+	// The text is "x y" per line; blank lines are skipped, malformed lines are skipped and reported in Info.
+	// A file is memory-mapped and parsed by several threads; the sort is skipped if x are already ascending.
+	bool LoadFromFile(const std::string& FileName, LoadInfo* Info = nullptr);
+	void LoadFromStream(std::istream& Stream, LoadInfo* Info = nullptr);
+	void LoadFromText(const char* Text, size_t TextSize, LoadInfo* Info = nullptr);
+
+	// Binary table file: sorted x/y columns, the statistics, and the spline (if it's built for the current points).
+	// Such a file can also be opened without copying by TableFunctionView (see UnitTableFile.h).
+	bool SaveToBinaryFile(const std::string& FileName) const;   // false if x aren't sorted
+	bool LoadFromBinaryFile(const std::string& FileName);
+
+	double GetBackX() { return PointsX.back(); }
+
+	// Spline is kept as it is until BuildSpline, GetSpline or SplineVal
+	mutable CubicSpline Spline;
+	bool BuildSpline();   // a full build is parallel for large tables (see SetThreadsCount and CubicSpline::BuildSpline)
+
+	// Natural by default. With a local spline (Akima, Pchip) a change of a point costs O(1) in GetSpline.
+	void SetSplineType(SplineType Type);
+	SplineType GetSplineType() const { return Spline.GetType(); }
+
+	// The spline for the current points: it's built on first use and recalculated after changes of the points.
+	// If neither the count nor the order of the points has changed, only a window of the spline around
+	// the changed points is recalculated.
+	const CubicSpline& GetSpline() const;
+	double SplineVal(double x) const { return GetSpline()(x); }
+	void GetSplineValsByX(const double* xs, double* ys, size_t n) const { GetSpline().GetValsByX(xs, ys, n, ThreadsCount); }
+
+	// Derivatives of the spline of the order 1..3, right from its coefficients
+	double SplineDerivative(double x, unsigned Order = 1) const { return GetSpline().Derivative(x, Order); }
+	void GetSplineDerivativesByX(const double* xs, double* ys, size_t n, unsigned Order = 1) const
+		{ GetSpline().GetDerivativesByX(xs, ys, n, Order, ThreadsCount); }
+
+	// Integrals over [x1, x2] of the linear interpolation and of the spline, extrapolated the same way as the values
+	// (negative if x1 > x2). The integrals from the first point to each point are calculated on first use
+	// after a change of the points, then a query costs two searches by x (O(1) with a uniform search index).
+	double Integral(double x1, double x2) const;
+	double SplineIntegral(double x1, double x2) const;   // NaN if there is no spline (too few points)
+
+	// Optional acceleration of the search by x for both the linear and the spline evaluation.
+	// Must be built after Sort(); any change of x (SetPoint, operator[], Sort, ...) drops it.
+	bool BuildSearchIndex(SearchIndexType type = SearchIndexType::Auto);
+	SearchIndexType GetSearchIndexType() const { return Index ? Index->GetType() : SearchIndexType::None; }
+
+	// The minimum and the maximum of y over the points with x in [x1, x2], with their positions
+	// (the same as MinMaxReduce over them); false if there are no such points.
+	// Without the range index it's a scan of the points; with it a query costs O(log n).
+	// The index is kept up to date after changes of the points: a few changed points are updated one by one
+	// on the next query, otherwise it's rebuilt.
+	bool GetMinMaxY(double x1, double x2, MinMaxInfo& Info) const;
+	void BuildRangeIndex();
+	void ClearRangeIndex();
+	bool IsRangeIndexExists() const { return RangeIndexOn; }
+
+	// Inverse queries (the points must be sorted): all x in [MinX, MaxX] where the linear interpolation
+	// (the spline) equals y, ascending; a flat piece at the level y gives its points. Returns the count.
+	// Nothing is extrapolated beyond the points.
+	// If y of the points are monotone, it's a binary search over them. Otherwise the ranges of y of the segments
+	// are indexed on first use after a change of the points (see CrossingIndex), and a query costs O(log n + k)
+	// for k crossings. The spline is always indexed: it can overshoot between monotone points.
+	size_t FindXsByY(double y, std::vector<double>& xs) const;
+	size_t SplineFindXsByY(double y, std::vector<double>& xs) const;
+
+	// Compact copies of a large table (sorted, without NaN), for coarse fits and plots. Each one is a single pass
+	// over the points split across threads (see SetThreadsCount); the result doesn't depend on the threads count.
+	// The new table gets the name, the threads count and the spline type of this one.
+	// Resample - the values (or the spline) at sorted xs; ResampleUniform - at n points from MinX to MaxX,
+	// the result has a uniform search index.
+	TableFunction Resample(const std::vector<double>& xs, bool BySpline = false) const;
+	TableFunction ResampleUniform(size_t n, bool BySpline = false) const;
+	// Largest-Triangle-Three-Buckets: n of the points that keep the shape (peaks and dips) - the first and
+	// the last ones, and one of each of n - 2 buckets, the one that makes the largest triangle with the point
+	// taken before it and the average of the next bucket
+	TableFunction DecimateLTTB(size_t n) const;
+	// Averages of x and y over blocks of BlockSize points (the last block may be shorter)
+	TableFunction BlockAverage(size_t BlockSize) const;
 
 };
 //---------------------------------------------------------------------------
@@ -0,0 +1,1066 @@
+//          Copyright Sergey Tsynikin 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+// Throughput measurements of the library hot paths.
+// Usage: tf_gd_lib_bench [size multiplier]
+
+#include "UnitSpline.h"
+#include "UnitTableFunctions.h"
+#include "UnitGradDescent.h"
+#include "UnitSearchIndex.h"
+#include "UnitTableFile.h"
+#include "UnitSimd.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace tf_gd_lib;
+
+using BenchClock = std::chrono::steady_clock;
+
+// Runs f once and returns the elapsed time in seconds
+template <typename F>
+double Measure(F&& f)
+{
+	auto t0 = BenchClock::now();
+	f();
+	auto t1 = BenchClock::now();
+	return chrono::duration<double>(t1 - t0).count();
+}
+//---------------------------------------------------------------------------
+
+void PrintResult(const string& name, double seconds, double items, const string& unit = "Mx/s")
+{
+	cout << "  " << left << setw(40) << name << right
+		 << fixed << setprecision(3) << setw(10) << seconds * 1e3 << " ms"
+		 << setprecision(1) << setw(12) << items / seconds / 1e6 << " " << unit << endl;
+}
+//---------------------------------------------------------------------------
+
+double CheckSum(const vector<double>& v)
+{
+	double s = 0;
+	for (double a : v)
+		s += a;
+	return s;
+}
+//---------------------------------------------------------------------------
+
+void BenchBatchEvaluation(size_t mult)
+{
+	cout << "TableFunction batch evaluation" << endl;
+
+	const size_t n = 1000000 * mult;
+	const size_t m = 4000000 * mult;
+
+	TableFunction tf;
+	tf.CreateDemoFunction(n, -1.0, 2.0 / n);
+
+	mt19937_64 gen(42);
+	uniform_real_distribution<double> dist(-1.1, 1.1);
+
+	vector<double> xs_random(m), xs_sorted(m), ys(m);
+	for (auto& x : xs_random)
+		x = dist(gen);
+	for (size_t k = 0; k < m; ++k)
+		xs_sorted[k] = -1.1 + 2.2 * k / m;
+
+	for (auto* xs : {&xs_sorted, &xs_random})
+	{
+		string kind = (xs == &xs_sorted) ? "sorted x" : "random x";
+
+		double t = Measure([&]()
+			{
+				for (size_t k = 0; k < m; ++k)
+					ys[k] = tf((*xs)[k]);
+			});
+		double s1 = CheckSum(ys);
+		PrintResult("scalar operator(), " + kind, t, (double)m);
+
+		tf.SetThreadsCount(1);
+		t = Measure([&]() { tf.GetValsByX(xs->data(), ys.data(), m); });
+		PrintResult("GetValsByX 1 thread, " + kind, t, (double)m);
+
+		tf.SetThreadsCount(0);
+		t = Measure([&]() { tf.GetValsByX(xs->data(), ys.data(), m); });
+		double s2 = CheckSum(ys);
+		PrintResult("GetValsByX all threads, " + kind, t, (double)m);
+
+		if (fabs(s1 - s2) > 1e-6 * (1 + fabs(s1)))
+			cout << "  !!! results differ: " << s1 << " vs " << s2 << endl;
+	}
+}
+//---------------------------------------------------------------------------
+
+void BenchCursor(size_t mult)
+{
+	cout << "Sequential access by a cursor, sweeps with a stride" << endl;
+
+	const size_t n = 1000000 * mult;
+	const size_t m = 2000000;
+
+	TableFunction tf;
+	tf.CreateDemoFunction(n, -1.0, 2.0 / n);
+
+	for (size_t stride : {size_t(1), size_t(100), size_t(10000)})
+	{
+		// back and forth over the table, every step is about stride points
+		double dx = 2.0 * stride / n;
+		double s1 = 0, s2 = 0;
+
+		double t = Measure([&]()
+			{
+				double x = -1.0, d = dx;
+				for (size_t k = 0; k < m; ++k, x += d)
+				{
+					if (x > 1.0 || x < -1.0)
+						d = -d;
+					s1 += tf(x);
+				}
+			});
+		PrintResult("operator(), stride " + to_string(stride), t, (double)m);
+
+		TableFunction::Cursor c = tf.GetCursor();
+		t = Measure([&]()
+			{
+				double x = -1.0, d = dx;
+				for (size_t k = 0; k < m; ++k, x += d)
+				{
+					if (x > 1.0 || x < -1.0)
+						d = -d;
+					s2 += c.GetValByX(x);
+				}
+			});
+		PrintResult("Cursor, stride " + to_string(stride), t, (double)m);
+
+		if (s1 != s2)
+			cout << "  !!! results differ" << endl;
+	}
+}
+//---------------------------------------------------------------------------
+
+void BenchSearchIndex(size_t mult)
+{
+	cout << "SearchIndex vs lower_bound, random x" << endl;
+
+	const size_t n = 4000000 * mult;
+	const size_t m = 2000000 * mult;
+
+	vector<double> uniform(n), jittered(n), clustered(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		uniform[i] = 0.5 * i;
+		jittered[i] = i + 0.3 * sin(i * 1.7);
+		clustered[i] = pow(1.001, i % 10000) + 1e9 * (i / 10000);
+	}
+
+	mt19937_64 gen(42);
+
+	vector<pair<string, vector<double>*>> grids = {
+		{"uniform grid", &uniform}, {"jittered grid", &jittered}, {"clustered grid", &clustered} };
+
+	for (auto& g : grids)
+	{
+		const vector<double>& X = *g.second;
+
+		uniform_real_distribution<double> dist(X.front(), X.back());
+		vector<double> xs(m);
+		for (auto& x : xs)
+			x = dist(gen);
+
+		size_t sum0 = 0;
+		double t = Measure([&]()
+			{
+				for (double x : xs)
+					sum0 += lower_bound(X.begin(), X.end(), x) - X.begin();
+			});
+		PrintResult("lower_bound, " + g.first, t, (double)m);
+
+		vector<pair<string, SearchIndexType>> types = {
+			{"Uniform", SearchIndexType::Uniform}, {"Buckets", SearchIndexType::Buckets}, {"Eytzinger", SearchIndexType::Eytzinger} };
+
+		for (auto& type : types)
+		{
+			SearchIndex idx;
+			if (!idx.Build(X.data(), n, type.second))
+				continue;
+
+			size_t sum = 0;
+			t = Measure([&]()
+				{
+					for (double x : xs)
+						sum += idx.LowerBound(X.data(), n, x);
+				});
+			PrintResult(type.first + ", " + g.first, t, (double)m);
+
+			if (sum != sum0)
+				cout << "  !!! results differ" << endl;
+		}
+	}
+
+	cout << "CubicSpline evaluation, random x" << endl;
+
+	TableFunction tf;
+	tf.CreateDemoFunction(n, -1.0, 2.0 / n);
+	tf.BuildSpline();
+
+	uniform_real_distribution<double> dist(-1.0, 1.0);
+	vector<double> xs(m);
+	for (auto& x : xs)
+		x = dist(gen);
+
+	double s1 = 0, s2 = 0;
+	double t = Measure([&]() { for (double x : xs) s1 += tf.Spline(x); });
+	PrintResult("spline, binary search", t, (double)m);
+
+	tf.BuildSearchIndex();
+	t = Measure([&]() { for (double x : xs) s2 += tf.Spline(x); });
+	PrintResult("spline, Auto index", t, (double)m);
+
+	if (s1 != s2)
+		cout << "  !!! results differ" << endl;
+
+	cout << "CubicSpline resampling, sorted x" << endl;
+
+	TableFunction plain;
+	plain.CreateDemoFunction(n, -1.0, 2.0 / n);
+	const CubicSpline& sp = plain.GetSpline();
+
+	vector<double> sorted(m), ys(m);
+	for (size_t k = 0; k < m; ++k)
+		sorted[k] = -1.0 + 2.0 * k / m;
+
+	s1 = s2 = 0;
+	t = Measure([&]() { for (double x : sorted) s1 += sp(x); });
+	PrintResult("spline operator()", t, (double)m);
+
+	CubicSpline::Cursor c = sp.GetCursor();
+	t = Measure([&]() { for (double x : sorted) s2 += c(x); });
+	PrintResult("spline Cursor", t, (double)m);
+
+	t = Measure([&]() { sp.GetValsByX(sorted.data(), ys.data(), m, 1); });
+	PrintResult("spline GetValsByX 1 thread", t, (double)m);
+
+	if (s1 != s2 || fabs(CheckSum(ys) - s1) > 1e-6 * (1 + fabs(s1)))
+		cout << "  !!! results differ" << endl;
+
+	cout << "CubicSpline batch, random x, no index" << endl;
+
+	static const char* LevelNames[] = {"Scalar", "AVX2", "AVX-512"};
+	SimdLevel max = GetMaxSimdLevel();
+	double sum0 = 0;
+	for (int level = (int)SimdLevel::Scalar; level <= (int)max; ++level)
+	{
+		SetSimdLevel((SimdLevel)level);
+		t = Measure([&]() { sp.GetValsByX(xs.data(), ys.data(), m, 1); });
+		PrintResult(string("spline GetValsByX 1 thread, ") + LevelNames[level], t, (double)m);
+
+		double sum = CheckSum(ys);
+		if (level == (int)SimdLevel::Scalar)
+			sum0 = sum;
+		else if (sum != sum0)
+			cout << "  !!! results differ" << endl;
+	}
+	SetSimdLevel(max);
+}
+//---------------------------------------------------------------------------
+
+// The loader as it was before the fast path: getline + sscanf + push_back + full sort
+void LegacyLoad(const string& FileName, vector<SinglePoint>& Points)
+{
+	ifstream f(FileName);
+	Points.clear();
+
+	string line;
+	while (getline(f, line))
+	{
+		double x, y;
+		if (sscanf(line.c_str(), "%lf%lf", &x, &y) == 2)
+			Points.emplace_back(x, y);
+	}
+
+	sort(Points.begin(), Points.end(), [](const SinglePoint& a, const SinglePoint& b)
+		{
+			return a.x < b.x;
+		});
+}
+//---------------------------------------------------------------------------
+
+void BenchLoad(size_t mult)
+{
+	cout << "Loading a text file" << endl;
+
+	const size_t n = 4000000 * mult;
+	const string FileName = "tf_gd_lib_bench_load.txt";
+
+	{
+		ofstream f(FileName);
+		char buf[64];
+		for (size_t i = 0; i < n; ++i)
+		{
+			snprintf(buf, sizeof(buf), "%.10g\t%.17g\n", i * 0.001, sin(i * 0.001));
+			f << buf;
+		}
+	}
+
+	double mb = 0;
+	{
+		ifstream f(FileName, ios::binary | ios::ate);
+		mb = (double)f.tellg();
+	}
+
+	vector<SinglePoint> legacy;
+	double t = Measure([&]() { LegacyLoad(FileName, legacy); });
+	PrintResult("getline + sscanf", t, mb, "MB/s");
+
+	TableFunction tf;
+	tf.SetThreadsCount(1);
+	t = Measure([&]() { tf.LoadFromFile(FileName); });
+	PrintResult("LoadFromFile 1 thread", t, mb, "MB/s");
+
+	tf.SetThreadsCount(0);
+	t = Measure([&]() { tf.LoadFromFile(FileName); });
+	PrintResult("LoadFromFile all threads", t, mb, "MB/s");
+
+	if (tf.Size() != legacy.size() || tf.GetY(n/2) != legacy[n/2].y)
+		cout << "  !!! results differ" << endl;
+
+	remove(FileName.c_str());
+
+	const string BinFileName = "tf_gd_lib_bench_load.bin";
+	tf.BuildSpline();
+	tf.SaveToBinaryFile(BinFileName);
+
+	TableFunction tf2;
+	t = Measure([&]() { tf2.LoadFromBinaryFile(BinFileName); });
+	PrintResult("LoadFromBinaryFile (copy)", t, mb, "MB/s");
+
+	TableFunctionView view;
+	t = Measure([&]() { view.Open(BinFileName); });
+	cout << "  " << left << setw(40) << "TableFunctionView::Open (mmap)" << right
+		 << fixed << setprecision(3) << setw(10) << t * 1e3 << " ms" << endl;
+
+	if (view.Size() != tf.Size() || view(0.5) != tf(0.5))
+		cout << "  !!! results differ" << endl;
+
+	view.Close();
+	remove(BinFileName.c_str());
+}
+//---------------------------------------------------------------------------
+
+void BenchAppend(size_t mult)
+{
+	cout << "Streaming append" << endl;
+
+	const size_t Batches = 2000 * mult;
+	const size_t BatchSize = 1000;
+	const size_t Total = Batches * BatchSize;
+
+	vector<double> xs(BatchSize), ys(BatchSize);
+	auto make_batch = [&](size_t b)
+		{
+			for (size_t k = 0; k < BatchSize; ++k)
+			{
+				// nearly sorted: every 10th point is a bit late
+				xs[k] = (double)(b*BatchSize + k) - (k % 10 == 5 ? 3.5 : 0.0);
+				ys[k] = sin(xs[k] * 0.001);
+			}
+		};
+
+	// what it was before: add the points and redo everything
+	TableFunction full;
+	const size_t FullBatches = min<size_t>(Batches, 200);
+	double t = Measure([&]()
+		{
+			full.ClearAll();
+			for (size_t b = 0; b < FullBatches; ++b)
+			{
+				make_batch(b);
+				size_t n = full.Size();
+				TableFunction grown;
+				grown.CreateNewFunction(n + BatchSize);
+				for (size_t i = 0; i < n; ++i)
+					grown.SetPoint(i, full.GetX(i), full.GetY(i));
+				for (size_t k = 0; k < BatchSize; ++k)
+					grown.SetPoint(n + k, xs[k], ys[k]);
+				grown.Sort();
+				grown.KillDuplicates();
+				grown.CalcStat();
+				full = move(grown);
+			}
+		});
+	PrintResult("rebuild + Sort (200 batches)", t, (double)FullBatches * BatchSize);
+
+	TableFunction tf;
+	t = Measure([&]()
+		{
+			tf.ClearAll();
+			for (size_t b = 0; b < Batches; ++b)
+			{
+				make_batch(b);
+				tf.AppendPoints(xs.data(), ys.data(), BatchSize);
+			}
+		});
+	PrintResult("AppendPoints", t, (double)Total);
+
+	TableFunction win;
+	win.SetWindowSize(100000);
+	t = Measure([&]()
+		{
+			win.ClearAll();
+			for (size_t b = 0; b < Batches; ++b)
+			{
+				make_batch(b);
+				win.AppendPoints(xs.data(), ys.data(), BatchSize);
+			}
+		});
+	PrintResult("AppendPoints, window 100000", t, (double)Total);
+
+	// small batches into a large full window: a batch shouldn't cost the window
+	TableFunction big;
+	big.SetWindowSize(1000000);
+	big.CreateDemoFunction(1000000, 0.0, 1.0, [](double x) { return sin(x * 0.001); });
+	const size_t SmallBatches = 100000;
+	double xsmall[10], ysmall[10];
+	t = Measure([&]()
+		{
+			for (size_t b = 0; b < SmallBatches; ++b)
+			{
+				for (size_t k = 0; k < 10; ++k)
+				{
+					xsmall[k] = 1000000.0 + b*10 + k;
+					ysmall[k] = sin(xsmall[k] * 0.001);
+				}
+				big.AppendPoints(xsmall, ysmall, 10);
+			}
+		});
+	PrintResult("AppendPoints by 10, window 1000000", t, SmallBatches * 10.0);
+
+	if (tf.Size() != Total || win.Size() != 100000 || win.GetMaxX() != tf.GetMaxX() || big.Size() != 1000000)
+		cout << "  !!! results differ" << endl;
+}
+//---------------------------------------------------------------------------
+
+void BenchPreprocessing(size_t mult)
+{
+	cout << "Sort, KillDuplicates, CalcStat" << endl;
+
+	const size_t n = 5000000 * mult;
+
+	TableFunction src;
+	src.CreateNewFunction(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		double x = (double)((i * 2654435761u) % (n / 2));   // shuffled, every x about twice
+		src.SetPoint(i, x, sin(x * 0.001));
+	}
+
+	double first = 0;
+	for (size_t threads : {size_t(1), size_t(0)})
+	{
+		TableFunction tf = src;
+		tf.SetThreadsCount(threads);
+		string suffix = threads ? " 1 thread" : " all threads";
+
+		double t = Measure([&]() { tf.Sort(); });
+		PrintResult("Sort" + suffix, t, (double)n);
+
+		t = Measure([&]() { tf.KillDuplicates(); });
+		PrintResult("KillDuplicates" + suffix, t, (double)n);
+
+		t = Measure([&]() { tf.CalcStat(); });
+		PrintResult("CalcStat" + suffix, t, (double)tf.Size());
+
+		double check = CheckSum(vector<double>(tf.GetDataY(), tf.GetDataY() + tf.Size())) + tf.GetMinY() + tf.Get_i_ForMaxY();
+		if (threads && !first)
+			first = check;
+		else if (check != first)
+			cout << "  !!! results differ" << endl;
+	}
+}
+//---------------------------------------------------------------------------
+
+void BenchSplineBuild(size_t mult)
+{
+	cout << "CubicSpline::BuildSpline" << endl;
+
+	const size_t n = 10000000 * mult;
+	vector<double> x(n), y(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		x[i] = i * 0.01 + 0.003 * sin(i * 1.7);
+		y[i] = sin(x[i] * 0.05);
+	}
+
+	CubicSpline serial;
+	serial.BuildSpline(x.data(), y.data(), n);   // the first build allocates
+
+	double t = Measure([&]() { serial.BuildSpline(x.data(), y.data(), n, 1); });
+	PrintResult("serial solver, rebuild", t, (double)n);
+
+	for (size_t threads : {size_t(4), size_t(0)})
+	{
+		CubicSpline sp;
+		sp.BuildSpline(x.data(), y.data(), n, threads);
+
+		t = Measure([&]() { sp.BuildSpline(x.data(), y.data(), n, threads); });
+		PrintResult(threads ? "partitioned solver, 4 chunks" : "partitioned solver, all threads", t, (double)n);
+
+		double err = 0;
+		for (size_t i = 0; i < n; ++i)
+			err = max(err, fabs(sp.GetDataC()[i] - serial.GetDataC()[i]));
+		if (err > 1e-12)
+			cout << "  !!! results differ" << endl;
+	}
+
+	for (size_t threads : {size_t(1), size_t(4)})
+	{
+		CubicSpline akima;
+		akima.SetType(SplineType::Akima);
+		akima.BuildSpline(x.data(), y.data(), n, threads);
+
+		t = Measure([&]() { akima.BuildSpline(x.data(), y.data(), n, threads); });
+		PrintResult(threads == 1 ? "Akima, 1 thread" : "Akima, 4 chunks", t, (double)n);
+	}
+}
+//---------------------------------------------------------------------------
+
+void BenchCalculus(size_t mult)
+{
+	cout << "Derivatives and integrals of the spline" << endl;
+
+	const size_t n = 1000000 * mult;
+	const size_t m = 1000000;
+
+	TableFunction tf;
+	tf.CreateDemoFunction(n, -1.0, 2.0 / n);
+	tf.SetThreadsCount(1);
+	tf.GetSpline();
+
+	mt19937_64 gen(7);
+	uniform_real_distribution<double> dist(-1.0, 1.0);
+	vector<double> xs(m), ys(m), lo(m), hi(m);
+	for (auto& x : xs)
+		x = dist(gen);
+
+	// a central difference needs two evaluations and loses half of the digits
+	const double h = 1e-6;
+	double t = Measure([&]()
+		{
+			for (size_t k = 0; k < m; ++k)
+			{
+				lo[k] = xs[k] - h;
+				hi[k] = xs[k] + h;
+			}
+			tf.GetSplineValsByX(lo.data(), lo.data(), m);
+			tf.GetSplineValsByX(hi.data(), hi.data(), m);
+			for (size_t k = 0; k < m; ++k)
+				ys[k] = (hi[k] - lo[k]) / (2 * h);
+		});
+	PrintResult("central difference, 2 batches", t, (double)m);
+
+	t = Measure([&]() { tf.GetSplineDerivativesByX(xs.data(), ys.data(), m); });
+	PrintResult("GetSplineDerivativesByX", t, (double)m);
+
+	// integrals over random ranges: Simpson's rule by 101 values, and two prefix lookups
+	const size_t q = m / 100;
+	double s1 = 0, s2 = 0;
+	t = Measure([&]()
+		{
+			for (size_t k = 0; k < q; ++k)
+			{
+				double a = min(xs[2*k], xs[2*k+1]), b = max(xs[2*k], xs[2*k+1]), step = (b - a) / 100;
+				double sum = tf.SplineVal(a) + tf.SplineVal(b);
+				for (size_t i = 1; i < 100; ++i)
+					sum += (i % 2 ? 4 : 2) * tf.SplineVal(a + i * step);
+				s1 += sum * step / 3;
+			}
+		});
+	PrintResult("Simpson's rule, 101 values", t, q * 1e6, "queries/s");
+
+	tf.SplineIntegral(0, 0);   // the prefix sums
+	t = Measure([&]()
+		{
+			for (size_t k = 0; k < q; ++k)
+				s2 += tf.SplineIntegral(min(xs[2*k], xs[2*k+1]), max(xs[2*k], xs[2*k+1]));
+		});
+	PrintResult("SplineIntegral", t, q * 1e6, "queries/s");
+
+	if (fabs(s1 - s2) > 1e-4 * (1 + fabs(s2)))   // Simpson's rule is that rough for sin(10x)
+		cout << "  !!! results differ" << endl;
+}
+//---------------------------------------------------------------------------
+
+void BenchRangeMinMax(size_t mult)
+{
+	cout << "Min/max over ranges of x" << endl;
+
+	const size_t n = 4000000 * mult;
+	const size_t q = 2000;
+
+	TableFunction tf;
+	tf.CreateDemoFunction(n, 0.0, 1.0);
+	tf.SetThreadsCount(1);
+
+	mt19937_64 gen(11);
+	uniform_real_distribution<double> dist(0.0, (double)n);
+	vector<double> lo(q), hi(q);
+	for (size_t k = 0; k < q; ++k)
+	{
+		lo[k] = dist(gen);
+		hi[k] = lo[k] + dist(gen) / 10;   // up to a tenth of the table
+	}
+
+	MinMaxInfo info;
+	double s1 = 0, s2 = 0;
+	double t = Measure([&]()
+		{
+			for (size_t k = 0; k < q; ++k)
+				if (tf.GetMinMaxY(lo[k], hi[k], info))
+					s1 += info.Min + info.Max + info.iMin;
+		});
+	PrintResult("scan", t, q * 1e6, "queries/s");
+
+	t = Measure([&]() { tf.BuildRangeIndex(); });
+	PrintResult("BuildRangeIndex", t, (double)n);
+
+	t = Measure([&]()
+		{
+			for (size_t k = 0; k < q; ++k)
+				if (tf.GetMinMaxY(lo[k], hi[k], info))
+					s2 += info.Min + info.Max + info.iMin;
+		});
+	PrintResult("range index", t, q * 1e6, "queries/s");
+
+	if (s1 != s2)
+		cout << "  !!! results differ" << endl;
+
+	t = Measure([&]()
+		{
+			for (size_t k = 0; k < q; ++k)
+			{
+				tf.SetValAtPoint((k * 7919) % n, cos(k));
+				if (tf.GetMinMaxY(lo[k], hi[k], info))
+					s1 += info.Min;
+			}
+		});
+	PrintResult("range index, edit + query", t, q * 1e6, "queries/s");
+}
+//---------------------------------------------------------------------------
+
+void BenchInverse(size_t mult)
+{
+	cout << "Inverse queries: x for y" << endl;
+
+	const size_t n = 4000000 * mult;
+	const size_t q = 200;
+
+	TableFunction tf;
+	tf.CreateDemoFunction(n, 0.0, 1e-5);
+	tf.SetThreadsCount(1);
+
+	vector<double> levels(q);
+	for (size_t k = 0; k < q; ++k)
+		levels[k] = sin(k * 1.7);
+
+	// what it takes without the index: a pass over all the segments
+	size_t c1 = 0, c2 = 0;
+	double t = Measure([&]()
+		{
+			for (double y : levels)
+				for (size_t j = 0; j + 1 < n; ++j)
+				{
+					double y0 = tf.GetY(j), y1 = tf.GetY(j+1);
+					c1 += (j == 0 && y0 == y) + ((y1 == y) || (y0 < y && y < y1) || (y0 > y && y > y1));
+				}
+		});
+	PrintResult("scan", t, q * 1e6, "queries/s");
+
+	vector<double> xs;
+	t = Measure([&]() { tf.FindXsByY(0.0, xs); });
+	PrintResult("first query (builds the index)", t, (double)n);
+
+	t = Measure([&]()
+		{
+			for (double y : levels)
+				c2 += tf.FindXsByY(y, xs);
+		});
+	PrintResult("crossing index", t, q * 1e6, "queries/s");
+
+	if (c1 != c2)
+		cout << "  !!! results differ" << endl;
+
+	t = Measure([&]() { tf.SplineFindXsByY(0.0, xs); });
+	PrintResult("spline, first query", t, (double)n);
+
+	t = Measure([&]()
+		{
+			for (double y : levels)
+				c2 += tf.SplineFindXsByY(y, xs);
+		});
+	PrintResult("spline, crossing index", t, q * 1e6, "queries/s");
+
+	TableFunction up;
+	up.CreateDemoFunction(n, 0.0, 1e-5, [](double x) { return x * x; });
+	up.FindXsByY(0.0, xs);
+
+	t = Measure([&]()
+		{
+			for (size_t k = 0; k < 100 * q; ++k)
+				c2 += up.FindXsByY(k * 1e-3, xs);
+		});
+	PrintResult("monotone, binary search", t, 100 * q * 1e6, "queries/s");
+}
+//---------------------------------------------------------------------------
+
+void BenchAdaptive(size_t mult)
+{
+	cout << "Adaptive tabulation of an expensive function" << endl;
+
+	// a model that takes about a microsecond, with a narrow peak
+	auto f = [](double x)
+		{
+			double s = 0;
+			for (int k = 1; k <= 50; ++k)
+				s += sin(k * x) / (k * k);
+			return s + exp(-(x - 1.0) * (x - 1.0) * 2500.0);
+		};
+
+	const double a = -2.0, b = 3.0, tol = 1e-6;
+
+	TableFunction lin, spl;
+	double t = Measure([&]() { lin.CreateAdaptiveFunction(a, b, f, tol); });
+	PrintResult("linear, " + to_string(lin.Size()) + " points", t, (double)lin.Size());
+
+	t = Measure([&]() { spl.CreateAdaptiveFunction(a, b, f, tol, true); });
+	PrintResult("spline, " + to_string(spl.Size()) + " points", t, (double)spl.Size());
+
+	const size_t m = 1000000 * mult;
+	vector<double> xs(m), ys(m);
+	for (size_t k = 0; k < m; ++k)
+		xs[k] = a + (b - a) * k / m;
+
+	double sum = 0;
+	t = Measure([&]()
+		{
+			for (size_t k = 0; k < m; ++k)
+				sum += f(xs[k]);
+		});
+	PrintResult("the function itself", t, (double)m);
+
+	t = Measure([&]() { spl.GetSplineValsByX(xs.data(), ys.data(), m); });
+	PrintResult("the spline surrogate, sorted batch", t, (double)m);
+
+	double err = 0;
+	for (size_t k = 0; k < m; k += 97)
+		err = max(err, fabs(ys[k] - f(xs[k])));
+	if (err > 10 * tol || sum != sum)
+		cout << "  !!! results differ" << endl;
+}
+//---------------------------------------------------------------------------
+
+void BenchResample(size_t mult)
+{
+	cout << "Resampling a large table to 10000 points" << endl;
+
+	const size_t n = 10000000 * mult;
+	TableFunction tf;
+	tf.CreateDemoFunction(n, 0.0, 1e-6, [](double x) { return sin(10.0 * x) + sin(x * 7919.0) * 0.1; });
+
+	for (size_t threads : {size_t(1), size_t(0)})
+	{
+		tf.SetThreadsCount(threads);
+		string suffix = threads ? ", 1 thread" : ", all threads";
+
+		TableFunction r;
+		double t = Measure([&]() { r = tf.ResampleUniform(10000); });
+		PrintResult("ResampleUniform" + suffix, t, (double)r.Size());
+
+		t = Measure([&]() { r = tf.DecimateLTTB(10000); });
+		PrintResult("DecimateLTTB" + suffix, t, (double)n);
+
+		t = Measure([&]() { r = tf.BlockAverage(n / 10000); });
+		PrintResult("BlockAverage" + suffix, t, (double)n);
+	}
+}
+//---------------------------------------------------------------------------
+
+void BenchLazyUpdate(size_t mult)
+{
+	cout << "Edit a point, then evaluate the spline" << endl;
+
+	const size_t n = 1000000 * mult;
+	const size_t Edits = 1000;
+
+	TableFunction tf;
+	tf.CreateNewFunction(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		double x = i * 0.01 + 0.003 * sin(i * 1.7);
+		tf.SetPoint(i, x, sin(x));
+	}
+
+	TableFunction rebuilt = tf;
+	rebuilt.BuildSpline();
+	double s1 = 0;
+	double t = Measure([&]()
+		{
+			for (size_t k = 0; k < 20; ++k)
+			{
+				rebuilt.SetValAtPoint((k * 7919) % n, cos(k));
+				rebuilt.BuildSpline();
+				rebuilt.CalcStat();
+				s1 += rebuilt.Spline(k * 7.0) + rebuilt.GetMaxY();
+			}
+		});
+	PrintResult("BuildSpline + CalcStat (20 edits)", t, 20.0 * 1e6, "edits/s");
+
+	tf.SplineVal(0.0);
+	double s2 = 0;
+	t = Measure([&]()
+		{
+			for (size_t k = 0; k < Edits; ++k)
+			{
+				tf.SetValAtPoint((k * 7919) % n, cos(k));
+				s2 += tf.SplineVal(k * 7.0) + tf.GetMaxY();
+			}
+		});
+	PrintResult("lazy local update", t, Edits * 1e6, "edits/s");
+
+	if (fabs(tf.SplineVal(7.0) - rebuilt.Spline(7.0)) > 1e-12)
+		cout << "  !!! results differ" << endl;
+
+	// the spline alone, without the statistics
+	static const char* TypeNames[] = {"natural", "Akima", "PCHIP"};
+	for (SplineType type : {SplineType::Natural, SplineType::Akima, SplineType::Pchip})
+	{
+		TableFunction local = tf;
+		local.SetSplineType(type);
+		local.SetValAtPoint(0, local.GetY(0));   // the points are shared with tf until the first change
+		local.SplineVal(0.0);
+
+		double s3 = 0;
+		t = Measure([&]()
+			{
+				for (size_t k = 0; k < 10 * Edits; ++k)
+				{
+					local.SetValAtPoint((k * 7919) % n, sin(k));
+					s3 += local.SplineVal(k * 0.07);
+				}
+			});
+		PrintResult(string("lazy local update, spline only, ") + TypeNames[(int)type], t, 10 * Edits * 1e6, "edits/s");
+
+		TableFunction check = local;
+		check.BuildSpline();
+		if (fabs(check.Spline(7.0) - local.SplineVal(7.0)) > 1e-12)
+			cout << "  !!! results differ" << endl;
+	}
+}
+//---------------------------------------------------------------------------
+
+// Four gaussians, 12 parameters
+double GaussiansModel(double x, const vector<double>& p)
+{
+	double y = 0;
+	for (size_t k = 0; k + 2 < p.size(); k += 3)
+		y += p[k] * exp(-(x - p[k+1]) * (x - p[k+1]) / (2.0 * p[k+2] * p[k+2]));
+	return y;
+}
+//---------------------------------------------------------------------------
+
+// The same over a block of x: the parameters are read once, and the loops over the points have no calls but exp
+void GaussiansBatchModel(const double* xs, double* ys, size_t n, const vector<double>& p)
+{
+	fill(ys, ys + n, 0.0);
+	for (size_t k = 0; k + 2 < p.size(); k += 3)
+	{
+		double a = p[k], c = p[k+1], s = -1.0 / (2.0 * p[k+2] * p[k+2]);
+		for (size_t i = 0; i < n; ++i)
+			ys[i] += a * exp((xs[i] - c) * (xs[i] - c) * s);
+	}
+}
+//---------------------------------------------------------------------------
+
+// The same written for any number type, so it also gives the derivatives with the dual numbers
+template <typename P>
+auto GaussiansGenericModel(double x, const P& p)
+{
+	typename P::value_type y = 0;
+	for (size_t k = 0; k + 2 < p.size(); k += 3)
+		y += p[k] * exp(-(x - p[k+1]) * (x - p[k+1]) / (2.0 * p[k+2] * p[k+2]));
+	return y;
+}
+//---------------------------------------------------------------------------
+
+void BenchGradDescent(size_t mult)
+{
+	cout << "GradDescent, 12 parameters, 5 iterations" << endl;
+
+	const size_t n = 100000 * mult;
+	const vector<double> truth = {3, -5, 1, 2, -1, 0.5, 4, 2, 2, 1, 6, 0.7};
+
+	TableFunction src;
+	src.CreateDemoFunction(n, -10.0, 20.0 / n, [&truth](double x) { return GaussiansModel(x, truth); });
+
+	const size_t iters = 5;
+	auto setup = [&](GradDescent& gd, size_t threads)
+		{
+			gd.SetSrcFunction(src);
+			gd.SetGradThreadsCount(threads);
+			gd.SetMaxIters(iters - 1);
+			gd.SetMaxTime(1000);
+
+			vector<double> p0 = {2.5, -4.5, 1.2, 2.2, -0.8, 0.6, 3.5, 2.2, 1.8, 1.2, 5.5, 0.8};
+			gd.SetParams(p0);
+			gd.SetMinConstrains(vector<double>(12, -100));
+			gd.SetMaxConstrains(vector<double>(12, 100));
+			gd.SetRelConstrains(vector<double>(12, 0));
+			gd.SetTypeConstrains(vector<bool>(12, false));
+		};
+
+	for (size_t threads : {size_t(1), size_t(0)})
+	{
+		GradDescent gd;
+		setup(gd, threads);
+		gd.SetDstFunction(GaussiansModel);
+
+		double t = Measure([&]() { gd.Go(); });
+		PrintResult(threads ? "finite differences, 1 thread" : "finite differences, all threads", t / iters, 1e6, "iters/s");
+	}
+
+	// one pass for the cost and the whole gradient instead of 4 passes per parameter
+	for (size_t threads : {size_t(1), size_t(0)})
+	{
+		GradDescent gd;
+		setup(gd, threads);
+		gd.SetDualModel<12>([](double x, const auto& p) { return GaussiansGenericModel(x, p); });
+
+		double t = Measure([&]() { gd.Go(); });
+		PrintResult(threads ? "dual numbers, 1 thread" : "dual numbers, all threads", t / iters, 1e6, "iters/s");
+	}
+
+	// the model inlined into the cost loop, and the parameters of a fixed count
+	auto model = [](double x, const auto& p) { return GaussiansGenericModel(x, p); };
+	for (size_t threads : {size_t(1), size_t(0)})
+	{
+		auto gd = MakeStaticGradDescent<12>(model);
+		gd.SetSrcFunction(src);
+		gd.SetGradThreadsCount(threads);
+		gd.SetMaxIters(iters - 1);
+		gd.SetMaxTime(1000);
+		gd.SetParams({2.5, -4.5, 1.2, 2.2, -0.8, 0.6, 3.5, 2.2, 1.8, 1.2, 5.5, 0.8});
+		array<double, 12> lo, hi;
+		lo.fill(-100);
+		hi.fill(100);
+		gd.SetMinConstrains(lo);
+		gd.SetMaxConstrains(hi);
+		gd.SetRelConstrains(array<double, 12>{});
+		gd.SetTypeConstrains(array<bool, 12>{});
+
+		double t = Measure([&]() { gd.Go(); });
+		PrintResult(threads ? "static model, 1 thread" : "static model, all threads", t / iters, 1e6, "iters/s");
+	}
+
+	// the cost alone: a plain loop over the points as it used to be, and the blocked pairwise sum
+	const size_t reps = 10;
+	vector<double> probe = truth;
+	probe[0] = 2.5;
+	double c1 = 0, c2 = 0;
+	double t = Measure([&]()
+		{
+			for (size_t r = 0; r < reps; ++r)
+				for (size_t i = 0; i < src.Size(); ++i)
+				{
+					double d = src.GetY(i) - GaussiansModel(src.GetX(i), probe);
+					c1 += d * d;
+				}
+		});
+	PrintResult("cost, plain loop", t, (double)(reps * n));
+
+	for (size_t threads : {size_t(1), size_t(0)})
+	{
+		GradDescent gd;
+		gd.SetSrcFunction(src);
+		gd.SetDstFunction(GaussiansModel);
+		gd.SetGradThreadsCount(threads);
+		gd.CalcCostAt(probe);   // starts the pool
+
+		t = Measure([&]()
+			{
+				for (size_t r = 0; r < reps; ++r)
+					c2 += gd.CalcCostAt(probe);
+			});
+		PrintResult(threads ? "cost, CalcCostAt, 1 thread" : "cost, CalcCostAt, all threads", t, (double)(reps * n));
+	}
+
+	GradDescent gd;
+	gd.SetSrcFunction(src);
+	gd.SetBatchDstFunction(GaussiansBatchModel);
+	double c3 = 0;
+	t = Measure([&]()
+		{
+			for (size_t r = 0; r < reps; ++r)
+				c3 += gd.CalcCostAt(probe);
+		});
+	PrintResult("cost, batch model, 1 thread", t, (double)(reps * n));
+
+	auto fixed = MakeStaticGradDescent<12>(model);
+	fixed.SetSrcFunction(src);
+	array<double, 12> probe12;
+	copy(probe.begin(), probe.end(), probe12.begin());
+	double c4 = 0;
+	t = Measure([&]()
+		{
+			for (size_t r = 0; r < reps; ++r)
+				c4 += fixed.CalcCostAt(probe12);
+		});
+	PrintResult("cost, static model, 1 thread", t, (double)(reps * n));
+
+	if (fabs(c1 - c4) > 1e-9 * (1 + c1))
+		cout << "  !!! results differ" << endl;
+
+	if (fabs(c1 - c3) > 1e-9 * (1 + c1))
+		cout << "  !!! results differ" << endl;
+
+	if (fabs(c1 - c2 / 2) > 1e-9 * (1 + c1))
+		cout << "  !!! results differ" << endl;
+}
+//---------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+	size_t mult = 1;
+	if (argc > 1)
+		mult = max(1, atoi(argv[1]));
+
+	BenchBatchEvaluation(mult);
+	BenchCursor(mult);
+	BenchCalculus(mult);
+	BenchRangeMinMax(mult);
+	BenchInverse(mult);
+	BenchAdaptive(mult);
+	BenchResample(mult);
+	BenchSearchIndex(mult);
+	BenchLoad(mult);
+	BenchAppend(mult);
+	BenchPreprocessing(mult);
+	BenchSplineBuild(mult);
+	BenchLazyUpdate(mult);
+	BenchGradDescent(mult);
+
+	return 0;
+}
+//---------------------------------------------------------------------------
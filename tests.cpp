@@ -8,16 +8,25 @@
 #include "UnitSpline.h"
 #include "UnitTableFunctions.h"
 #include "UnitGradDescent.h"
+#include "UnitTableFile.h"
+#include "UnitSimd.h"
 
 #include <boost/test/unit_test.hpp>
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
+#include <cstdio>
 #include <cmath>
+#include <limits>
 #include <tuple>
 
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
-//#include <fstream>
 
 using namespace std;
 using namespace tf_gd_lib;
@@ -99,6 +108,497 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tabulated_function_test)
 }
 //---------------------------------------------------------------------------
 
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_batch_evaluation_test)
+{
+	TableFunction tf;
+	tf.CreateDemoFunction(1001, -1, 0.002);
+
+	const size_t m = 200000;
+	vector<double> xs(m);
+	for (size_t k = 0; k < m; ++k)                 // a few ascending runs with extrapolation at both ends
+		xs[k] = -1.2 + 2.4 * ((k * 7) % m) / m;
+	xs[m/2] = 0.5;                                 // an exact point inside a run
+
+	for (size_t threads : {1, 4})
+	{
+		tf.SetThreadsCount(threads);
+		vector<double> ys = tf.GetValsByX(xs);
+
+		bool ok = true;
+		for (size_t k = 0; k < m; ++k)
+			ok = ok && CmpFunc(ys[k], tf(xs[k]), 1e-12);
+		BOOST_CHECK(ok);
+	}
+
+	TableFunction empty;
+	BOOST_CHECK( empty.GetValsByX(vector<double>{1.0, 2.0}) == vector<double>({0.0, 0.0}) );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_data_layout_test)
+{
+	TableFunction tf;
+	tf.CreateNewFunction(4);
+	tf.SetPoint(0, 3, 30);
+	tf.SetPoint(1, 1, 10);
+	tf.SetPointByNumber(2, make_tuple(2, 20));
+	get<0>(tf[3]) = 0;   // write through operator[]
+	get<1>(tf[3]) = 0;
+
+	tf.Sort();           // x and y have to stay paired
+	tf.CalcStat();
+
+	const double *xs = tf.GetDataX();
+	const double *ys = tf.GetDataY();
+	for (size_t i = 0; i < tf.Size(); ++i)
+	{
+		BOOST_CHECK( xs[i] == i && tf.GetX(i) == i );
+		BOOST_CHECK( ys[i] == 10.0*i && tf.GetY(i) == 10.0*i );
+	}
+
+	BOOST_CHECK( tf.Get_i_ForMaxY() == 3 && tf.GetMaxY() == 30 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_search_index_test)
+{
+	const size_t n = 3000;
+	vector<double> uniform(n), jittered(n), clustered(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		uniform[i] = -1.0 + 0.001 * i;
+		jittered[i] = i + 0.3 * sin(i * 1.7);
+		clustered[i] = pow(1.01, i % 1000) + 1e5 * (i / 1000);
+	}
+	jittered[10] = jittered[11];  // a duplicate
+
+	vector<double> queries;
+	for (int k = -100; k < 4100; ++k)
+		queries.push_back(k * 0.77);
+	for (auto &v : {uniform, jittered, clustered})
+		for (size_t i = 0; i < n; i += 7)
+			queries.insert(queries.end(), {v[i], nextafter(v[i], -1e300), nextafter(v[i], 1e300)});
+
+	for (auto *v : {&uniform, &jittered, &clustered})
+		for (auto type : {SearchIndexType::Uniform, SearchIndexType::Buckets,
+						  SearchIndexType::Eytzinger, SearchIndexType::Auto})
+		{
+			SearchIndex idx;
+			bool built = idx.Build(v->data(), n, type);
+
+			if (type == SearchIndexType::Uniform)
+				BOOST_CHECK( built == (v == &uniform) );
+			if (!built)
+				continue;
+
+			bool ok = true;
+			for (double x : queries)
+				ok = ok && idx.LowerBound(v->data(), n, x) == size_t(lower_bound(v->begin(), v->end(), x) - v->begin());
+			BOOST_CHECK(ok);
+		}
+
+	bool small_ok = true;         // every shape of a small Eytzinger tree
+	for (size_t k = 2; k < 70; ++k)
+	{
+		SearchIndex idx;
+		idx.Build(clustered.data(), k, SearchIndexType::Eytzinger);
+		for (size_t i = 0; i <= k; ++i)
+		{
+			double x = i < k ? clustered[i] : clustered[k-1] + 1;
+			small_ok = small_ok && idx.LowerBound(clustered.data(), k, x) == i;
+		}
+	}
+	BOOST_CHECK(small_ok);
+
+	TableFunction tf;
+	tf.CreateDemoFunction(501, -1, 0.004);
+	BOOST_CHECK( tf.BuildSpline() );
+
+	double l1 = tf(0.3333), s1 = tf.Spline(0.3333);
+	BOOST_CHECK( tf.BuildSearchIndex() );
+	BOOST_CHECK( tf.GetSearchIndexType() == SearchIndexType::Uniform );
+	BOOST_CHECK( tf.Spline.GetSearchIndexType() == SearchIndexType::Uniform );
+	BOOST_CHECK( tf(0.3333) == l1 && tf.Spline(0.3333) == s1 );
+
+	tf.SetPoint(0, -1.5, 0);   // changing x drops the index
+	BOOST_CHECK( tf.GetSearchIndexType() == SearchIndexType::None );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_cursors_test)
+{
+	TableFunction table;
+	table.CreateDemoFunction(2001, -1, 0.001);
+	const TableFunction &tf = table;   // shared read-only by all threads
+
+	const size_t threads_count = 4;
+	vector<int> ok(threads_count, 0);
+	vector<thread> threads;
+
+	for (size_t t = 0; t < threads_count; ++t)
+		threads.emplace_back([&tf, &ok, t]()
+			{
+				bool res = true;
+				TableFunction::Cursor right = tf.GetCursor();
+				for (double x = -0.9995 + t*0.0001; x < 0.999; x += 0.00037)
+					res = res && CmpFunc(right.GetValFromRightX(x), tf(x), 1e-12);
+
+				TableFunction::Cursor left = tf.GetCursor(tf.Size() - 1);
+				for (double x = 0.9995 - t*0.0001; x > -0.999; x -= 0.00041)
+					res = res && CmpFunc(left.GetValFromLeftX(x), tf(x), 1e-12);
+
+				ok[t] = res;
+			});
+
+	for (auto &th : threads)
+		th.join();
+
+	for (int r : ok)
+		BOOST_CHECK(r);
+
+	// the table's own cursor
+	BOOST_CHECK( CmpFunc(table.GetValFromRightX(0.1234), tf(0.1234), 1e-12) );
+	BOOST_CHECK( CmpFunc(table.GetValFromRightX(0.5678), tf(0.5678), 1e-12) );
+	BOOST_CHECK( CmpFunc(table.GetValFromLeftX(0.2345), tf(0.2345), 1e-12) );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_gallop_cursor_test)
+{
+	TableFunction tf;
+	tf.CreateDemoFunction(10001, -1, 0.0002);
+
+	// the same as lower_bound from any hint
+	const double *X = tf.GetDataX();
+	bool ok = true;
+	for (size_t k = 0; k < 2000; ++k)
+	{
+		double x = -1.1 + (k * 0.6180339887 - floor(k * 0.6180339887)) * 2.2;
+		size_t hint = (k * 7919) % (tf.Size() + 1);
+		ok = ok && GallopLowerBound(X, tf.Size(), hint, x) == size_t(lower_bound(X, X + tf.Size(), x) - X);
+	}
+	BOOST_CHECK(ok);
+
+	// big strides both ways and beyond the table: exactly the same as the random access
+	TableFunction::Cursor c = tf.GetCursor(5000);
+	ok = true;
+	for (double x = -1.5; x < 1.5; x += 0.0137)
+		ok = ok && c.GetValFromRightX(x) == tf(x);
+	for (double x = 1.5; x > -1.5; x -= 0.2113)
+		ok = ok && c.GetValFromLeftX(x) == tf(x);
+	for (size_t k = 0; k < 1000; ++k)
+	{
+		double x = sin(k * 1.3) * 1.2;
+		ok = ok && c.GetValFromRightX(x) == tf(x) && c.GetValFromLeftX(-x) == tf(-x);
+	}
+	BOOST_CHECK(ok);
+
+	// the left one extrapolates to the right too, and the right one to the left
+	BOOST_CHECK( c.GetValFromLeftX(1.3) == tf(1.3) && c.GetIndex() == tf.Size() - 2 );
+	BOOST_CHECK( c.GetValFromRightX(-1.3) == tf(-1.3) && c.GetIndex() == 0 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_spline_cursor_test)
+{
+	TableFunction tf;
+	tf.CreateDemoFunction(5001, -1, 0.0004);
+	const CubicSpline &sp = tf.GetSpline();
+
+	// the cursor both ways, with steps of any size and beyond the knots
+	CubicSpline::Cursor c = sp.GetCursor();
+	bool ok = true;
+	for (double x = -1.2; x < 1.2; x += 0.00031)
+		ok = ok && c(x) == sp(x);
+	for (double x = 1.2; x > -1.2; x -= 0.0917)
+		ok = ok && c(x) == sp(x);
+	for (size_t k = 0; k < 5001; k += 7)
+		ok = ok && c(tf.GetX(k)) == sp(tf.GetX(k));   // at the knots
+	BOOST_CHECK(ok);
+
+	// batches: sorted (merged with the knots), random, and mixed; several threads
+	const size_t m = 100000;
+	vector<double> xs(m), ys(m);
+	for (size_t mode = 0; mode < 3; ++mode)
+	{
+		for (size_t k = 0; k < m; ++k)
+		{
+			double sorted = -1.1 + 2.2 * k / m;
+			double random = sin(k * 12.9898) * 1.1;
+			xs[k] = mode == 0 ? sorted : (mode == 1 ? random : (k / 100 % 2 ? sorted : random));
+		}
+
+		tf.SetThreadsCount(mode + 1);
+		tf.GetSplineValsByX(xs.data(), ys.data(), m);
+
+		ok = true;
+		for (size_t k = 0; k < m; ++k)
+			ok = ok && ys[k] == sp(xs[k]);
+		BOOST_CHECK(ok);
+	}
+
+	// with a search index the result is the same
+	tf.BuildSearchIndex();
+	tf.GetSplineValsByX(xs.data(), ys.data(), m);
+	ok = true;
+	for (size_t k = 0; k < m; ++k)
+		ok = ok && ys[k] == sp(xs[k]);
+	BOOST_CHECK(ok);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_spline_simd_test)
+{
+	// irregular knots, so that there is no uniform index to shortcut the search
+	vector<double> kx(3001), ky(3001);
+	for (size_t k = 0; k < 3001; ++k)
+	{
+		double x = -1.0 + 2.0 * k / 3000;
+		kx[k] = x + x * x * x * 0.1;
+		ky[k] = sin(5 * x);
+	}
+	TableFunction tf;
+	tf.AppendPoints(kx, ky);
+	const CubicSpline &sp = tf.GetSpline();
+
+	// random x, beyond the knots, at the knots, a NaN, and a count that isn't a multiple of the lanes
+	const size_t m = 10007;
+	vector<double> xs(m), ys(m);
+	for (size_t k = 0; k < m; ++k)
+		xs[k] = k % 97 == 0 ? tf.GetX(k % 3001) : sin(k * 12.9898) * 1.3;
+	xs[5] = numeric_limits<double>::quiet_NaN();
+
+	SimdLevel max = GetMaxSimdLevel();
+	for (int level = (int)SimdLevel::Scalar; level <= (int)max; ++level)
+	{
+		BOOST_CHECK( SetSimdLevel((SimdLevel)level) );
+		BOOST_CHECK( GetSimdLevel() == (SimdLevel)level );
+
+		fill(ys.begin(), ys.end(), 0.0);
+		sp.GetValsByX(xs.data(), ys.data(), m);
+
+		bool ok = true;
+		for (size_t k = 0; k < m; ++k)
+			ok = ok && (ys[k] == sp(xs[k]) || (std::isnan(ys[k]) && std::isnan(sp(xs[k]))));
+		BOOST_CHECK(ok);
+	}
+
+	BOOST_CHECK( max == SimdLevel::AVX512 || !SetSimdLevel(SimdLevel::AVX512) );
+	BOOST_CHECK( SetSimdLevel(max) );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_spline_parallel_build_test)
+{
+	const size_t n = 200003;
+	vector<double> x(n), y(n);
+	for (size_t k = 0; k < n; ++k)
+	{
+		double t = -1.0 + 2.0 * k / (n - 1);
+		x[k] = t + t * t * t * 0.3;
+		y[k] = sin(40 * t) + 0.01 * sin(k * 12.9898);
+	}
+
+	CubicSpline serial;
+	BOOST_CHECK( serial.BuildSpline(x.data(), y.data(), n) );
+
+	// the partitioned solver gives the same coefficients within rounding for any count of chunks
+	for (size_t threads : {2, 3, 4, 6})
+	{
+		CubicSpline sp;
+		BOOST_CHECK( sp.BuildSpline(x.data(), y.data(), n, threads) );
+
+		double err = 0, scale = 0;
+		for (size_t k = 0; k < n; ++k)
+		{
+			err = max(err, fabs(sp.GetDataC()[k] - serial.GetDataC()[k]));
+			err = max(err, fabs(sp.GetDataB()[k] - serial.GetDataB()[k]));
+			scale = max(scale, fabs(serial.GetDataC()[k]));
+		}
+		BOOST_CHECK( err <= 1e-12 * scale );
+		BOOST_CHECK( sp.GetDataD()[n-1] == sp.GetDataD()[n-1] );   // not NaN
+	}
+
+	// a rebuild reuses the memory, unless a copy shares it
+	CubicSpline sp;
+	sp.BuildSpline(x.data(), y.data(), n, 4);
+	const double *c = sp.GetDataC();
+	sp.BuildSpline(x.data(), y.data(), n, 4);
+	BOOST_CHECK( sp.GetDataC() == c );
+
+	CubicSpline copy = sp;
+	y[n / 2] += 1.0;
+	sp.BuildSpline(x.data(), y.data(), n, 4);
+	BOOST_CHECK( sp.GetDataC() != c && copy.GetDataC() == c );
+	BOOST_CHECK( copy(x[n / 2]) != sp(x[n / 2]) );
+
+	// small systems with up to more chunks than unknowns, where a chunk would get one row or none
+	bool same = true;
+	for (size_t m = 3; m <= 40; ++m)
+	{
+		vector<double> xs(m), ys(m), b0(m), c0(m), d0(m), b1(m), c1(m), d1(m);
+		for (size_t k = 0; k < m; ++k)
+		{
+			xs[k] = k + 0.4 * sin(k * 7.31);
+			ys[k] = cos(k * 1.7);
+		}
+		BOOST_CHECK( NaturalSplineCoefs(xs.data(), ys.data(), m, b0.data(), c0.data(), d0.data(), 1) );
+		for (size_t chunks = 2; chunks <= m + 2; ++chunks)
+		{
+			NaturalSplineCoefs(xs.data(), ys.data(), m, b1.data(), c1.data(), d1.data(), chunks);
+			for (size_t k = 0; k < m; ++k)
+				same = same && fabs(b1[k] - b0[k]) < 1e-12 && fabs(c1[k] - c0[k]) < 1e-12 && fabs(d1[k] - d0[k]) < 1e-12;
+		}
+	}
+	BOOST_CHECK( same );
+	BOOST_CHECK( !NaturalSplineCoefs(x.data(), y.data(), 2, &y[0], &y[0], &y[0], 2) );
+
+	// the table builds with its own threads count
+	TableFunction tf;
+	tf.AppendPoints(x, y);
+	tf.SetThreadsCount(3);
+	BOOST_CHECK( tf.BuildSpline() );
+	BOOST_CHECK( fabs(tf.SplineVal(0.123) - sp(0.123)) < 1e-12 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_local_spline_test)
+{
+	// monotone data with a step: PCHIP goes through the points, stays monotone and doesn't overshoot
+	vector<double> x = {0, 1, 2, 3, 4, 5, 6, 7}, y = {0, 0.1, 0.2, 0.3, 5, 5.1, 5.2, 5.3};
+	CubicSpline pchip;
+	pchip.SetType(SplineType::Pchip);
+	BOOST_CHECK( pchip.BuildSpline(x.data(), y.data(), x.size()) );
+
+	bool ok = true;
+	double prev = pchip(0.0);
+	for (double t = 0.0; t <= 7.0; t += 0.01)
+	{
+		double v = pchip(t);
+		ok = ok && v >= prev - 1e-12 && v >= -1e-12 && v <= 5.3 + 1e-12;
+		prev = v;
+	}
+	for (size_t k = 0; k < x.size(); ++k)
+		ok = ok && CmpFunc(pchip(x[k]), y[k], 1e-12);
+	BOOST_CHECK(ok);
+
+	// Akima reproduces a straight line, and both are close to a smooth function
+	CubicSpline akima;
+	akima.SetType(SplineType::Akima);
+	vector<double> line = {1, 3, 5, 7, 9, 11, 13, 15};
+	BOOST_CHECK( akima.BuildSpline(x.data(), line.data(), x.size()) );
+	BOOST_CHECK( CmpFunc(akima(2.345), 5.69, 1e-12) && CmpFunc(akima(6.5), 14.0, 1e-12) );
+
+	for (SplineType type : {SplineType::Akima, SplineType::Pchip})
+	{
+		TableFunction tf;
+		tf.CreateDemoFunction(2001, -1, 0.001);
+		tf.SetSplineType(type);
+		BOOST_CHECK( tf.GetSplineType() == type );
+
+		double err = 0;
+		for (double t = -0.99; t < 0.99; t += 0.00123)
+			err = max(err, fabs(tf.SplineVal(t) - TableFunction::TestFunc(t)));
+		BOOST_CHECK( err < 1e-4 );
+	}
+
+	// a change of a point recalculates a few segments, exactly as a full build would;
+	// the build by chunks gives exactly the same coefficients
+	const size_t n = 100001;
+	TableFunction tf;
+	tf.CreateNewFunction(n);
+	for (size_t i = 0; i < n; ++i)
+		tf.SetPoint(i, i * 0.01 + 0.003 * sin(i * 1.7), sin(i * 0.05));
+	tf.SetSplineType(SplineType::Akima);
+	tf.SetThreadsCount(1);
+	tf.GetSpline();
+
+	const double *c = tf.GetSpline().GetDataC();
+	double far_c = c[100];
+	tf.SetValAtPoint(n / 2, 3.0);
+	tf.SetValAtPoint(n - 1, -1.0);
+	tf.SetValAtPoint(1, 2.0);
+	const CubicSpline &updated = tf.GetSpline();
+	BOOST_CHECK( updated.GetDataC()[100] == far_c );
+
+	TableFunction rebuilt = tf;
+	rebuilt.SetThreadsCount(4);
+	BOOST_CHECK( rebuilt.BuildSpline() );
+	BOOST_CHECK( rebuilt.GetSpline().GetDataC() != updated.GetDataC() );
+	BOOST_CHECK( equal(updated.GetDataB(), updated.GetDataB() + n, rebuilt.GetSpline().GetDataB()) );
+	BOOST_CHECK( equal(updated.GetDataC(), updated.GetDataC() + n, rebuilt.GetSpline().GetDataC()) );
+	BOOST_CHECK( equal(updated.GetDataD(), updated.GetDataD() + n, rebuilt.GetSpline().GetDataD()) );
+
+	// the type is kept in a binary file
+	const string FileName = "tf_gd_lib_test_local_spline.bin";
+	BOOST_CHECK( tf.SaveToBinaryFile(FileName) );
+	TableFunction loaded;
+	BOOST_CHECK( loaded.LoadFromBinaryFile(FileName) );
+	BOOST_CHECK( loaded.GetSplineType() == SplineType::Akima );
+	loaded.SetValAtPoint(7, 1.0);
+	tf.SetValAtPoint(7, 1.0);
+	BOOST_CHECK( loaded.SplineVal(0.071) == tf.SplineVal(0.071) );
+	remove(FileName.c_str());
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_derivative_integral_test)
+{
+	const double pi = 3.14159265358979323846;
+	const size_t n = 2001;
+
+	TableFunction tf;
+	tf.CreateDemoFunction(n, -pi, 2 * pi / (n - 1), [](double x) { return sin(x); });
+
+	// derivatives from the coefficients; the batch gives the same values
+	bool ok = true;
+	vector<double> xs, d1(1), d2(1);
+	for (double x = -3.0; x < 3.0; x += 0.0137)
+	{
+		ok = ok && fabs(tf.SplineDerivative(x) - cos(x)) < 1e-5 && fabs(tf.SplineDerivative(x, 2) + sin(x)) < 1e-3;
+		xs.push_back(x);
+	}
+	BOOST_CHECK(ok);
+	BOOST_CHECK( tf.SplineDerivative(0.5, 0) == tf.SplineVal(0.5) && tf.SplineDerivative(0.5, 4) == 0.0 );
+
+	d1.resize(xs.size());
+	d2.resize(xs.size());
+	tf.GetSplineDerivativesByX(xs.data(), d1.data(), xs.size());
+	tf.GetSplineDerivativesByX(xs.data(), d2.data(), xs.size(), 2);
+	ok = true;
+	for (size_t k = 0; k < xs.size(); ++k)
+		ok = ok && d1[k] == tf.SplineDerivative(xs[k]) && d2[k] == tf.SplineDerivative(xs[k], 2);
+	BOOST_CHECK(ok);
+
+	// integrals of both interpolations; reversed limits give the negative
+	BOOST_CHECK( CmpFunc(tf.SplineIntegral(0, pi / 2), 1.0, 1e-10) );
+	BOOST_CHECK( CmpFunc(tf.SplineIntegral(-pi, pi), 0.0, 1e-10) );
+	BOOST_CHECK( CmpFunc(tf.Integral(0, pi / 2), 1.0, 1e-5) );
+	BOOST_CHECK( CmpFunc(tf.Integral(0.3, 1.7) + tf.Integral(1.7, 2.2), tf.Integral(0.3, 2.2), 1e-12) );
+	BOOST_CHECK( tf.SplineIntegral(1.1, 0.2) == -tf.SplineIntegral(0.2, 1.1) );
+
+	// a change of the points is taken into account; the search index gives the same result
+	double before = tf.Integral(-1, 1);
+	tf.SetValAtPoint(n / 2, 1.0);
+	double h = 2 * pi / (n - 1);
+	BOOST_CHECK( CmpFunc(tf.Integral(-1, 1) - before, h, 1e-12) );   // a triangle of the height 1 and the base 2h
+	BOOST_CHECK( tf.SplineIntegral(-1, 1) - before > 0.9 * h );
+
+	double line = tf.Integral(-0.77, 2.5), spline = tf.SplineIntegral(-0.77, 2.5);
+	BOOST_CHECK( tf.BuildSearchIndex(SearchIndexType::Uniform) );
+	BOOST_CHECK( CmpFunc(tf.Integral(-0.77, 2.5), line, 1e-14) && CmpFunc(tf.SplineIntegral(-0.77, 2.5), spline, 1e-14) );
+
+	// the linear extrapolation: y = x over [0, 1], integrated up to 2
+	TableFunction lin;
+	lin.AppendPoints(vector<double>{0, 0.5, 1}, vector<double>{0, 0.5, 1});
+	BOOST_CHECK( CmpFunc(lin.Integral(0, 1), 0.5, 1e-15) && CmpFunc(lin.Integral(-1, 2), 1.5, 1e-15) );
+	BOOST_CHECK( CmpFunc(lin.SplineIntegral(0, 2), 2.0, 1e-14) );
+
+	TableFunction empty;
+	BOOST_CHECK( empty.Integral(0, 1) == 0.0 && std::isnan(empty.SplineIntegral(0, 1)) );
+}
+//---------------------------------------------------------------------------
+
 BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_load_and_spline_test)
 {
 	TableFunction tf;
@@ -117,6 +617,103 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_load_and_spline_test)
 	BOOST_CHECK( tf.Spline(0.5) == tf(0.5) );   // at existing point
 }
 //---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_load_text_test)
+{
+	TableFunction tf;
+	LoadInfo info;
+
+	string text = "0 1\n"
+				  "\n"                  // blank lines are skipped silently
+				  "  2\t5 \r\n"
+				  "abc def\n"           // malformed
+				  "1 +3e0\n"            // not sorted
+				  "4\n"                 // malformed: no y
+				  "3 7";                // no end of line
+	istringstream ss(text);
+	tf.LoadFromStream(ss, &info);
+
+	BOOST_CHECK( info.LinesCount == 7 );
+	BOOST_CHECK( info.PointsCount == 4 && tf.Size() == 4 );
+	BOOST_CHECK( info.MalformedLines == vector<size_t>({4, 6}) );
+	BOOST_CHECK( !info.WasSorted );
+	for (size_t i = 0; i < tf.Size(); ++i)
+		BOOST_CHECK( tf.GetX(i) == i );
+	BOOST_CHECK( tf.GetY(1) == 3 && tf.GetMaxY() == 7 );
+
+	// a big sorted text parsed by several threads
+	const size_t n = 300000;
+	string big;
+	for (size_t i = 0; i < n; ++i)
+	{
+		big += to_string(i * 0.5) + " " + to_string(i % 7) + "\n";
+		if (i == 123456)
+			big += "oops\n";
+	}
+
+	tf.SetThreadsCount(4);
+	tf.LoadFromText(big.data(), big.size(), &info);
+
+	BOOST_CHECK( info.WasSorted );
+	BOOST_CHECK( info.LinesCount == n + 1 && tf.Size() == n );
+	BOOST_CHECK( info.MalformedLines == vector<size_t>({123458}) );
+
+	bool ok = true;
+	for (size_t i = 0; i < n; ++i)
+		ok = ok && tf.GetX(i) == i * 0.5 && tf.GetY(i) == i % 7;
+	BOOST_CHECK(ok);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_binary_file_test)
+{
+	const string FileName = "tf_gd_lib_test_table.bin";
+
+	TableFunction tf;
+	tf.CreateDemoFunction(1001, -1, 0.002, TableFunction::TestFunc, "BinaryDemo");
+	BOOST_CHECK( tf.BuildSpline() );
+	BOOST_CHECK( tf.SaveToBinaryFile(FileName) );
+
+	TableFunctionView view;
+	BOOST_CHECK( view.Open(FileName) );
+	BOOST_CHECK( view.Size() == tf.Size() && view.GetName() == "BinaryDemo" );
+	BOOST_CHECK( view.GetMaxY() == tf.GetMaxY() && view.Get_i_ForMinY() == tf.Get_i_ForMinY() );
+	BOOST_CHECK( view.IsSplineExists() );
+	BOOST_CHECK( view.BuildSearchIndex() );
+
+	bool ok = true;
+	for (double x = -1.1; x < 1.1; x += 0.0123)
+		ok = ok && view(x) == tf(x) && view.SplineVal(x) == tf.Spline(x);
+	BOOST_CHECK(ok);
+
+	TableFunction copy;
+	BOOST_CHECK( copy.LoadFromBinaryFile(FileName) );
+	BOOST_CHECK( copy.Size() == tf.Size() && copy.GetName() == "BinaryDemo" );
+	BOOST_CHECK( copy.GetMinY() == tf.GetMinY() && copy.Get_x_ForMaxY() == tf.Get_x_ForMaxY() );
+	BOOST_CHECK( copy(0.1234) == tf(0.1234) && copy.Spline(0.1234) == tf.Spline(0.1234) );
+
+	view.Close();
+
+	// an index of the min or max out of the table - the file is rejected
+	for (size_t k = 0; k < 2; ++k)
+	{
+		BOOST_CHECK( tf.SaveToBinaryFile(FileName) );
+		uint64_t bad = tf.Size();
+		fstream f(FileName, ios::in | ios::out | ios::binary);
+		f.seekp(k ? offsetof(TableFileHeader, i_ForMaxY) : offsetof(TableFileHeader, i_ForMinY));
+		f.write(reinterpret_cast<const char*>(&bad), sizeof(bad));
+		f.close();
+		BOOST_CHECK( !view.Open(FileName) && !copy.LoadFromBinaryFile(FileName) );
+	}
+
+	tf.SetPoint(0, 5, 0);                        // not sorted - can't be saved
+	BOOST_CHECK( !tf.SaveToBinaryFile(FileName) );
+
+	BOOST_CHECK( !view.Open("test_data.txt") );  // not a binary table file
+
+	remove(FileName.c_str());
+}
+//---------------------------------------------------------------------------
 //---------------------------------------------------------------------------
 
 
@@ -142,6 +739,649 @@ double user_target_function(const std::vector<double>& p)
 //    /              \
 //   *(0,0)           *
 
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_append_test)
+{
+	// the reference is the whole table sorted and recalculated from scratch;
+	// equal x always have equal y, so it doesn't matter which duplicate is kept
+	auto y_of = [](double x) { return floor(sin(x) * 20.0); };   // a lot of equal y for the ties
+
+	auto same = [](const TableFunction &a, const TableFunction &b)
+		{
+			bool ok = a.Size() == b.Size();
+			for (size_t i = 0; ok && i < a.Size(); ++i)
+				ok = a.GetX(i) == b.GetX(i) && a.GetY(i) == b.GetY(i);
+			return ok && a.GetMinX() == b.GetMinX() && a.GetMaxX() == b.GetMaxX() &&
+				   a.GetMinY() == b.GetMinY() && a.GetMaxY() == b.GetMaxY() &&
+				   a.Get_x_ForMinY() == b.Get_x_ForMinY() && a.Get_x_ForMaxY() == b.Get_x_ForMaxY() &&
+				   a.Get_i_ForMinY() == b.Get_i_ForMinY() && a.Get_i_ForMaxY() == b.Get_i_ForMaxY();
+		};
+
+	TableFunction tf, all;
+	vector<double> AllX, AllY;
+
+	for (size_t b = 0; b < 50; ++b)
+	{
+		vector<double> xs, ys;
+		for (size_t k = 0; k < 40; ++k)
+		{
+			// mostly going forward, some points late or repeated
+			double x = 0.1 * (b*30 + k) - (k % 7 == 3 ? 2.0 : 0.0);
+			xs.push_back(x);
+			ys.push_back(y_of(x));
+		}
+		tf.AppendPoints(xs, ys);
+
+		AllX.insert(AllX.end(), xs.begin(), xs.end());
+		AllY.insert(AllY.end(), ys.begin(), ys.end());
+	}
+
+	all.CreateNewFunction(AllX.size());
+	for (size_t i = 0; i < AllX.size(); ++i)
+		all.SetPoint(i, AllX[i], AllY[i]);
+	all.Sort();
+	all.KillDuplicates();
+	all.CalcStat();
+
+	BOOST_CHECK( same(tf, all) );
+
+	// a sliding window of the last points
+	const size_t w = 500;
+	TableFunction win;
+	win.SetWindowSize(w);
+	for (size_t b = 0; b < 40; ++b)
+	{
+		vector<double> xs, ys;
+		for (size_t k = 0; k < 70; ++k)
+		{
+			double x = 0.05 * (b*70 + k);
+			xs.push_back(x);
+			ys.push_back(y_of(x));
+		}
+		win.AppendPoints(xs, ys);
+
+		TableFunction check = win;
+		check.CalcStat();
+		BOOST_CHECK( win.Size() == min(w, (b+1)*70) && same(win, check) );
+	}
+	BOOST_CHECK( win.GetMaxX() == 0.05 * (40*70 - 1) );
+
+	// late points, evicted extremes, a changed point and a copy that shares the points in between
+	TableFunction late;
+	late.SetWindowSize(300);
+	bool ok = true;
+	for (size_t b = 0; b < 60; ++b)
+	{
+		vector<double> xs, ys;
+		for (size_t k = 0; k < 40; ++k)
+		{
+			double x = 0.1 * (b*30 + k) - (k % 7 == 3 ? 2.0 : 0.0);
+			xs.push_back(x);
+			ys.push_back(y_of(x) + (b < 30 ? 0.01 * x : -0.01 * x));   // the extremes move to the evicted end and back
+		}
+		late.AppendPoints(xs, ys);
+
+		if (b == 20)
+			late.SetValAtPoint(100, 1000);
+		if (b == 40)
+		{
+			TableFunction copy = late;
+			late.AppendPoints(vector<double>{1e6}, vector<double>{-1000});
+			copy.AppendPoints(vector<double>{1e6 + 1}, vector<double>{1000});
+			TableFunction check = copy;
+			check.CalcStat();
+			ok = ok && copy.Size() == 300 && same(copy, check) && copy.GetMaxY() == 1000;
+		}
+
+		TableFunction check = late;
+		check.CalcStat();
+		ok = ok && (late.Size() == 300 || (b < 10 && late.Size() < 300)) && same(late, check);
+	}
+	BOOST_CHECK(ok);
+	BOOST_CHECK( late.GetMinY() == -1000 && late.GetMaxX() == 1e6 );
+
+	// the points left after evictions are the same for the other operations on the table
+	// (not a copy of each other: then the points would be copied instead of moved)
+	TableFunction evicted, sorted, direct;
+	for (TableFunction *t : {&evicted, &sorted})
+	{
+		t->SetWindowSize(10);
+		t->AppendPoints(vector<double>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, vector<double>(10, 1.0));
+		t->AppendPoints(vector<double>{10}, vector<double>{2.0});
+	}
+	direct.CreateNewFunction(10);
+	for (size_t i = 0; i < 10; ++i)
+		direct.SetPoint(i, i + 1.0, i < 9 ? 1.0 : 2.0);
+	direct.CalcStat();
+	evicted.KillDuplicates();
+	evicted.CalcStat();
+	sorted.Sort();
+	sorted.CalcStat();
+	BOOST_CHECK( same(evicted, direct) && same(sorted, direct) );
+
+	// NaN at the first point of the window makes MinY and MaxY NaN until it's evicted
+	TableFunction nans;
+	nans.SetWindowSize(50);
+	ok = true;
+	for (size_t b = 0; b < 30; ++b)
+	{
+		vector<double> xs, ys;
+		for (size_t k = 0; k < 10; ++k)
+		{
+			xs.push_back(b*10.0 + k);
+			ys.push_back(b == 3 && k == 0 ? NAN : y_of(xs.back()));
+		}
+		nans.AppendPoints(xs, ys);
+
+		TableFunction check = nans;
+		check.CalcStat();
+		// the points are the same, and same() can't compare NaN
+		bool front_nan = std::isnan(nans.GetY(0));
+		ok = ok && front_nan == (b == 7) && front_nan == std::isnan(nans.GetMinY()) && front_nan == std::isnan(check.GetMaxY()) &&
+			 (front_nan || (nans.GetMinY() == check.GetMinY() && nans.GetMaxY() == check.GetMaxY())) &&
+			 nans.Get_x_ForMinY() == check.Get_x_ForMinY() && nans.Get_x_ForMaxY() == check.Get_x_ForMaxY() &&
+			 nans.Get_i_ForMinY() == check.Get_i_ForMinY() && nans.Get_i_ForMaxY() == check.Get_i_ForMaxY();
+	}
+	BOOST_CHECK(ok);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_parallel_preprocessing_test)
+{
+	// a lot of equal x (with different y) and equal y, to see that the order of ties is kept
+	const size_t n = 300000;
+	vector<double> xs(n), ys(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		xs[i] = (double)((i * 7919) % 50000);
+		ys[i] = (double)(i % 1000) - 500.0;
+	}
+	ys[100] = -0.0;
+	ys[1000] = 0.0;
+	ys[200000] = NAN;
+
+	// the serial reference: a plain stable sort, the first point of every x, a plain loop for the statistics
+	vector<SinglePoint> ref;
+	for (size_t i = 0; i < n; ++i)
+		ref.emplace_back(xs[i], ys[i]);
+	stable_sort(ref.begin(), ref.end(), [](const SinglePoint &a, const SinglePoint &b) { return a.x < b.x; });
+	ref.erase(unique(ref.begin(), ref.end(), [](const SinglePoint &a, const SinglePoint &b) { return a.x == b.x; }), ref.end());
+
+	size_t iMin = 0, iMax = 0;
+	for (size_t i = 1; i < ref.size(); ++i)
+	{
+		if (ref[i].y > ref[iMax].y)
+			iMax = i;
+		if (ref[i].y < ref[iMin].y)
+			iMin = i;
+	}
+
+	for (size_t threads : {1, 3, 4})
+	{
+		TableFunction tf;
+		tf.SetThreadsCount(threads);
+		tf.CreateNewFunction(n);
+		for (size_t i = 0; i < n; ++i)
+			tf.SetPoint(i, xs[i], ys[i]);
+
+		tf.Sort();
+		tf.KillDuplicates();
+		tf.CalcStat();
+
+		bool ok = tf.Size() == ref.size();
+		for (size_t i = 0; ok && i < ref.size(); ++i)
+			ok = tf.GetX(i) == ref[i].x && (tf.GetY(i) == ref[i].y || (std::isnan(tf.GetY(i)) && std::isnan(ref[i].y)));
+		BOOST_CHECK(ok);
+
+		BOOST_CHECK( tf.Get_i_ForMinY() == iMin && tf.Get_i_ForMaxY() == iMax );
+		BOOST_CHECK( tf.GetMinY() == ref[iMin].y && tf.GetMaxY() == ref[iMax].y );
+		BOOST_CHECK( tf.GetMinX() == ref.front().x && tf.GetMaxX() == ref.back().x );
+	}
+
+	// the first of equal values, with a sign of zero too
+	vector<double> a = {3, 0.0, -0.0, 5, NAN, 5};
+	MinMaxInfo mm = MinMaxReduce(a.data(), a.size());
+	BOOST_CHECK( mm.iMin == 1 && !std::signbit(mm.Min) && mm.iMax == 3 && mm.Max == 5 );
+
+	a[0] = NAN;
+	mm = MinMaxReduce(a.data(), a.size());
+	BOOST_CHECK( std::isnan(mm.Min) && std::isnan(mm.Max) && mm.iMin == 0 && mm.iMax == 0 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_shared_data_test)
+{
+	TableFunction tf;
+	tf.CreateDemoFunction(1001, -1, 0.002, TableFunction::TestFunc, "SharedDemo");
+	BOOST_CHECK( tf.BuildSpline() );
+
+	// copies share the points and the spline
+	TableFunction copy = tf;
+	BOOST_CHECK( copy.GetDataX() == tf.GetDataX() && copy.GetDataY() == tf.GetDataY() );
+	BOOST_CHECK( copy.Spline.GetDataB() == tf.Spline.GetDataB() );
+	BOOST_CHECK( copy.Spline.GetKnots() == tf.GetDataX() );   // the spline itself shares the points
+
+	// a change makes a copy's own data, the other one stays as it was
+	double y = tf.GetY(500);
+	double s = tf.Spline(0.0001);
+	copy.SetValAtPoint(500, 10.0);
+	BOOST_CHECK( copy.GetDataY() != tf.GetDataY() );
+	BOOST_CHECK( copy.GetY(500) == 10.0 && tf.GetY(500) == y );
+	BOOST_CHECK( tf.Spline(0.0001) == s && copy.Spline(0.0001) == s );   // the spline of the copy isn't rebuilt
+
+	get<1>(copy[501]) = 20.0;
+	BOOST_CHECK( copy.GetY(501) == 20.0 && tf.GetY(501) != 20.0 );
+
+	BOOST_CHECK( copy.BuildSpline() );
+	BOOST_CHECK( copy.Spline(0.0001) != s && tf.Spline(0.0001) == s );
+
+	// the data are kept while anybody uses them
+	const double *x = tf.GetDataX();
+	TableFunction other = tf;
+	tf.ClearAll();
+	BOOST_CHECK( other.GetDataX() == x && other.Size() == 1001 && other.Spline(0.0001) == s );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_lazy_update_test)
+{
+	const size_t n = 2000;
+
+	// the statistics don't need CalcStat any more
+	TableFunction tf;
+	tf.CreateNewFunction(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		double x = i * 0.01 + 0.003 * sin(i * 1.7);   // not uniform
+		tf.SetPoint(i, x, sin(x) + 0.1 * cos(7 * x));
+	}
+	BOOST_CHECK( tf.GetMinX() == tf.GetX(0) && tf.GetMaxX() == tf.GetX(n-1) );
+
+	auto stat_ok = [](const TableFunction &t)
+		{
+			TableFunction check = t;
+			check.CalcStat();
+			return t.GetMinY() == check.GetMinY() && t.GetMaxY() == check.GetMaxY() &&
+				   t.Get_i_ForMinY() == check.Get_i_ForMinY() && t.Get_i_ForMaxY() == check.Get_i_ForMaxY() &&
+				   t.Get_x_ForMinY() == check.Get_x_ForMinY() && t.Get_x_ForMaxY() == check.Get_x_ForMaxY();
+		};
+
+	// edits of y, including ones of the extreme points themselves
+	bool ok = true;
+	for (size_t k = 0; k < 200; ++k)
+	{
+		size_t i = (k * 7919) % n;
+		if (k % 10 == 0)
+			i = tf.Get_i_ForMaxY();
+		if (k % 10 == 5)
+			i = tf.Get_i_ForMinY();
+		tf.SetValAtPoint(i, sin(k * 0.37) * 1.2);
+		ok = ok && stat_ok(tf);
+	}
+	BOOST_CHECK(ok);
+
+	// the spline is built on first use, and then is only updated around the changed points
+	auto spline_ok = [](const TableFunction &t)
+		{
+			CubicSpline full;
+			full.BuildSpline(t.GetDataX(), t.GetDataY(), t.Size());
+
+			bool ok = true;
+			for (double x = t.GetMinX() - 0.1; x < t.GetMaxX() + 0.1; x += 0.00713)
+				ok = ok && fabs(t.SplineVal(x) - full(x)) < 1e-9;
+			return ok;
+		};
+
+	BOOST_CHECK( spline_ok(tf) );
+
+	tf.SetValAtPoint(1000, 5.0);
+	BOOST_CHECK( spline_ok(tf) );
+
+	tf.SetPoint(700, tf.GetX(700) + 0.004, 1.0);   // still between its neighbours
+	tf.SetValAtPoint(710, -1.0);
+	BOOST_CHECK( spline_ok(tf) );
+
+	get<1>(tf[3]) = 2.0;   // near the ends
+	BOOST_CHECK( spline_ok(tf) );
+	tf.SetValAtPoint(n-2, 2.0);
+	BOOST_CHECK( spline_ok(tf) );
+
+	tf.SetValAtPoint(0, -3.0);
+	tf.SetValAtPoint(n-1, 3.0);   // too far from each other for a window, it's built anew
+	BOOST_CHECK( spline_ok(tf) );
+
+	tf.Sort();   // already sorted, nothing to do
+	TableFunction copy = tf;
+	copy.KillDuplicates();
+	BOOST_CHECK( spline_ok(copy) );
+
+	// a change, then many threads at once need the statistics and the spline
+	tf.SetValAtPoint(1500, 7.0);
+	vector<double> maxs(4), vals(4);
+	vector<thread> threads;
+	for (size_t t = 0; t < 4; ++t)
+		threads.emplace_back([&tf, &maxs, &vals, t]()
+			{
+				maxs[t] = tf.GetMaxY();
+				vals[t] = tf.SplineVal(tf.GetX(1500));
+			});
+	for (auto &t : threads)
+		t.join();
+
+	for (size_t t = 0; t < 4; ++t)
+		BOOST_CHECK( maxs[t] == 7.0 && fabs(vals[t] - 7.0) < 1e-12 );
+
+	// copies are taken while other threads fill in the statistics, the spline and the integrals
+	bool copies_ok = true;
+	for (size_t r = 0; r < 20; ++r)
+	{
+		tf.SetValAtPoint(1000 + r, 8.0 + r);
+		vector<int> ok(4, 0);
+		vector<thread> group;
+		for (size_t t = 0; t < 4; ++t)
+			group.emplace_back([&tf, &ok, t, r]()
+				{
+					if (t % 2)
+					{
+						TableFunction c = tf;
+						ok[t] = c.GetMaxY() == 8.0 + r && fabs(c.SplineVal(c.GetX(1000 + r)) - (8.0 + r)) < 1e-12;
+					}
+					else
+						ok[t] = tf.GetMaxY() == 8.0 + r && tf.Integral(tf.GetMinX(), tf.GetMaxX()) > 0 &&
+								fabs(tf.SplineVal(tf.GetX(1000 + r)) - (8.0 + r)) < 1e-12;
+				});
+		for (auto &t : group)
+			t.join();
+		for (int v : ok)
+			copies_ok = copies_ok && v;
+	}
+	BOOST_CHECK(copies_ok);
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_range_minmax_test)
+{
+	// ties, signed zeros and NaN, so that the choice of the position is checked too
+	const size_t n = 5003;
+	TableFunction tf;
+	tf.CreateNewFunction(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		double y = floor(sin(i * 0.37) * 20) + (i % 13 == 0 ? -0.0 : 0.0);
+		tf.SetPoint(i, i * 0.1, i % 101 == 5 ? numeric_limits<double>::quiet_NaN() : y);
+	}
+
+	TableFunction scan = tf;
+	tf.BuildRangeIndex();
+	BOOST_CHECK( tf.IsRangeIndexExists() && !scan.IsRangeIndexExists() );
+
+	auto same = [&](double x1, double x2)
+		{
+			MinMaxInfo a, b;
+			bool fa = tf.GetMinMaxY(x1, x2, a), fb = scan.GetMinMaxY(x1, x2, b);
+			if (fa != fb)
+				return false;
+			return !fa || (a.iMin == b.iMin && a.iMax == b.iMax && (a.Min == b.Min || std::isnan(a.Min)));
+		};
+
+	bool ok = true;
+	for (size_t k = 0; k < 3000; ++k)
+	{
+		double x1 = fabs(sin(k * 1.3)) * 520 - 10, x2 = x1 + fabs(sin(k * 0.7)) * (k % 3 ? 5 : 300);
+		ok = ok && same(x1, x2);
+	}
+	ok = ok && same(50.5, 50.5) && same(50.5, 50.6) && same(0.5, 0.5) && same(-1, 1000) && same(3, 2);
+	BOOST_CHECK(ok);
+
+	MinMaxInfo info;
+	BOOST_CHECK( !tf.GetMinMaxY(1000, 2000, info) );
+	BOOST_CHECK( tf.GetMinMaxY(-1, 1000, info) && info.Min == tf.GetMinY() && info.iMax == tf.Get_i_ForMaxY() );
+
+	// edits are applied on the next query; a copy keeps its own index
+	TableFunction before = tf;
+	for (size_t k = 0; k < 20; ++k)
+	{
+		size_t i = (k * 977) % n;
+		tf.SetValAtPoint(i, k % 2 ? 100.0 + k : -100.0 - k);
+		scan.SetValAtPoint(i, k % 2 ? 100.0 + k : -100.0 - k);
+	}
+	get<1>(tf[1234]) = 500;
+	get<1>(scan[1234]) = 500;
+
+	ok = true;
+	for (size_t k = 0; k < 1000; ++k)
+	{
+		double x1 = fabs(sin(k * 2.1)) * 500, x2 = x1 + fabs(sin(k * 0.3)) * 200;
+		ok = ok && same(x1, x2);
+	}
+	BOOST_CHECK(ok);
+	BOOST_CHECK( tf.GetMinMaxY(123.3, 123.5, info) && info.Max == 500 && info.iMax == 1234 );
+	BOOST_CHECK( before.GetMinMaxY(123.3, 123.5, info) && info.Max != 500 );
+
+	// a change of the count rebuilds it
+	tf.AppendPoints(vector<double>{1000.0, 1001.0}, vector<double>{-1e9, 1e9});
+	scan.AppendPoints(vector<double>{1000.0, 1001.0}, vector<double>{-1e9, 1e9});
+	BOOST_CHECK( same(400, 1000.5) && same(-10, 2000) );
+	BOOST_CHECK( tf.GetMinMaxY(-10, 2000, info) && info.iMin == n && info.iMax == n + 1 );
+
+	tf.ClearRangeIndex();
+	BOOST_CHECK( !tf.IsRangeIndexExists() && same(0, 2000) );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_inverse_test)
+{
+	vector<double> xs;
+
+	// monotone: a binary search
+	TableFunction up;
+	up.CreateDemoFunction(1001, 0.0, 0.01, [](double x) { return x * x; });
+	BOOST_CHECK( up.FindXsByY(4.0, xs) == 1 && fabs(xs[0] - 2.0) < 1e-12 );
+	BOOST_CHECK( up.FindXsByY(2.0, xs) == 1 && fabs(xs[0] - sqrt(2.0)) < 1e-4 );
+	BOOST_CHECK( up.FindXsByY(0.0, xs) == 1 && xs[0] == 0.0 );
+	BOOST_CHECK( up.FindXsByY(100.0, xs) == 1 && xs[0] == 10.0 );
+	BOOST_CHECK( up.FindXsByY(-1.0, xs) == 0 && up.FindXsByY(101.0, xs) == 0 );
+
+	TableFunction down;
+	down.CreateDemoFunction(5, 0.0, 1.0, [](double x) { return x < 1.5 ? 3.0 : (x < 3.5 ? 1.0 : 0.0); });   // 3 3 1 1 0
+	BOOST_CHECK( down.FindXsByY(2.0, xs) == 1 && xs[0] == 1.5 );
+	BOOST_CHECK( down.FindXsByY(1.0, xs) == 2 && xs[0] == 2.0 && xs[1] == 3.0 );   // a flat piece
+	BOOST_CHECK( down.FindXsByY(3.0, xs) == 2 && xs[0] == 0.0 && xs[1] == 1.0 );
+
+	// general: the same as a scan of all the segments
+	const size_t n = 20001;
+	TableFunction tf;
+	tf.CreateDemoFunction(n, 0.0, 0.001, [](double x) { return floor(sin(10.0 * x) * 8 + sin(37.0 * x)) / 4; });
+
+	auto scan = [&](double y)
+		{
+			vector<double> r;
+			for (size_t j = 0; j + 1 < n; ++j)
+			{
+				double y0 = tf.GetY(j), y1 = tf.GetY(j+1);
+				if (j == 0 && y0 == y)
+					r.push_back(tf.GetX(0));
+				if (y1 == y)
+					r.push_back(tf.GetX(j+1));
+				else if ((y0 < y && y < y1) || (y0 > y && y > y1))
+					r.push_back(tf.GetX(j) + (y - y0) / (y1 - y0) * (tf.GetX(j+1) - tf.GetX(j)));
+			}
+			return r;
+		};
+
+	bool ok = true;
+	for (int k = -12; k <= 12; ++k)
+	{
+		double y = k * 0.25 + (k % 3 ? 0.0 : 0.1);
+		ok = ok && tf.FindXsByY(y, xs) == scan(y).size() && xs == scan(y);
+	}
+	BOOST_CHECK(ok);
+	BOOST_CHECK( tf.FindXsByY(numeric_limits<double>::quiet_NaN(), xs) == 0 );
+
+	// a change of the points is seen by the next query
+	tf.SetValAtPoint(n / 2, 100.0);
+	BOOST_CHECK( tf.FindXsByY(50.0, xs) == 2 && xs[0] < tf.GetX(n / 2) && xs[1] > tf.GetX(n / 2) );
+
+	// the spline: all the crossings of sin(10x) with 0.5, then a monotone Pchip
+	TableFunction sine;
+	sine.CreateDemoFunction(2001, 0.0, 0.001);
+	BOOST_CHECK( sine.SplineFindXsByY(0.5, xs) == 7 );
+	const double pi = acos(-1.0), a = asin(0.5);
+	ok = xs.size() == 7;
+	for (size_t k = 0; ok && k < 7; ++k)
+	{
+		double exact = (k % 2 ? pi - a : a) / 10 + 2 * pi * (k / 2) / 10;
+		ok = fabs(xs[k] - exact) < 1e-9 && fabs(sine.SplineVal(xs[k]) - 0.5) < 1e-12;
+	}
+	BOOST_CHECK(ok);
+	BOOST_CHECK( sine.SplineFindXsByY(0.9999, xs) == 6 && xs[0] < pi / 20 && xs[1] > pi / 20 );   // between the knots
+	BOOST_CHECK( sine.SplineFindXsByY(sine.GetY(700), xs) == 7 && count(xs.begin(), xs.end(), sine.GetX(700)) == 1 );
+	BOOST_CHECK( sine.SplineFindXsByY(2.0, xs) == 0 );
+
+	TableFunction steps = down;
+	steps.SetSplineType(SplineType::Pchip);
+	BOOST_CHECK( steps.SplineFindXsByY(2.0, xs) == 1 && fabs(steps.SplineVal(xs[0]) - 2.0) < 1e-12 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_adaptive_test)
+{
+	// smooth, with a narrow peak: the points must gather at the peak
+	atomic<size_t> calls{0};
+	auto f = [&calls](double x)
+		{
+			++calls;
+			return sin(3.0 * x) + exp(-(x - 1.0) * (x - 1.0) * 2500.0);
+		};
+
+	const double tol = 1e-5;
+	TableFunction tf;
+	tf.SetThreadsCount(4);
+	BOOST_CHECK( tf.CreateAdaptiveFunction(-2.0, 3.0, f, tol) );
+	BOOST_CHECK( tf.GetMinX() == -2.0 && tf.GetMaxX() == 3.0 );
+	BOOST_CHECK( calls == 2 * tf.Size() - 1 );   // the points and the middles of the intervals, each one once
+
+	double err = 0;
+	for (size_t k = 0; k <= 100000; ++k)
+	{
+		double x = -2.0 + 5.0 * k / 100000;
+		err = max(err, fabs(tf(x) - f(x)));
+	}
+	BOOST_CHECK( err < 2 * tol );
+
+	auto count_in = [](const TableFunction &t, double x1, double x2)
+		{
+			return upper_bound(t.GetDataX(), t.GetDataX() + t.Size(), x2) - lower_bound(t.GetDataX(), t.GetDataX() + t.Size(), x1);
+		};
+	BOOST_CHECK( count_in(tf, 0.9, 1.1) > count_in(tf, 2.0, 2.2) * 5 );
+
+	// the spline needs far fewer points for the same error
+	TableFunction sp;
+	BOOST_CHECK( sp.CreateAdaptiveFunction(-2.0, 3.0, f, tol, true) );
+	BOOST_CHECK( sp.Size() * 4 < tf.Size() );
+	err = 0;
+	for (size_t k = 0; k <= 100000; ++k)
+	{
+		double x = -2.0 + 5.0 * k / 100000;
+		err = max(err, fabs(sp.SplineVal(x) - f(x)));
+	}
+	BOOST_CHECK( err < 10 * tol );
+
+	// the limit of points, and a jump that can't be met
+	TableFunction few;
+	BOOST_CHECK( !few.CreateAdaptiveFunction(-2.0, 3.0, f, tol, false, 100) && few.Size() <= 100 );
+	TableFunction jump;
+	BOOST_CHECK( !jump.CreateAdaptiveFunction(0.0, 1.0, [](double x) { return x < 0.3 ? 0.0 : 1.0; }, 1e-3) );
+	BOOST_CHECK( jump.Size() < 200 && jump(0.2) == 0.0 && jump(0.4) == 1.0 );
+
+	TableFunction one;
+	BOOST_CHECK( one.CreateAdaptiveFunction(1.0, 1.0, f, tol) && one.Size() == 1 );
+	BOOST_CHECK( !one.CreateAdaptiveFunction(2.0, 1.0, f, tol) && one.Size() == 0 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_tf_resample_test)
+{
+	const size_t n = 100003;
+	TableFunction tf;
+	tf.CreateDemoFunction(n, 0.0, 0.0001, [](double x) { return sin(10.0 * x) + sin(x * 7919.0) * 0.1 + (fabs(x - 5.0) < 1e-4 ? 3.0 : 0.0); });
+	tf.SetName("src");
+
+	// uniform: the same values as the table (or its spline) gives, with a uniform index
+	TableFunction u = tf.ResampleUniform(1001);
+	BOOST_CHECK( u.Size() == 1001 && u.GetX(0) == tf.GetMinX() && u.GetX(1000) == tf.GetMaxX() && u.GetName() == "src" );
+	BOOST_CHECK( u.GetSearchIndexType() == SearchIndexType::Uniform );
+	BOOST_CHECK( u.GetY(500) == tf(u.GetX(500)) && u.GetY(1000) == tf.GetY(n - 1) );
+	TableFunction us = tf.ResampleUniform(1001, true);
+	BOOST_CHECK( us.GetY(333) == tf.SplineVal(us.GetX(333)) );
+	TableFunction g = tf.Resample({0.5, 1.0, 2.0});
+	BOOST_CHECK( g.Size() == 3 && g.GetY(1) == tf(1.0) );
+
+	// LTTB: the same points as the classic serial scan, for any threads count
+	auto classic = [&](size_t m)
+		{
+			vector<size_t> r = {0};
+			size_t nb = m - 2, a = 0;
+			auto B = [&](size_t i) { return 1 + i * (n - 2) / nb; };
+			for (size_t i = 0; i < nb; ++i)
+			{
+				double cx = 0, cy = 0;
+				size_t b1 = B(i + 1), e1 = i + 1 < nb ? B(i + 2) : n;
+				for (size_t k = b1; k < e1; ++k)
+				{
+					cx += tf.GetX(k);
+					cy += tf.GetY(k);
+				}
+				cx /= e1 - b1;
+				cy /= e1 - b1;
+
+				double best = -1;
+				size_t p = 0;
+				for (size_t k = B(i); k < B(i + 1); ++k)
+				{
+					double area = fabs((tf.GetX(a) - cx) * (tf.GetY(k) - tf.GetY(a)) - (tf.GetX(a) - tf.GetX(k)) * (cy - tf.GetY(a)));
+					if (area > best)
+					{
+						best = area;
+						p = k;
+					}
+				}
+				r.push_back(a = p);
+			}
+			r.push_back(n - 1);
+			return r;
+		};
+
+	bool ok = true;
+	for (size_t m : {3, 10, 1000, 7777})
+	{
+		vector<size_t> ref = classic(m);
+		for (size_t threads : {1, 3})
+		{
+			tf.SetThreadsCount(threads);
+			TableFunction d = tf.DecimateLTTB(m);
+			ok = ok && d.Size() == m;
+			for (size_t k = 0; ok && k < m; ++k)
+				ok = d.GetX(k) == tf.GetX(ref[k]) && d.GetY(k) == tf.GetY(ref[k]);
+		}
+	}
+	BOOST_CHECK(ok);
+	BOOST_CHECK( tf.DecimateLTTB(1000).GetMaxY() == tf.GetMaxY() );   // the spike survives
+	BOOST_CHECK( tf.DecimateLTTB(2).Size() == 2 && tf.DecimateLTTB(0).Size() == 0 && tf.DecimateLTTB(n + 5).Size() == n );
+
+	// block averages
+	TableFunction avg = tf.BlockAverage(1000);
+	BOOST_CHECK( avg.Size() == 101 );
+	double sx = 0, sy = 0;
+	for (size_t k = 1000; k < 2000; ++k)
+	{
+		sx += tf.GetX(k);
+		sy += tf.GetY(k);
+	}
+	BOOST_CHECK( fabs(avg.GetX(1) - sx / 1000) < 1e-12 && fabs(avg.GetY(1) - sy / 1000) < 1e-12 );
+	BOOST_CHECK( avg.GetX(100) == (tf.GetX(n - 3) + tf.GetX(n - 2) + tf.GetX(n - 1)) / 3 );
+}
+//---------------------------------------------------------------------------
+
 BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_user_target_function)
 {
 	GradDescent gd;
@@ -223,6 +1463,9 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_user_target_function)
 	case GradErrorType::ItersOverflow:
 		cout << "ItersOverflow" << endl;
 		break;
+	case GradErrorType::TooManyParams:
+		cout << "TooManyParams" << endl;
+		break;
 	}
 
 	cout << "gd.GetLastCost() = " << gd.GetLastCost() << endl;
@@ -310,6 +1553,9 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_linear_test)
 	case GradErrorType::ItersOverflow:
 		cout << "ItersOverflow" << endl;
 		break;
+	case GradErrorType::TooManyParams:
+		cout << "TooManyParams" << endl;
+		break;
 	}
 
 	cout << "gd.GetLastCost() = " << gd.GetLastCost() << endl;
@@ -392,6 +1638,9 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_polynominal_test)
 	case GradErrorType::ItersOverflow:
 		cout << "ItersOverflow" << endl;
 		break;
+	case GradErrorType::TooManyParams:
+		cout << "TooManyParams" << endl;
+		break;
 	}
 
 	cout << "gd.GetLastCost() = " << gd.GetLastCost() << endl;
@@ -492,6 +1741,9 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_damped_oscillations_test)
 	case GradErrorType::ItersOverflow:
 		cout << "ItersOverflow" << endl;
 		break;
+	case GradErrorType::TooManyParams:
+		cout << "TooManyParams" << endl;
+		break;
 	}
 
 	cout << "gd.GetLastCost() = " << gd.GetLastCost() << endl;
@@ -512,6 +1764,308 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_damped_oscillations_test)
 //---------------------------------------------------------------------------
 
 
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_parallel_gradient_test)
+{
+	TableFunction experimental;
+	experimental.CreateDemoFunction(2001, -20, 0.05, [](double x) { return 3.0 * sin(0.25 * x + 0.5) * exp(-0.02 * x) + 10.0; });
+
+	// the same steps for any threads count, also when the pool is reused by the next Go
+	auto fit = [&](size_t threads, bool fin_dif, GradDescent *reuse = nullptr)
+		{
+			GradDescent own;
+			GradDescent &gd = reuse ? *reuse : own;
+			gd.SetSrcFunction(experimental);
+			gd.SetDstFunction(damped_oscillations_predict);
+			gd.SetGradThreadsCount(threads);
+			gd.SetAlpha(0.45);
+			gd.SetEps(1e-6);
+			gd.SetMin_Eta(1e-11);
+			gd.SetEta_k_inc(1.09);
+			gd.SetFinDifMethod(fin_dif);
+			gd.SetMaxIters(150);
+			gd.SetMaxTime(1000);
+
+			gd.SetParams({2.5, 0.27, 0, 0.01, 15});
+			gd.SetMinConstrains({1, 0, -3.15, 0.001, 0});
+			gd.SetMaxConstrains({3, 1, 3.15, 0.05, 30});
+			gd.SetRelConstrains(vector<double>(5, 0));
+			gd.SetTypeConstrains(vector<bool>(5, false));
+
+			gd.Go();
+			vector<double> r = gd.GetParams();
+			r.push_back(gd.GetLastCost());
+			return r;
+		};
+
+	for (bool fin_dif : {false, true})
+	{
+		vector<double> serial = fit(1, fin_dif);
+		BOOST_CHECK( fit(2, fin_dif) == serial );
+		BOOST_CHECK( fit(3, fin_dif) == serial );
+
+		GradDescent gd;
+		BOOST_CHECK( fit(4, fin_dif, &gd) == serial && fit(4, fin_dif, &gd) == serial );
+	}
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_cost_test)
+{
+	// large residuals of mixed sizes: the naive sum would lose digits
+	const size_t n = 1000003;
+	TableFunction experimental;
+	experimental.CreateDemoFunction(n, -20, 40.0 / n, [](double x) { return 10.0 + 1e4 * sin(x * 37.0) * sin(x * 37.0) * sin(x * 37.0); });
+
+	vector<double> p = {2.5, 0.27, 0, 0.01, 15};
+
+	long double exact = 0;
+	for (size_t i = 0; i < n; ++i)
+	{
+		long double r = experimental.GetY(i) - damped_oscillations_predict(experimental.GetX(i), p);
+		exact += r * r;
+	}
+
+	double costs[3];
+	size_t k = 0;
+	for (size_t threads : {1, 2, 3})
+	{
+		GradDescent gd;
+		gd.SetSrcFunction(experimental);
+		gd.SetDstFunction(damped_oscillations_predict);
+		gd.SetGradThreadsCount(threads);
+		costs[k++] = gd.CalcCostAt(p);
+	}
+
+	BOOST_CHECK( costs[0] == costs[1] && costs[0] == costs[2] );
+	BOOST_CHECK( fabs(costs[0] - (double)exact) <= 1e-14 * (double)exact );
+
+	TableFunction empty;
+	GradDescent gd;
+	gd.SetSrcFunction(empty);
+	gd.SetDstFunction(damped_oscillations_predict);
+	BOOST_CHECK( gd.CalcCostAt(p) == 0 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_batch_model_test)
+{
+	TableFunction experimental;
+	experimental.CreateDemoFunction(1501, -20, 0.03, [](double x) { return 3.0 * sin(0.25 * x + 0.5) * exp(-0.02 * x) + 10.0; });
+
+	atomic<size_t> calls{0}, points{0};
+	BatchDstFunctionType batch = [&](const double *xs, double *ys, size_t n, const vector<double> &p)
+		{
+			++calls;
+			points += n;
+			for (size_t i = 0; i < n; ++i)
+				ys[i] = damped_oscillations_predict(xs[i], p);
+		};
+
+	// the same values in the same order, so the same steps as with the model point by point
+	auto fit = [&](bool use_batch, size_t threads, GradDescent &gd)
+		{
+			gd.SetSrcFunction(experimental);
+			if (use_batch)
+				gd.SetBatchDstFunction(batch);
+			else
+				gd.SetDstFunction(damped_oscillations_predict);
+			gd.SetGradThreadsCount(threads);
+			gd.SetAlpha(0.45);
+			gd.SetMin_Eta(1e-11);
+			gd.SetMaxIters(100);
+			gd.SetMaxTime(1000);
+			gd.SetParams({2.5, 0.27, 0, 0.01, 15});
+			gd.SetMinConstrains({1, 0, -3.15, 0.001, 0});
+			gd.SetMaxConstrains({3, 1, 3.15, 0.05, 30});
+			gd.SetRelConstrains(vector<double>(5, 0));
+			gd.SetTypeConstrains(vector<bool>(5, false));
+			gd.Go();
+			vector<double> r = gd.GetParams();
+			r.push_back(gd.GetLastCost());
+			return r;
+		};
+
+	GradDescent plain, batched, batched3;
+	vector<double> ref = fit(false, 1, plain);
+	BOOST_CHECK( fit(true, 1, batched) == ref );
+	BOOST_CHECK( calls > 0 && points / calls > GradDescent::CostBlockSize / 2 );   // by blocks, not by points
+	BOOST_CHECK( fit(true, 3, batched3) == ref );
+
+	vector<double> ys(experimental.Size());
+	batched.GetYs(ys.data());
+	BOOST_CHECK( ys[700] == plain.GetY(700) && batched.GetY(700) == plain.GetY(700) && batched.GetRandomY(0.1) == plain.GetRandomY(0.1) );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_jacobian_test)
+{
+	// the derivatives carried by the dual numbers
+	Dual<2> a(0.7, 0), b(-1.3, 1);
+	Dual<2> f = sin(a * b) + exp(a) / b - pow(a, 3.0) + sqrt(a * a + b * b);
+	double r = std::sqrt(0.7 * 0.7 + 1.3 * 1.3);
+	BOOST_CHECK( fabs(f.v - (std::sin(-0.91) + std::exp(0.7) / -1.3 - 0.343 + r)) < 1e-14 );
+	BOOST_CHECK( fabs(f.d[0] - (-1.3 * std::cos(-0.91) + std::exp(0.7) / -1.3 - 3 * 0.49 + 0.7 / r)) < 1e-13 );
+	BOOST_CHECK( fabs(f.d[1] - (0.7 * std::cos(-0.91) - std::exp(0.7) / 1.69 - 1.3 / r)) < 1e-13 );
+
+	// comparisons with plain numbers in both orders look at the value only
+	BOOST_CHECK( a <= 0.7 && a >= 0.7 && a == 0.7 && !(a != 0.7) && b < 0.0 && b != -1.0 );
+	BOOST_CHECK( 0.7 <= a && 0.7 >= a && 0.7 == a && !(0.7 != a) && 0.0 > b && -1.0 != b );
+
+	// so a model may branch on them
+	auto hinge = [](double x, const auto &p) { return x <= p[1] || p[0] == 0.0 ? p[2] : p[0] * (x - p[1]) + p[2]; };
+	GradDescent branchy;
+	branchy.SetDualModel<3>(hinge);
+	TableFunction knee;
+	knee.CreateDemoFunction(101, -5, 0.1, [](double x) { return x <= 0.0 ? 1.0 : 2.0 * x + 1.0; });
+	branchy.SetSrcFunction(knee);
+	vector<double> hp = {2.0, 0.0, 1.0}, hg;
+	BOOST_CHECK( branchy.CalcCostAndGradientAt(hp, hg) < 1e-20 && hg.size() == 3 );
+	BOOST_CHECK( fabs(hg[0]) < 1e-12 && fabs(hg[1]) < 1e-12 && fabs(hg[2]) < 1e-12 );
+
+	TableFunction experimental;
+	experimental.CreateDemoFunction(1501, -20, 0.03, [](double x) { return 3.0 * sin(0.25 * x + 0.5) * exp(-0.02 * x) + 10.0; });
+
+	auto model = [](double x, const auto &p) { return p[0] * sin(p[1] * x + p[2]) * exp(-p[3] * x) + p[4]; };
+
+	// the same model by hand
+	JacobianFunctionType jacobian = [](const double *xs, double *ys, double *J, size_t n, const vector<double> &p)
+		{
+			for (size_t i = 0; i < n; ++i, J += 5)
+			{
+				double x = xs[i], s = sin(p[1] * x + p[2]), c = cos(p[1] * x + p[2]), e = exp(-p[3] * x);
+				ys[i] = p[0] * s * e + p[4];
+				J[0] = s * e;
+				J[1] = p[0] * c * x * e;
+				J[2] = p[0] * c * e;
+				J[3] = -p[0] * s * x * e;
+				J[4] = 1;
+			}
+		};
+
+	auto setup = [&](GradDescent &gd)
+		{
+			gd.SetSrcFunction(experimental);
+			gd.SetAlpha(0.45);
+			gd.SetMin_Eta(1e-11);
+			gd.SetMaxIters(1000);
+			gd.SetMaxTime(1000);
+			gd.SetParams({2.5, 0.27, 0, 0.01, 15});
+			gd.SetMinConstrains({1, 0, -3.15, 0.001, 0});
+			gd.SetMaxConstrains({3, 1, 3.15, 0.05, 30});
+			gd.SetRelConstrains(vector<double>(5, 0));
+			gd.SetTypeConstrains(vector<bool>(5, false));
+		};
+
+	GradDescent fd, dual, manual, dual3, tooshort;
+	setup(fd);
+	fd.SetDstFunction(damped_oscillations_predict);
+	setup(dual);
+	dual.SetDualModel<8>(model);
+	setup(manual);
+	manual.SetDstFunction(damped_oscillations_predict);
+	manual.SetJacobianFunction(jacobian);
+	setup(dual3);
+	dual3.SetDualModel<5>(model);
+	dual3.SetGradThreadsCount(3);
+
+	// the exact gradient agrees with the finite differences and doesn't depend on the threads
+	vector<double> p = {2.5, 0.27, 0.1, 0.01, 15}, g_fd, g_dual, g_manual, g_dual3;
+	double c_fd = fd.CalcCostAndGradientAt(p, g_fd);
+	double c_dual = dual.CalcCostAndGradientAt(p, g_dual);
+	BOOST_CHECK( c_dual == fd.CalcCostAt(p) && fabs(c_fd - c_dual) < 1e-12 * c_dual );
+	BOOST_CHECK( manual.CalcCostAndGradientAt(p, g_manual) == c_dual && dual3.CalcCostAndGradientAt(p, g_dual3) == c_dual );
+	BOOST_CHECK( g_dual3 == g_dual );
+	for (size_t j = 0; j < p.size(); ++j)
+	{
+		BOOST_CHECK( fabs(g_fd[j] - g_dual[j]) < 1e-4 * (1 + fabs(g_dual[j])) );
+		BOOST_CHECK( fabs(g_manual[j] - g_dual[j]) < 1e-9 * (1 + fabs(g_dual[j])) );
+	}
+
+	// the values come from DstFunction, even if the Jacobian's differ a little
+	GradDescent skewed;
+	setup(skewed);
+	skewed.SetDstFunction(damped_oscillations_predict);
+	skewed.SetJacobianFunction([&](const double *xs, double *ys, double *J, size_t n, const vector<double> &p)
+		{
+			jacobian(xs, ys, J, n, p);
+			for (size_t i = 0; i < n; ++i)
+				ys[i] += 0.01;
+		});
+	vector<double> g_skewed;
+	BOOST_CHECK( skewed.CalcCostAndGradientAt(p, g_skewed) == c_dual && g_skewed == g_manual );
+
+	// the dual numbers must be long enough for the parameters
+	setup(tooshort);
+	tooshort.SetDualModel<4>(model);
+	BOOST_CHECK( std::isnan(tooshort.CalcCostAndGradientAt(p, g_dual)) );
+	BOOST_CHECK( tooshort.Go() == GradErrorType::TooManyParams && tooshort.GetParams()[0] == 2.5 );
+	tooshort.SetDualModel<5>(model);
+	tooshort.SetMaxIters(3);
+	BOOST_CHECK( tooshort.Go() == GradErrorType::ItersOverflow );
+
+	fd.Go();
+	dual.Go();
+	manual.Go();
+	dual3.Go();
+	BOOST_CHECK( dual.GetLastCost() < 1e-6 && manual.GetLastCost() < 1e-6 );
+	BOOST_CHECK( dual.GetLastCost() <= fd.GetLastCost() * 1.01 );
+	BOOST_CHECK( dual3.GetParams() == dual.GetParams() );
+	BOOST_CHECK( fabs(dual.GetParams()[0] - 3.0) < 1e-3 && fabs(dual.GetParams()[3] - 0.02) < 1e-5 );
+}
+//---------------------------------------------------------------------------
+
+BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_static_test)
+{
+	TableFunction experimental;
+	experimental.CreateDemoFunction(1501, -20, 0.03, [](double x) { return 3.0 * sin(0.25 * x + 0.5) * exp(-0.02 * x) + 10.0; });
+
+	auto model = [](double x, const auto &p) { return p[0] * sin(p[1] * x + p[2]) * exp(-p[3] * x) + p[4]; };
+
+	auto setup = [&](auto &gd, size_t threads)
+		{
+			gd.SetSrcFunction(experimental);
+			gd.SetGradThreadsCount(threads);
+			gd.SetAlpha(0.45);
+			gd.SetMin_Eta(1e-11);
+			gd.SetMaxIters(200);
+			gd.SetMaxTime(1000);
+			gd.SetParams({2.5, 0.27, 0, 0.01, 15});
+			gd.SetMinConstrains({1, 0, -3.15, 0.001, 0});
+			gd.SetMaxConstrains({3, 1, 3.15, 0.05, 30});
+			gd.SetRelConstrains({0, 0, 0, 0, 0});
+			gd.SetTypeConstrains({false, false, false, false, false});
+		};
+
+	GradDescent runtime;
+	setup(runtime, 1);
+	runtime.SetDstFunction(damped_oscillations_predict);
+
+	auto fixed = MakeStaticGradDescent<5>(model);
+	setup(fixed, 1);
+	auto fixed3 = MakeStaticGradDescent<5>(model);
+	setup(fixed3, 3);
+	StaticGradDescent<decltype(&damped_oscillations_predict)> dynamic(&damped_oscillations_predict);
+	setup(dynamic, 1);
+
+	// the same code with the same model: the same costs and the same steps
+	array<double, 5> p = {2.5, 0.27, 0.1, 0.01, 15};
+	vector<double> pv(p.begin(), p.end());
+	BOOST_CHECK( fixed.CalcCostAt(p) == runtime.CalcCostAt(pv) && dynamic.CalcCostAt(pv) == runtime.CalcCostAt(pv) );
+
+	BOOST_CHECK( runtime.Go() == GradErrorType::ItersOverflow );
+	BOOST_CHECK( fixed.Go() == GradErrorType::ItersOverflow );
+	fixed3.Go();
+	dynamic.Go();
+
+	vector<double> r = runtime.GetParams();
+	array<double, 5> f = fixed.GetParams();
+	BOOST_CHECK( vector<double>(f.begin(), f.end()) == r && fixed3.GetParams() == f && dynamic.GetParams() == r );
+	BOOST_CHECK( fixed.GetLastCost() == runtime.GetLastCost() && fixed.GetLastIters() == runtime.GetLastIters() );
+	BOOST_CHECK( fixed.GetY(700) == runtime.GetY(700) && fixed.GetRandomY(0.1) == runtime.GetRandomY(0.1) );
+	BOOST_CHECK( fixed.GetLastCost() < 0.01 * fixed.CalcCostAt({2.5, 0.27, 0, 0.01, 15}) );
+}
+//---------------------------------------------------------------------------
+
 double two_gaussian_distribution_experimental(double x)
 {
 	double noise = rand() / (double)RAND_MAX / 1.5; // add some noise 
@@ -600,6 +2154,9 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_two_gaussian_distribution_test)
 	case GradErrorType::ItersOverflow:
 		cout << "ItersOverflow" << endl;
 		break;
+	case GradErrorType::TooManyParams:
+		cout << "TooManyParams" << endl;
+		break;
 	}
 
 	cout << "gd.GetLastCost() = " << gd.GetLastCost() << endl;
@@ -719,6 +2276,9 @@ BOOST_AUTO_TEST_CASE(tf_gd_lib_test_gd_mix_test)
 	case GradErrorType::ItersOverflow:
 		cout << "ItersOverflow" << endl;
 		break;
+	case GradErrorType::TooManyParams:
+		cout << "TooManyParams" << endl;
+		break;
 	}
 
 	cout << "gd.GetLastCost() = " << gd.GetLastCost() << endl;